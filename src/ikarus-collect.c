@@ -27,6 +27,10 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/time.h>
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#  include <signal.h>
+#endif
 
 
 /** --------------------------------------------------------------------
@@ -46,7 +50,12 @@
 #define meta_weak	3
 #define meta_pair	4
 #define meta_symbol	5
-#define meta_count	6
+#define meta_ephemeron	6
+#define meta_count	7
+
+/* Do not bother  spawning sweep jobs for page ranges  smaller than this
+   number of pages. */
+#define IK_GC_PARALLEL_MIN_PAGES	(16 * 1024)
 
 
 /** --------------------------------------------------------------------
@@ -66,18 +75,74 @@ typedef struct {
   ikptr base;
 } meta_t;
 
+/* A pending ephemeron; "next" is the index of the next node in the same
+   bucket, or -1. */
+typedef struct ephemeron_node_t {
+  ikptr		key;
+  ikptr		ephemeron;
+  long		next;
+} ephemeron_node_t;
+
 typedef struct gc_t {
   meta_t	meta[meta_count];
   qupages_t *	queues[meta_count];
   ikpcb*	pcb;
   unsigned *	segment_vector;
   int		collect_gen;
+  /* The  generation  receiving the  survivors:  usually the  one  after
+     "collect_gen", older when pretenuring. */
+  int		target_gen;
   int		collect_gen_tag;
   ikptr		tconc_ap;
   ikptr		tconc_ep;
   ikptr		tconc_base;
   ikpages *	tconc_queue;
   ik_ptr_page *	forward_list;
+  /* Number of bytes moved into the target generation: in total and for
+     each meta type. */
+  long		copied_bytes;
+  long		copied_meta[meta_count];
+  /* Number of dirty pages scanned and of guardian pairs inspected. */
+  long		dirty_pages;
+  long		guardians;
+  /* When not NULL: bitmap of the marked granules of pairs and symbols in
+     the oldest generation, covering the memory from "mark_base" included
+     to "mark_end" excluded. */
+  unsigned char *	mark_bits;
+  long		mark_bits_size;
+  ikptr		mark_base;
+  ikptr		mark_end;
+  /* True if  the survivors promoted into  the oldest generation can be
+     copied into the free slots of "pcb->mark_region_free_pairs" and
+     "pcb->mark_region_free_symbols".  Only when all the generations
+     younger than  the oldest are  collected:  the hole pages are not new,
+     so no dirty bits are recorded for their fields, which must not
+     reference objects left in a younger generation. */
+  int		reuse_holes;
+  /* Stack of marked objects whose fields have not yet been scanned; it
+     also holds the pairs copied into reused holes. */
+  ikptr *	mark_stack;
+  long		mark_stack_len;
+  long		mark_stack_size;
+  /* Ephemerons moved in this run whose  car is known to be live: their
+     cdr must be collected. */
+  ikptr *	ephemerons;
+  long		ephemerons_len;
+  long		ephemerons_size;
+  /* Ephemerons moved in this run whose car is not yet known to be live,
+     hashed by the address of  their car: when the car is moved or marked
+     its ephemerons are queued in "ephemerons". */
+  ephemeron_node_t *	ephemeron_nodes;
+  long		ephemeron_nodes_len;
+  long		ephemeron_nodes_size;
+  long *	ephemeron_buckets;
+  long		ephemeron_buckets_size;
+  long		ephemerons_pending;
+  /* Indexes of  the weak table buckets holding  the ephemerons whose car
+     was found dead in this run; see "break_ephemerons()". */
+  long *	broken_buckets;
+  long		broken_buckets_len;
+  long		broken_buckets_size;
 } gc_t;
 
 
@@ -89,9 +154,29 @@ static void	handle_guardians	(gc_t* gc);
 static void	gc_finalize_guardians	(gc_t* gc);
 static ikptr	meta_alloc_extending	(long size, gc_t* gc, int meta_id);
 static int	collection_id_to_gen	(int id);
+static int	collection_gen_adaptive	(ikpcb * pcb);
+static void	update_gen_statistics	(gc_t * gc, long nursery_bytes);
+static void	adapt_nursery_size	(ikpcb * pcb, unsigned long mem_req, struct timeval * start, struct timeval * end);
+static int	limit_gen_by_pause	(ikpcb * pcb, int gen);
+static inline int next_gen		(int i);
+static void	update_gen_pause	(ikpcb * pcb, int gen, struct timeval * start, struct timeval * end);
+static void	record_gc_event		(gc_t * gc, long heap_before, struct timeval * start, struct timeval * end);
+
+static void	mark_region_init	(gc_t * gc);
+static void	mark_region_final	(gc_t * gc);
+static ikptr	mark_object		(gc_t * gc, ikptr X, int tag, unsigned segment_bits);
+static void	drain_mark_stack	(gc_t * gc);
+static void	sweep_mark_region_pages	(gc_t * gc);
+static void	collect_mark_region_holes (gc_t * gc);
 
 static void ik_munmap_from_segment (ikptr base, ik_ulong size, ikpcb* pcb);
 
+/* A function sweeping the slots  of the page tables from LO_IDX included
+   to HI_IDX excluded. */
+typedef void gc_sweep_fun_t (gc_t * gc, long lo_idx, long hi_idx);
+
+static void	gc_parallel_sweep	(gc_t * gc, gc_sweep_fun_t * fun);
+
 
 /** --------------------------------------------------------------------
  ** Global variables.
@@ -113,6 +198,9 @@ static int string_count		= 0;
 static int htable_count		= 0;
 #endif
 
+/* The granule of the mark bitmap is the alignment of objects. */
+#define IK_GC_GRANULE_SIZE	(2 * wordsize)
+
 static int extension_amount[meta_count] = {
   1 * IK_PAGESIZE,
   1 * IK_PAGESIZE,
@@ -120,6 +208,7 @@ static int extension_amount[meta_count] = {
   1 * IK_PAGESIZE,
   1 * IK_PAGESIZE,
   1 * IK_PAGESIZE,
+  1 * IK_PAGESIZE,
 };
 
 static unsigned int meta_mt[meta_count] = {
@@ -127,8 +216,9 @@ static unsigned int meta_mt[meta_count] = {
   code_mt,
   data_mt,
   weak_pairs_mt,
-  pointers_mt,
-  symbols_mt
+  pointers_mt | pairs_page_tag,
+  symbols_mt,
+  ephemerons_mt
 };
 
 static unsigned int
@@ -153,7 +243,10 @@ ik_munmap_from_segment (ikptr base, ik_ulong size, ikpcb* pcb)
 
    - Mark all its pages as pure in the dirty vector.
 
-   - Either register it in the uncached pages or unmap it. */
+   - Either register it in the cached pages or unmap it.
+
+   Cached pages are left resident; "ik_release_cached_pages()" returns
+   to the OS those above the high-water mark. */
 {
   assert(base >= pcb->memory_base);
   assert((base+size) <= pcb->memory_end);
@@ -167,6 +260,7 @@ ik_munmap_from_segment (ikptr base, ik_ulong size, ikpcb* pcb)
       *segme = hole_mt;
       *dirty = 0;
     }
+    pcb->heap_pages_count -= IK_PAGE_INDEX(size);
   }
   {
     ikpage *	UNcache = pcb->uncached_pages;
@@ -182,6 +276,8 @@ ik_munmap_from_segment (ikptr base, ik_ulong size, ikpcb* pcb)
 	UNcache		= next;
 	base		+= IK_PAGESIZE;
 	size		-= IK_PAGESIZE;
+	++(pcb->cached_pages_count);
+	++(pcb->cached_pages_resident);
       } while (UNcache && size);
       pcb->cached_pages   = cache;
       pcb->uncached_pages = UNcache;
@@ -193,6 +289,15 @@ ik_munmap_from_segment (ikptr base, ik_ulong size, ikpcb* pcb)
 }
 
 
+static inline void
+count_copied (gc_t * gc, int meta_id, long size)
+/* Account SIZE bytes moved into the target generation in pages of META_ID
+   type. */
+{
+  gc->copied_bytes		+= size;
+  gc->copied_meta[meta_id]	+= size;
+}
+
 static ikptr
 meta_alloc_extending (long size, gc_t* gc, int meta_id)
 {
@@ -236,6 +341,7 @@ meta_alloc (long aligned_size, gc_t* gc, int meta_id)
   ikptr		ap   = meta->ap;
   ikptr		ep   = meta->ep;
   ikptr		nap  = ap + aligned_size;
+  count_copied(gc, meta_id, aligned_size);
   if (nap > ep) {
     return meta_alloc_extending(aligned_size, gc, meta_id);
   } else {
@@ -256,6 +362,7 @@ gc_alloc_new_large_ptr (int size, gc_t* gc)
   ikptr		mem;
   qupages_t *	p;
   memreq = IK_ALIGN_TO_NEXT_PAGE(size);
+  count_copied(gc, meta_ptrs, size);
   mem = ik_mmap_typed(memreq, pointers_mt | large_object_tag | gc->collect_gen_tag, gc->pcb);
   gc->segment_vector = gc->pcb->segment_vector;
   p    = ik_malloc(sizeof(qupages_t));
@@ -272,6 +379,7 @@ enqueue_large_ptr (ikptr mem, int size, gc_t* gc)
   long		i;
   long		j;
   qupages_t *	p;
+  count_copied(gc, meta_ptrs, size);
   for (i = IK_PAGE_INDEX(mem), j = IK_PAGE_INDEX(mem+size-1); i<=j; ++i)
     gc->segment_vector[i] = pointers_mt | large_object_tag | gc->collect_gen_tag;
   p    = ik_malloc(sizeof(qupages_t));
@@ -281,31 +389,76 @@ enqueue_large_ptr (ikptr mem, int size, gc_t* gc)
   gc->queues[meta_ptrs] = p;
 }
 static inline ikptr
+gc_alloc_new_large_data (long size, gc_t* gc)
+/* Allocate a  run of pages  to hold a single  data object of  SIZE bytes,
+   like a big string or bytevector.   The pages are marked as large object
+   pages: in the following collections the object is not copied; rather
+   the pages are retagged with "retag_large_data()". */
+{
+  long		memreq = IK_ALIGN_TO_NEXT_PAGE(size);
+  ikptr		mem;
+  count_copied(gc, meta_data, size);
+  mem = ik_mmap_typed(memreq, data_mt | large_object_tag | gc->collect_gen_tag, gc->pcb);
+  gc->segment_vector = gc->pcb->segment_vector;
+  return mem;
+}
+static inline void
+retag_large_data (ikptr mem, long size, gc_t* gc)
+/* Move to  the target generation the  large data object of  SIZE bytes
+   starting at  MEM, by  updating the segment  vector of its pages.  Data
+   pages are not scanned, so they are not enqueued. */
+{
+  long		i;
+  long		j;
+  count_copied(gc, meta_data, size);
+  for (i = IK_PAGE_INDEX(mem), j = IK_PAGE_INDEX(mem+size-1); i<=j; ++i)
+    gc->segment_vector[i] = data_mt | large_object_tag | gc->collect_gen_tag;
+}
+static inline ikptr
 gc_alloc_new_symbol_record (gc_t* gc)
 {
   assert(symbol_record_size == IK_ALIGN(symbol_record_size));
+  if (gc->reuse_holes && gc->pcb->mark_region_free_symbols) {
+    ikptr	mem = gc->pcb->mark_region_free_symbols;
+    gc->pcb->mark_region_free_symbols = ref(mem, 0);
+    count_copied(gc, meta_symbol, symbol_record_size);
+    return mem;
+  }
   return meta_alloc(symbol_record_size, gc, meta_symbol);
 }
 
 
 
 
+static void mark_stack_push (gc_t * gc, ikptr X);
+
 static inline ikptr
 gc_alloc_new_pair(gc_t* gc) {
+  if (gc->reuse_holes && gc->pcb->mark_region_free_pairs) {
+    /* The pair is not in a queued page: its fields are scanned from the
+       mark stack. */
+    ikptr	mem = gc->pcb->mark_region_free_pairs;
+    gc->pcb->mark_region_free_pairs = ref(mem, 0);
+    count_copied(gc, meta_pair, pair_size);
+    mark_stack_push(gc, mem | pair_tag);
+    return mem;
+  }
   return meta_alloc(pair_size, gc, meta_pair);
 }
 
 
 
 static inline ikptr
-gc_alloc_new_weak_pair(gc_t* gc) {
-  meta_t* meta = &gc->meta[meta_weak];
+gc_alloc_new_weak_pair(gc_t* gc, int meta_id) {
+  /* META_ID is either meta_weak or meta_ephemeron. */
+  meta_t* meta = &gc->meta[meta_id];
   ikptr ap = meta->ap;
   ikptr ep = meta->ep;
   ikptr nap = ap + pair_size;
+  count_copied(gc, meta_id, pair_size);
   if (nap > ep) {
       ikptr mem = ik_mmap_typed(IK_PAGESIZE,
-				meta_mt[meta_weak] | gc->collect_gen_tag,
+				meta_mt[meta_id] | gc->collect_gen_tag,
 				gc->pcb);
       gc->segment_vector = gc->pcb->segment_vector;
       meta->ap = mem + pair_size;
@@ -341,6 +494,7 @@ gc_alloc_new_code (long aligned_size, gc_t* gc)
     long	memreq	= IK_ALIGN_TO_NEXT_PAGE(aligned_size);
     ikptr	mem	= ik_mmap_code(memreq, gc->collect_gen, gc->pcb);
     qupages_t *	p;
+    count_copied(gc, meta_code, aligned_size);
     /* FIXME In this function we never access the "segment_vector" field
        of  "gc", do  we  need  this assignment?   (Marco  Maggi; Oct  5,
        2012) */
@@ -403,16 +557,27 @@ gc_tconc_push(gc_t* gc, ikptr tcbucket) {
 /* #define DEBUG_ADD_OBJECT	1 */
 #if (((defined VICARE_DEBUGGING) && (defined VICARE_DEBUGGING_GC)) || (defined DEBUG_ADD_OBJECT))
 static ikptr add_object_proc(gc_t* gc, ikptr x, char* caller);
+static ikptr move_object_proc(gc_t* gc, ikptr x, char* caller);
 #define add_object(gc,x,caller) add_object_proc(gc,x,caller)
+#define move_object(gc,x,caller) move_object_proc(gc,x,caller)
 #else
 static ikptr add_object_proc(gc_t* gc, ikptr x);
+static ikptr move_object_proc(gc_t* gc, ikptr x);
 #define add_object(gc,x,caller) add_object_proc(gc,x)
+#define move_object(gc,x,caller) move_object_proc(gc,x)
 #endif
 
 static void collect_stack(gc_t*, ikptr top, ikptr base);
 static void collect_locatives(gc_t*, ik_callback_locative*);
+static void collect_alloc_samples(gc_t*);
 static void collect_loop(gc_t*);
 static void fix_weak_pointers(gc_t*);
+static void push_ephemeron(gc_t*, ikptr);
+static void ephemeron_key_live(gc_t*, ikptr);
+static int  collect_ephemerons(gc_t*);
+static void break_ephemerons(gc_t*);
+static void queue_broken_bucket(gc_t*, ikptr);
+static void clear_ephemeron_tables(gc_t*);
 static void gc_add_tconcs(gc_t*);
 
 /* ik_collect is called from scheme under the following conditions:
@@ -447,10 +612,15 @@ static void fix_new_pages(gc_t* gc);
 ikptr
 ik_collect_check (unsigned long req, ikpcb* pcb)
 /* Check if there  are REQ bytes already allocated and  available on the
-   heap; return #t if there are, run a GC and return #f otherwise. */
+   heap; return #t if there are, run a GC and return #f otherwise.
+
+   This  is also the  entry point of  the overflow handler:  when the
+   allocation profiler is enabled, the compiled code calls it whenever a
+   sampling point is reached. */
 {
-  long bytes = ((long)pcb->allocation_redline) - ((long)pcb->allocation_pointer);
-  if (bytes >= req) {
+  long bytes = ((long)pcb->heap_redline) - ((long)pcb->allocation_pointer);
+  ik_alloc_sample_record(pcb);
+  if (bytes >= (long)req) {
     return IK_TRUE_OBJECT;
   } else {
     ik_collect(req, pcb);
@@ -477,9 +647,12 @@ ik_collect (unsigned long mem_req, ikpcb* pcb)
 #if (0 || (defined VICARE_DEBUGGING) && (defined VICARE_DEBUGGING_GC))
   ik_verify_integrity(pcb, "entry");
 #endif
+  long			nursery_bytes;
+  long			heap_before = ik_heap_bytes(pcb);
   { /* accounting */
     long bytes = ((long)pcb->allocation_pointer) - ((long)pcb->heap_base);
     add_to_collect_count(pcb, bytes);
+    nursery_bytes = bytes;
   }
   struct rusage		t0, t1;		/* for GC statistics */
   struct timeval	rt0, rt1;	/* for GC statistics */
@@ -493,9 +666,27 @@ ik_collect (unsigned long mem_req, ikpcb* pcb)
   bzero(&gc, sizeof(gc_t));
   gc.pcb		= pcb;
   gc.segment_vector	= pcb->segment_vector;
-  gc.collect_gen	= collection_id_to_gen(pcb->collection_id);
-  gc.collect_gen_tag	= next_gen_tag[gc.collect_gen];
+  gc.collect_gen	= (IK_GC_POLICY_ADAPTIVE == pcb->collect_policy)?
+    collection_gen_adaptive(pcb) : collection_id_to_gen(pcb->collection_id);
+  gc.collect_gen	= limit_gen_by_pause(pcb, gc.collect_gen);
+  if (pcb->collect_major_request) {
+    gc.collect_gen		 = generation_count-1;
+    pcb->collect_major_request = 0;
+  }
+  gc.target_gen		= next_gen(gc.collect_gen);
+  if (pcb->pretenure_generation > gc.target_gen)
+    gc.target_gen	= pcb->pretenure_generation;
+  gc.collect_gen_tag	= next_gen_tag[gc.target_gen - 1];
   pcb->collection_id++;
+  if ((generation_count-1) == gc.collect_gen) {
+    /* The pages holding the free slots may be released or marked anew. */
+    pcb->mark_region_free_pairs		= 0;
+    pcb->mark_region_free_symbols	= 0;
+    if (pcb->collect_mark_region)
+      mark_region_init(&gc);
+  } else
+    gc.reuse_holes = ((generation_count-1) == gc.target_gen) &&
+      (gc.target_gen == next_gen(gc.collect_gen));
 #if ((defined VICARE_DEBUGGING) && (defined VICARE_DEBUGGING_GC))
   ik_debug_message("ik_collect entry %ld free=%ld (collect gen=%d/id=%d)",
 		   mem_req, pcb->allocation_redline - pcb->allocation_pointer,
@@ -504,22 +695,23 @@ ik_collect (unsigned long mem_req, ikpcb* pcb)
   /* cache heap-pages to delete later */
   old_heap_pages = pcb->heap_pages;
   pcb->heap_pages = 0;
+  { /* the full heap segments are part of the nursery, too */
+    ikpages *	p;
+    for (p = old_heap_pages; p; p = p->next)
+      nursery_bytes += p->size;
+  }
   /* scan GC roots */
   scan_dirty_pages(&gc);
   collect_stack(&gc, pcb->frame_pointer, pcb->frame_base - wordsize);
   /* ik_print_stack_frame_code_objects(stderr, 3, pcb); */
   collect_locatives(&gc, pcb->callbacks);
+  collect_alloc_samples(&gc);
   { /* Scan the collection of words not to be collected because they are
        referenced somewhere outside the Scheme heap and stack. */
-    ik_gc_avoidance_collection_t *	C = pcb->not_to_be_collected;
-    while (C) {
-      int	i;
-      for (i=0; i<IK_GC_AVOIDANCE_ARRAY_LEN; ++i) {
-	if (C->slots[i])
-	  C->slots[i] = add_object(&gc, C->slots[i], "not_to_be_collected");
-      }
-      C = C->next;
-    }
+    ik_gc_avoidance_registry_t *	R = &(pcb->not_to_be_collected);
+    long	i;
+    for (i=0; i<R->live_count; ++i)
+      R->live[i]->obj = add_object(&gc, R->live[i]->obj, "not_to_be_collected");
 #if 0 /* This is the  old implementation, when the "not  to be collected
 	 list" was an actual Scheme list. */
     pcb->not_to_be_collected =
@@ -531,6 +723,7 @@ ik_collect (unsigned long mem_req, ikpcb* pcb)
   pcb->gensym_table	= add_object(&gc, pcb->gensym_table,	"gensym_table");
   pcb->arg_list		= add_object(&gc, pcb->arg_list,	"args_list_foo");
   pcb->base_rtd		= add_object(&gc, pcb->base_rtd,	"base_rtd");
+  pcb->ephemeron_tables	= add_object(&gc, pcb->ephemeron_tables, "ephemeron_tables");
   if (pcb->root0) *(pcb->root0) = add_object(&gc, *(pcb->root0), "root0");
   if (pcb->root1) *(pcb->root1) = add_object(&gc, *(pcb->root1), "root1");
   if (pcb->root2) *(pcb->root2) = add_object(&gc, *(pcb->root2), "root2");
@@ -541,6 +734,19 @@ ik_collect (unsigned long mem_req, ikpcb* pcb)
   if (pcb->root7) *(pcb->root7) = add_object(&gc, *(pcb->root7), "root7");
   if (pcb->root8) *(pcb->root8) = add_object(&gc, *(pcb->root8), "root8");
   if (pcb->root9) *(pcb->root9) = add_object(&gc, *(pcb->root9), "root9");
+  {
+    long	i;
+    for (i=0; i<pcb->root_stack_count; ++i)
+      *(pcb->root_stack[i]) = add_object(&gc, *(pcb->root_stack[i]), "root_stack");
+  }
+  { /* The guardian pairs not yet delivered keep their tconc and object
+       alive until "ikrt_deliver_guardians()" appends them. */
+    ik_ptr_page *	ls;
+    int			i;
+    for (ls = pcb->guardians_pending; ls; ls = ls->next)
+      for (i=0; i<ls->count; ++i)
+	ls->ptr[i] = add_object(&gc, ls->ptr[i], "guardians_pending");
+  }
   /* trace all live objects */
   collect_loop(&gc);
   /* next   all   guardian/guarded  objects,   the   procedure  does   a
@@ -552,11 +758,20 @@ ik_collect (unsigned long mem_req, ikpcb* pcb)
   collect_loop(&gc);
   /* does not allocate, only BWP's dead pointers */
   fix_weak_pointers(&gc);
+  break_ephemerons(&gc);
+  /* retain the pages holding marked objects */
+  if (gc.mark_bits) {
+    sweep_mark_region_pages(&gc);
+    collect_mark_region_holes(&gc);
+  }
+  mark_region_final(&gc);
   /* now deallocate all unused pages */
   deallocate_unused_pages(&gc);
 
   fix_new_pages(&gc);
   gc_finalize_guardians(&gc);
+  /* unlinks the dead entries of weak tables, does not allocate */
+  clear_ephemeron_tables(&gc);
 
   pcb->allocation_pointer = pcb->heap_base;
   /* does not allocate */
@@ -566,6 +781,14 @@ ik_collect (unsigned long mem_req, ikpcb* pcb)
 #endif
   pcb->weak_pairs_ap = 0;
   pcb->weak_pairs_ep = 0;
+  pcb->ephemerons_ap = 0;
+  pcb->ephemerons_ep = 0;
+  { /* The nursery is reused: empty the allocation buffers. */
+    ik_alloc_buffer *	buf;
+    for (buf = pcb->alloc_buffers; buf; buf = buf->next)
+      buf->ap = buf->ep = 0;
+  }
+  update_gen_statistics(&gc, nursery_bytes);
 #if ACCOUNTING
 #if ((defined VICARE_DEBUGGING) && (defined VICARE_DEBUGGING_GC))
   ik_debug_message("[%d cons|%d sym|%d cls|%d vec|%d rec|%d cck|%d str|%d htb]\n",
@@ -597,29 +820,33 @@ ik_collect (unsigned long mem_req, ikpcb* pcb)
     } while(p);
     old_heap_pages = 0;
   }
+  ik_release_cached_pages(pcb);
   unsigned long free_space =
-    ((unsigned long)pcb->allocation_redline) -
+    ((unsigned long)pcb->heap_redline) -
     ((unsigned long)pcb->allocation_pointer);
-  if ((free_space <= mem_req) || (pcb->heap_size < IK_HEAPSIZE)) {
+  long	memsize = (mem_req > pcb->nursery_size) ? mem_req : pcb->nursery_size;
+  memsize = IK_ALIGN_TO_NEXT_PAGE(memsize);
+  /* Reallocate the nursery if  it is too small for the request or if its
+     size was adapted. */
+  if ((free_space <= mem_req) || (pcb->heap_size != (memsize + 2 * IK_PAGESIZE))) {
 #if ((defined VICARE_DEBUGGING) && (defined VICARE_DEBUGGING_GC))
     fprintf(stderr, "REQ=%ld, got %ld\n", mem_req, free_space);
 #endif
-    long	memsize = (mem_req > IK_HEAPSIZE) ? mem_req : IK_HEAPSIZE;
     long	new_heap_size;
     ikptr	ptr;
-    memsize	  = IK_ALIGN_TO_NEXT_PAGE(memsize);
     new_heap_size = memsize + 2 * IK_PAGESIZE;
     ik_munmap_from_segment(pcb->heap_base, pcb->heap_size, pcb);
     ptr = ik_mmap_mixed(new_heap_size, pcb);
     pcb->allocation_pointer = ptr;
-    pcb->allocation_redline = ptr+memsize;
+    pcb->heap_redline = ptr+memsize;
     pcb->heap_base = ptr;
     pcb->heap_size = new_heap_size;
   }
+  ik_alloc_sample_arm(pcb);
 #if ((defined VICARE_DEBUGGING) && (defined VICARE_DEBUGGING_GC))
   { /* reset the free space to a magic number */
     ikptr	x;
-    for (x = pcb->allocation_pointer; x < pcb->allocation_redline; x += wordsize)
+    for (x = pcb->allocation_pointer; x < pcb->heap_redline; x += wordsize)
       ref(x, 0) = (ikptr)(0x1234FFFF);
   }
 #endif
@@ -657,9 +884,17 @@ ik_collect (unsigned long mem_req, ikpcb* pcb)
       pcb->collect_rtime.tv_sec  -= 1;
     }
   }
+  update_gen_pause(pcb, gc.collect_gen, &rt0, &rt1);
+  record_gc_event(&gc, heap_before, &rt0, &rt1);
+  adapt_nursery_size(pcb, mem_req, &rt0, &rt1);
   /* fprintf(stderr, "%s: leave\n", __func__); */
   return pcb;
 }
+static inline int
+next_gen (int i)
+{
+  return ((i == (generation_count-1)) ? i : (i+1));
+}
 static int
 collection_id_to_gen (int id)
 /* Subroutine  of "ik_collect()".   Convert  a collection  counter to  a
@@ -671,8 +906,367 @@ collection_id_to_gen (int id)
   if ((id &   3) == 3)   { return 1; }
   return 0;
 }
+static int
+collection_gen_adaptive (ikpcb * pcb)
+/* Subroutine of "ik_collect()".  Select the oldest generation whose
+   occupancy  exceeds  its threshold.  The threshold of  the younger
+   generations is enlarged proportionally to the survival rate of their
+   last  collection: collecting a  generation in  which most  objects
+   survive is  wasted work.  The threshold  of the oldest  generation is
+   at least twice the  size of the data surviving its last collection,
+   so that major collections happen  at a frequency proportional to the
+   size of the live data. */
+{
+  int	gen;
+  long	threshold;
+  for (gen=generation_count-1; gen>0; --gen) {
+    threshold = pcb->gen_threshold[gen];
+    if (generation_count-1 == gen) {
+      if (threshold < 2 * pcb->gen_major_live)
+	threshold = 2 * pcb->gen_major_live;
+    } else
+      threshold += (threshold / 1000) * pcb->gen_survival[gen];
+    if (pcb->gen_occupancy[gen] >= threshold)
+      return gen;
+  }
+  return 0;
+}
+static void
+update_gen_statistics (gc_t * gc, long nursery_bytes)
+/* Subroutine of "ik_collect()".   Update the occupancy  and survival
+   statistics  of the generations after  collecting generations from 0
+   to "gc->collect_gen"; NURSERY_BYTES must be the number of bytes that
+   were allocated in the nursery before the collection. */
+{
+  ikpcb *	pcb	= gc->pcb;
+  int		gen	= gc->collect_gen;
+  long		collected = nursery_bytes;
+  int		i;
+  for (i=1; i<=gen; ++i) {
+    collected += pcb->gen_occupancy[i];
+    pcb->gen_occupancy[i] = 0;
+  }
+  pcb->gen_occupancy[gc->target_gen] += gc->copied_bytes;
+  if (collected > 0) {
+    long	rate = (gc->copied_bytes / (collected / 1000 + 1));
+    pcb->gen_survival[gen] = (rate > 1000)? 1000 : (int)rate;
+  }
+  if (generation_count-1 == gen)
+    pcb->gen_major_live = gc->copied_bytes;
+}
+static int
+limit_gen_by_pause (ikpcb * pcb, int gen)
+/* Subroutine of "ik_collect()".   Given the selected generation GEN: if
+   the average pause of its collections exceeds the pause target, select
+   the  next  younger  generation,  and so on.  A  generation  can be
+   postponed at  most IK_GC_MAX_DEFERRALS consecutive times, then it is
+   collected regardless of the  target; so the older generations are
+   still collected, less frequently.  This only schedules collections:
+   the selected generations are still collected in a single pause. */
+{
+  if (pcb->collect_pause_target) {
+    while ((gen > 0) &&
+	   (pcb->gen_pause[gen] > pcb->collect_pause_target) &&
+	   (pcb->gen_deferrals[gen] < IK_GC_MAX_DEFERRALS)) {
+      ++(pcb->gen_deferrals[gen]);
+      --gen;
+    }
+  }
+  return gen;
+}
+static void
+update_gen_pause (ikpcb * pcb, int gen, struct timeval * start, struct timeval * end)
+/* Subroutine of "ik_collect()".  Update the moving average of the pause
+   caused by collecting GEN, which ran from START to END. */
+{
+  long	usecs = 1000000 * (end->tv_sec - start->tv_sec) + (end->tv_usec - start->tv_usec);
+  int	i;
+  if (usecs < 0)
+    return;
+  /* Give the last sample a weight of 1/4. */
+  pcb->gen_pause[gen] = (pcb->gen_pause[gen])? ((3 * pcb->gen_pause[gen] + usecs) / 4) : usecs;
+  for (i=0; i<=gen; ++i)
+    pcb->gen_deferrals[i] = 0;
+}
+static void
+record_gc_event (gc_t * gc, long heap_before, struct timeval * start, struct timeval * end)
+/* Subroutine of  "ik_collect()".  Store in the ring buffer of the PCB the
+   record describing the current collection. */
+{
+  ikpcb *	pcb   = gc->pcb;
+  ik_gc_event *	event = &(pcb->gc_events[pcb->gc_events_count % IK_GC_EVENTS_COUNT]);
+  event->collection_id		= pcb->collection_id - 1;
+  event->generation		= gc->collect_gen;
+  event->pause			= 1000000 * (end->tv_sec - start->tv_sec) + (end->tv_usec - start->tv_usec);
+  event->heap_before		= heap_before;
+  event->heap_after		= ik_heap_bytes(gc->pcb);
+  event->dirty_pages		= gc->dirty_pages;
+  event->bytes_scanned		= gc->dirty_pages * IK_PAGESIZE + gc->copied_bytes;
+  event->guardians		= gc->guardians;
+  event->copied_pairs		= gc->copied_meta[meta_pair];
+  event->copied_symbols		= gc->copied_meta[meta_symbol];
+  event->copied_pointers	= gc->copied_meta[meta_ptrs];
+  event->copied_data		= gc->copied_meta[meta_data];
+  event->copied_code		= gc->copied_meta[meta_code];
+  event->copied_weak_pairs	= gc->copied_meta[meta_weak] + gc->copied_meta[meta_ephemeron];
+  ++(pcb->gc_events_count);
+}
+static void
+adapt_nursery_size (ikpcb * pcb, unsigned long mem_req, struct timeval * start, struct timeval * end)
+/* Subroutine of "ik_collect()".  START and END  must be the timestamps of
+   the  beginning and end of the  current collection.  Update the moving
+   average of  the fraction of real  time spent collecting and  double or
+   halve the size of the nursery when it leaves the range around the
+   target;  the new size is used when  the nursery is reallocated  at the
+   end of the next collection.  The nursery is never halved below MEM_REQ,
+   the number of bytes requested by the allocation that triggered this
+   collection. */
+{
+  long	gc_usecs  = 1000000 * (end->tv_sec - start->tv_sec) + (end->tv_usec - start->tv_usec);
+  long	mut_usecs = 1000000 * (start->tv_sec - pcb->collect_last_end.tv_sec)
+    + (start->tv_usec - pcb->collect_last_end.tv_usec);
+  int	ratio;
+  pcb->collect_last_end = *end;
+  if ((0 == pcb->collect_time_target) || (gc_usecs < 0) || (mut_usecs < 0) || (0 == (gc_usecs + mut_usecs)))
+    return;
+  ratio = (int)((1000.0 * gc_usecs) / (gc_usecs + mut_usecs));
+  /* Give the last sample a weight of 1/4. */
+  pcb->collect_time_ratio = (3 * pcb->collect_time_ratio + ratio) / 4;
+  /* When the size changes: the average is scaled to the frequency of
+     collections expected with the new size, to avoid overshooting. */
+  if (pcb->collect_time_ratio > pcb->collect_time_target) {
+    /* Do not grow the nursery if  its collection is already near the pause
+       target. */
+    if ((pcb->nursery_size < IK_NURSERY_MAX_SIZE) &&
+	((0 == pcb->collect_pause_target) || (2 * pcb->gen_pause[0] < pcb->collect_pause_target))) {
+      pcb->nursery_size       *= 2;
+      pcb->collect_time_ratio /= 2;
+    }
+  } else if (pcb->collect_time_ratio < pcb->collect_time_target / 4) {
+    if ((pcb->nursery_size > IK_NURSERY_MIN_SIZE) && ((unsigned long)(pcb->nursery_size / 2) >= mem_req)) {
+      pcb->nursery_size       /= 2;
+      pcb->collect_time_ratio *= 2;
+    }
+  }
+}
 
 
+/** --------------------------------------------------------------------
+ ** Non-moving collection of pairs and symbols in the oldest generation.
+ ** ----------------------------------------------------------------- */
+
+/* When "pcb->collect_mark_region"  is true: a collection of  the oldest
+   generation does not copy the pairs and symbol records living in the
+   old pages of such generation;  rather it marks them in a bitmap with
+   one bit for each granule of memory, then scans their fields.
+
+   At the end of  the collection: the pages holding  at least one marked
+   granule are retained  and promoted as if they were  new pages; in such
+   pages the unmarked granules, which  belong to dead objects, are filled
+   with fixnum zero  so that the dirty cards scan  finds no dangling
+   references.   Pages with  no marked  granules are released  as usual by
+   "deallocate_unused_pages()".
+
+   Pairs pages  and symbols  pages can be  handled this way  because they
+   only hold objects of a single size, aligned to the granule.
+
+   The  free slots of the retained  pages are then linked in the lists
+   "pcb->mark_region_free_pairs" and "pcb->mark_region_free_symbols":
+   the following younger collections  promoting survivors into the oldest
+   generation copy them into these  slots, before allocating new pages.
+   The link in the first word of a free slot is a granule-aligned address,
+   so it looks like a fixnum to the dirty cards scan. */
+
+static inline int
+is_mark_region_type (unsigned segment_bits)
+/* Return true if the page  with SEGMENT_BITS is a pairs or symbols page of
+   the oldest generation. */
+{
+  return (((generation_count-1) == (segment_bits & gen_mask)) &&
+	  ((symbols_type == (segment_bits & type_mask)) ||
+	   (pairs_page_tag == (segment_bits & pairs_page_mask))));
+}
+static inline int
+is_mark_region_page (gc_t * gc, unsigned segment_bits)
+/* Return true if  the page with SEGMENT_BITS holds objects  that must be
+   marked rather than copied; the pages allocated in this run are not. */
+{
+  return (gc->mark_bits &&
+	  (0 == (segment_bits & new_gen_mask)) &&
+	  is_mark_region_type(segment_bits));
+}
+static inline int
+is_marked (gc_t * gc, ikptr X)
+/* Return true if the tagged pointer X references a marked object. */
+{
+  ikptr	p = X - IK_TAGOF(X);
+  long	idx;
+  if ((NULL == gc->mark_bits) || (p < gc->mark_base) || (p >= gc->mark_end))
+    return 0;
+  idx = (p - gc->mark_base) / IK_GC_GRANULE_SIZE;
+  return (gc->mark_bits[idx >> 3] & (1 << (idx & 7)))? 1 : 0;
+}
+static void
+mark_region_init (gc_t * gc)
+/* Allocate the  bitmap covering the pages  from the first to the last
+   pairs or symbols page of the  oldest generation; if there are no such
+   pages: leave "gc->mark_bits" set to NULL. */
+{
+  ikpcb *	pcb	    = gc->pcb;
+  unsigned *	segment_vec = pcb->segment_vector;
+  long		lo_idx	    = IK_PAGE_INDEX(pcb->memory_base);
+  long		hi_idx	    = IK_PAGE_INDEX(pcb->memory_end);
+  for (; (lo_idx < hi_idx) && (! is_mark_region_type(segment_vec[lo_idx])); ++lo_idx);
+  for (; (lo_idx < hi_idx) && (! is_mark_region_type(segment_vec[hi_idx-1])); --hi_idx);
+  if (lo_idx == hi_idx)
+    return;
+  gc->mark_base		= (ikptr)(lo_idx << IK_PAGESHIFT);
+  gc->mark_end		= (ikptr)(hi_idx << IK_PAGESHIFT);
+  gc->mark_bits_size	= (gc->mark_end - gc->mark_base) / (IK_GC_GRANULE_SIZE * 8);
+  gc->mark_bits		= ik_malloc(gc->mark_bits_size);
+  bzero(gc->mark_bits, gc->mark_bits_size);
+}
+static void
+mark_region_final (gc_t * gc)
+{
+  if (gc->mark_bits)
+    ik_free(gc->mark_bits, gc->mark_bits_size);
+  if (gc->mark_stack)
+    ik_free(gc->mark_stack, gc->mark_stack_size * sizeof(ikptr));
+  gc->mark_bits		= NULL;
+  gc->mark_stack	= NULL;
+}
+static void
+mark_stack_push (gc_t * gc, ikptr X)
+/* Push the tagged pointer X on the stack of objects whose fields must be
+   scanned, allocating or enlarging the stack as needed. */
+{
+  if (NULL == gc->mark_stack) {
+    gc->mark_stack_size	= IK_PAGESIZE / sizeof(ikptr);
+    gc->mark_stack	= ik_malloc(gc->mark_stack_size * sizeof(ikptr));
+    gc->mark_stack_len	= 0;
+  } else if (gc->mark_stack_len == gc->mark_stack_size) {
+    ikptr *	stack = ik_malloc(2 * gc->mark_stack_size * sizeof(ikptr));
+    memcpy(stack, gc->mark_stack, gc->mark_stack_size * sizeof(ikptr));
+    ik_free(gc->mark_stack, gc->mark_stack_size * sizeof(ikptr));
+    gc->mark_stack	 = stack;
+    gc->mark_stack_size *= 2;
+  }
+  gc->mark_stack[gc->mark_stack_len++] = X;
+}
+static ikptr
+mark_object (gc_t * gc, ikptr X, int tag, unsigned segment_bits)
+/* Mark the  pair or symbol record  referenced by the tagged  pointer X
+   and push it on the mark stack; return X itself. */
+{
+  ikptr	p	= X - tag;
+  long	idx	= (p - gc->mark_base) / IK_GC_GRANULE_SIZE;
+  long	size	= (symbols_type == (segment_bits & type_mask))? symbol_record_size : pair_size;
+  long	last	= idx + size / IK_GC_GRANULE_SIZE;
+  if (gc->mark_bits[idx >> 3] & (1 << (idx & 7)))
+    return X;
+  for (; idx < last; ++idx)
+    gc->mark_bits[idx >> 3] |= (1 << (idx & 7));
+  if (gc->ephemerons_pending)
+    ephemeron_key_live(gc, X);
+  count_copied(gc, (symbols_type == (segment_bits & type_mask))? meta_symbol : meta_pair, size);
+  mark_stack_push(gc, X);
+  return X;
+}
+static void
+drain_mark_stack (gc_t * gc)
+/* Apply "add_object()" to the fields  of the objects in the mark stack,
+   until it is empty. */
+{
+  while (gc->mark_stack_len) {
+    ikptr	X = gc->mark_stack[--gc->mark_stack_len];
+    if (pair_tag == IK_TAGOF(X)) {
+      IK_CAR(X) = add_object(gc, IK_CAR(X), "mark");
+      IK_CDR(X) = add_object(gc, IK_CDR(X), "mark");
+    } else {
+      ikptr	p = X - IK_TAGOF(X);
+      long	i;
+      for (i=0; i<symbol_record_size; i+=wordsize)
+	ref(p, i) = add_object(gc, ref(p, i), "mark");
+    }
+  }
+}
+static void
+sweep_mark_region_range (gc_t * gc, long lo_idx, long hi_idx)
+/* Retain the pages, from LO_IDX included  to HI_IDX excluded, holding at
+   least one marked object; fill  with fixnum zero the unmarked granules in
+   them.  Only the  slots and words of such pages are  mutated, so this
+   function can be applied concurrently to disjoint ranges. */
+{
+  unsigned *	segment_vec	= gc->pcb->segment_vector;
+  unsigned *	dirty_vec	= (unsigned *)(long)gc->pcb->dirty_vector;
+  long		bytes_per_page	= IK_PAGESIZE / (IK_GC_GRANULE_SIZE * 8);
+  long		i;
+  if (lo_idx < IK_PAGE_INDEX(gc->mark_base))
+    lo_idx = IK_PAGE_INDEX(gc->mark_base);
+  if (hi_idx > IK_PAGE_INDEX(gc->mark_end))
+    hi_idx = IK_PAGE_INDEX(gc->mark_end);
+  for (i=lo_idx; i<hi_idx; ++i) {
+    unsigned	t = segment_vec[i];
+    if (is_mark_region_page(gc, t)) {
+      ikptr		page	= (ikptr)(i << IK_PAGESHIFT);
+      unsigned char *	bits	= gc->mark_bits + (page - gc->mark_base) / (IK_GC_GRANULE_SIZE * 8);
+      long		j;
+      for (j=0; (j < bytes_per_page) && (0 == bits[j]); ++j);
+      if (j < bytes_per_page) {
+	for (j=0; j < bytes_per_page * 8; ++j) {
+	  if (0 == (bits[j >> 3] & (1 << (j & 7)))) {
+	    ref(page, j * IK_GC_GRANULE_SIZE)		   = IK_FIX(0);
+	    ref(page, j * IK_GC_GRANULE_SIZE + wordsize) = IK_FIX(0);
+	  }
+	}
+	/* All the references  in this page are now  to the oldest
+	   generation: the page is clean. */
+	segment_vec[i]	= t | new_gen_tag;
+	dirty_vec[i]	= 0;
+      }
+    }
+  }
+}
+static void
+sweep_mark_region_pages (gc_t * gc)
+{
+  gc_parallel_sweep(gc, sweep_mark_region_range);
+}
+static void
+collect_mark_region_holes (gc_t * gc)
+/* Link  the free slots of the  pages retained by "sweep_mark_region_pages()"
+   in the lists of the PCB.  A retained page has at least one marked
+   granule; a free slot has none. */
+{
+  ikpcb *	pcb		= gc->pcb;
+  unsigned *	segment_vec	= pcb->segment_vector;
+  long		bytes_per_page	= IK_PAGESIZE / (IK_GC_GRANULE_SIZE * 8);
+  long		i;
+  for (i=IK_PAGE_INDEX(gc->mark_base); i<IK_PAGE_INDEX(gc->mark_end); ++i) {
+    unsigned	t = segment_vec[i];
+    if (is_mark_region_type(t)) {
+      ikptr		page	= (ikptr)(i << IK_PAGESHIFT);
+      unsigned char *	bits	= gc->mark_bits + (page - gc->mark_base) / (IK_GC_GRANULE_SIZE * 8);
+      int		symbols	= (symbols_type == (t & type_mask));
+      long		size	= symbols? symbol_record_size : pair_size;
+      long		grans	= size / IK_GC_GRANULE_SIZE;
+      ikptr *		list	= symbols? &(pcb->mark_region_free_symbols) : &(pcb->mark_region_free_pairs);
+      long		j, k;
+      for (j=0; (j < bytes_per_page) && (0 == bits[j]); ++j);
+      if (j == bytes_per_page)
+	continue;	/* not retained: it is going to be released */
+      for (j=0; j < bytes_per_page * 8; j += grans) {
+	for (k=j; (k < j + grans) && (0 == (bits[k >> 3] & (1 << (k & 7)))); ++k);
+	if (k == j + grans) {
+	  ref(page, j * IK_GC_GRANULE_SIZE) = *list;
+	  *list = page + j * IK_GC_GRANULE_SIZE;
+	}
+      }
+    }
+  }
+}
+
 static inline int
 is_live (ikptr x, gc_t* gc)
 {
@@ -686,23 +1280,17 @@ is_live (ikptr x, gc_t* gc)
   if (IK_FORWARD_PTR == ref(x, -tag))
     return 1;
   gen = gc->segment_vector[IK_PAGE_INDEX(x)] & gen_mask;
-  return (gen > gc->collect_gen)? 1 : 0;
-}
-static inline int
-next_gen (int i)
-{
-  return ((i == (generation_count-1)) ? i : (i+1));
+  return ((gen > gc->collect_gen) || is_marked(gc, x))? 1 : 0;
 }
 static ik_ptr_page *
-move_tconc (ikptr tc, ik_ptr_page* ls)
+move_tconc (gc_t* gc, ikptr tc, ik_ptr_page* ls)
 /* Store TC in the  first node of the linked list LS.   If LS is NULL or
    the first node of  LS is full: allocate a new node  and prepend it to
    LS; then store TC in it.  Return the, possibly new, first node of the
-   linked list. */
+   linked list.  The nodes come from the cache in the PCB. */
 {
   if ((NULL == ls) || (IK_PTR_PAGE_SIZE == ls->count)) {
-    ik_ptr_page* page = (ik_ptr_page*)ik_mmap(IK_PAGESIZE);
-    page->count = 0;
+    ik_ptr_page* page = ik_ptr_page_alloc(gc->pcb);
     page->next  = ls;
     ls = page;
   }
@@ -725,6 +1313,7 @@ handle_guardians (gc_t* gc)
     pcb->protected_list[gen] = 0;
     while (prot_list) {
       int	i;
+      gc->guardians += prot_list->count;
       /* Scan the words in this page. */
       for(i=0; i<prot_list->count; i++) {
         ikptr	p   = prot_list->ptr[i];
@@ -736,13 +1325,13 @@ handle_guardians (gc_t* gc)
           obj = IK_CDR(np);
         }
         if (is_live(obj, gc))
-          pend_hold_list  = move_tconc(p, pend_hold_list);
+          pend_hold_list  = move_tconc(gc, p, pend_hold_list);
 	else
-          pend_final_list = move_tconc(p, pend_final_list);
+          pend_final_list = move_tconc(gc, p, pend_final_list);
       }
       { /* Deallocate this node in the PROT_LIST linked list. */
 	ik_ptr_page *	next = prot_list->next;
-	ik_munmap((ikptr)prot_list, IK_PAGESIZE);
+	ik_ptr_page_release(pcb, prot_list);
 	prot_list = next;
       }
     }
@@ -769,13 +1358,13 @@ handle_guardians (gc_t* gc)
 	    tc = ref(np, off_car);
 	  }
 	  if (is_live(tc, gc)) {
-	    final_list = move_tconc(p, final_list);
+	    final_list = move_tconc(gc, p, final_list);
 	  } else {
-	    pend_final_list = move_tconc(p, pend_final_list);
+	    pend_final_list = move_tconc(gc, p, pend_final_list);
 	  }
 	}
 	ik_ptr_page* next = ls->next;
-	ik_munmap((ikptr)ls, IK_PAGESIZE);
+	ik_ptr_page_release(pcb, ls);
 	ls = next;
       }
       if (final_list == NULL) {
@@ -786,10 +1375,10 @@ handle_guardians (gc_t* gc)
 	  int i;
 	  for (i=0; i<ls->count; i++) {
 	    ikptr p = ls->ptr[i];
-	    gc->forward_list = move_tconc(add_object(gc, p, "guardian"), gc->forward_list);
+	    gc->forward_list = move_tconc(gc, add_object(gc, p, "guardian"), gc->forward_list);
 	  }
 	  ik_ptr_page* next = ls->next;
-	  ik_munmap((ikptr)ls, IK_PAGESIZE);
+	  ik_ptr_page_release(pcb, ls);
 	  ls = next;
 	}
 	collect_loop(gc);
@@ -800,7 +1389,7 @@ handle_guardians (gc_t* gc)
      are also dead, deallocate. */
   while (pend_final_list) {
     ik_ptr_page* next = pend_final_list->next;
-    ik_munmap((ikptr)pend_final_list, IK_PAGESIZE);
+    ik_ptr_page_release(pcb, pend_final_list);
     pend_final_list = next;
   }
   /* pend_hold_list pairs with live tconcs are moved to
@@ -816,11 +1405,11 @@ handle_guardians (gc_t* gc)
         tc = ref(np, off_car);
       }
       if (is_live(tc, gc)) {
-        target = move_tconc(add_object(gc, p, "guardian"), target);
+        target = move_tconc(gc, add_object(gc, p, "guardian"), target);
       }
     }
     ik_ptr_page* next = pend_hold_list->next;
-    ik_munmap((ikptr)pend_hold_list, IK_PAGESIZE);
+    ik_ptr_page_release(pcb, pend_hold_list);
     pend_hold_list = next;
   }
   collect_loop(gc);
@@ -829,35 +1418,23 @@ handle_guardians (gc_t* gc)
 
 static void
 gc_finalize_guardians (gc_t* gc)
+/* Queue the  guardian pairs whose object  was found dead for delivery
+   to their tconcs; the nodes are moved, not copied, so the cost in the
+   collection is proportional to the number of nodes.  The pairs are
+   appended to the tconcs by "ikrt_deliver_guardians()", called in batches
+   by the post-collection Scheme code. */
 {
-  ik_ptr_page* ls = gc->forward_list;
-  int tconc_count = 0;
-  unsigned int* dirty_vec = (unsigned int*)(long)gc->pcb->dirty_vector;
-  while(ls) {
-    int i;
-    for(i=0; i<ls->count; i++) {
-      tconc_count++;
-      ikptr p = ls->ptr[i];
-      ikptr tc = ref(p, off_car);
-      ikptr obj = ref(p, off_cdr);
-      ikptr last_pair = ref(tc, off_cdr);
-      ref(last_pair, off_car) = obj;
-      ref(last_pair, off_cdr) = p;
-      ref(p, off_car) = IK_FALSE_OBJECT;
-      ref(p, off_cdr) = IK_FALSE_OBJECT;
-      ref(tc, off_cdr) = p;
-      dirty_vec[IK_PAGE_INDEX(tc)] = -1;
-      dirty_vec[IK_PAGE_INDEX(last_pair)] = -1;
-    }
-    ik_ptr_page* next = ls->next;
-    ik_munmap((ikptr)ls, IK_PAGESIZE);
+  ik_ptr_page *	ls = gc->forward_list;
+  while (ls) {
+    ik_ptr_page *	next = ls->next;
+    ls->next = gc->pcb->guardians_pending;
+    gc->pcb->guardians_pending = ls;
     ls = next;
   }
+  gc->forward_list = NULL;
 }
 
 
-static int alloc_code_count = 0;
-
 static ikptr
 add_code_entry (gc_t* gc, ikptr entry)
 /* Add a code object. */
@@ -871,6 +1448,8 @@ add_code_entry (gc_t* gc, ikptr entry)
   int		gen	= t & gen_mask;
   if (gen > gc->collect_gen)
     return entry;
+  if (gc->ephemerons_pending)
+    ephemeron_key_live(gc, x | vector_tag);
   /* The number of bytes actually used in the allocated memory block. */
   long		code_size	= IK_UNFIX(IK_REF(x, disp_code_code_size));
   /* The total number of allocated bytes. */
@@ -920,6 +1499,21 @@ collect_locatives(gc_t* gc, ik_callback_locative* loc) {
   }
 }
 
+static void
+collect_alloc_samples (gc_t* gc)
+/* The code objects  referenced by the samples of  the allocation profiler
+   not yet drained are roots. */
+{
+  ikpcb *	pcb = gc->pcb;
+  long		i;
+  int		j;
+  for (i=0; i<pcb->alloc_samples_count; ++i) {
+    ik_alloc_sample *	sample = &(pcb->alloc_samples[i]);
+    for (j=0; j<sample->depth; ++j)
+      sample->code[j] = add_object(gc, sample->code[j], "alloc_sample");
+  }
+}
+
 
 #define DEBUG_STACK 0
 
@@ -1244,11 +1838,26 @@ add_list (gc_t* gc, unsigned segment_bits, ikptr X, ikptr* loc)
     ikptr Y;
     if ((segment_bits & type_mask) != weak_pairs_type)
       Y = gc_alloc_new_pair(gc)      | pair_tag;
-    else
-      Y = gc_alloc_new_weak_pair(gc) | pair_tag;
+    else if (segment_bits & ephemerons_page_mask) {
+      /* X is  an  ephemeron: its cdr is  left alone until  its car is
+	 known to be live, see "collect_ephemerons()". */
+      Y = gc_alloc_new_weak_pair(gc, meta_ephemeron) | pair_tag;
+      *loc = Y;
+      IK_CAR(X) = IK_FORWARD_PTR;
+      IK_CDR(X) = Y;
+      IK_CAR(Y) = first_word;
+      IK_CDR(Y) = second_word;
+      if (gc->ephemerons_pending)
+	ephemeron_key_live(gc, X);
+      push_ephemeron(gc, Y);
+      return;
+    } else
+      Y = gc_alloc_new_weak_pair(gc, meta_weak) | pair_tag;
     *loc = Y;
     IK_CAR(X) = IK_FORWARD_PTR;
     IK_CDR(X) = Y;
+    if (gc->ephemerons_pending)
+      ephemeron_key_live(gc, X);
     /* X is gone.  From now on we care about Y. */
     IK_CAR(Y) = first_word;
     if (pair_tag == second_word_tag) {
@@ -1265,6 +1874,10 @@ add_list (gc_t* gc, unsigned segment_bits, ikptr X, ikptr* loc)
         if (gen > collect_gen) {
           IK_CDR(Y) = second_word;
           return;
+        } else if (is_mark_region_page(gc, segment_bits)) {
+	  /* The cdr of Y is not moved: mark it. */
+          IK_CDR(Y) = mark_object(gc, second_word, pair_tag, segment_bits);
+          return;
         } else {
 	  /* Prepare  for  the next  for(;;)  loop  iteration.  We  will
 	     process the cdr  of Y (a pair) and update  the reference to
@@ -1313,6 +1926,28 @@ add_list (gc_t* gc, unsigned segment_bits, ikptr X, ikptr* loc)
 static ikptr
 #if (((defined VICARE_DEBUGGING) && (defined VICARE_DEBUGGING_GC)) || (defined DEBUG_ADD_OBJECT))
 add_object_proc (gc_t* gc, ikptr X, char* caller)
+/* Move the live object X with  "move_object()"; if ephemerons are pending
+   and X was moved or marked by this call: queue the ephemerons whose car
+   is X. */
+{
+#else
+add_object_proc (gc_t* gc, ikptr X)
+{
+#endif
+  if (0 == gc->ephemerons_pending)
+    return move_object(gc, X, caller);
+  else {
+    int		fresh = ! is_live(X, gc);
+    ikptr	Y     = move_object(gc, X, caller);
+    if (fresh)
+      ephemeron_key_live(gc, X);
+    return Y;
+  }
+}
+
+static ikptr
+#if (((defined VICARE_DEBUGGING) && (defined VICARE_DEBUGGING_GC)) || (defined DEBUG_ADD_OBJECT))
+move_object_proc (gc_t* gc, ikptr X, char* caller)
 /* Move  the live  object X,  and all  its component  objects, to  a new
    location  and return  a new  machine  word which  must replace  every
    occurrence of X.
@@ -1332,7 +1967,7 @@ add_object_proc (gc_t* gc, ikptr X, char* caller)
 {
   caller = caller;
 #else
-add_object_proc (gc_t* gc, ikptr X)
+move_object_proc (gc_t* gc, ikptr X)
 {
 #endif
   int		tag;		/* tag bits of X */
@@ -1361,6 +1996,10 @@ add_object_proc (gc_t* gc, ikptr X)
     if (generation > gc->collect_gen)
       return X;
   }
+  /* If X is  a pair or symbol in the oldest generation and  we are not
+     copying them: mark it. */
+  if (is_mark_region_page(gc, segment_bits))
+    return mark_object(gc, X, tag, segment_bits);
   /* If we are here  X must be moved to a new  location.  This is a type
      specific operation, so we branch by tag value. */
   if (pair_tag == tag) {
@@ -1703,7 +2342,15 @@ add_object_proc (gc_t* gc, ikptr X)
     if (IK_IS_FIXNUM(first_word)) {
       long	len    = IK_UNFIX(first_word);
       long	memreq = IK_ALIGN(len * IK_STRING_CHAR_SIZE + disp_string_data);
-      ikptr	Y      = gc_alloc_new_data(memreq, gc) | string_tag;
+      ikptr	Y;
+      if (memreq >= IK_PAGESIZE) { /* big string */
+	if (large_object_tag == (segment_bits & large_object_mask)) {
+	  retag_large_data(X - string_tag, memreq, gc);
+	  return X;
+	} else
+	  Y = gc_alloc_new_large_data(memreq, gc) | string_tag;
+      } else
+	Y = gc_alloc_new_data(memreq, gc) | string_tag;
       IK_REF(Y, off_string_length) = first_word;
       memcpy((char*)(long)(Y + off_string_data),
              (char*)(long)(X + off_string_data),
@@ -1720,7 +2367,15 @@ add_object_proc (gc_t* gc, ikptr X)
   else if (bytevector_tag == tag) {
     long	len    = IK_UNFIX(first_word);
     long	memreq = IK_ALIGN(len + disp_bytevector_data + 1);
-    ikptr	Y = gc_alloc_new_data(memreq, gc) | bytevector_tag;
+    ikptr	Y;
+    if (memreq >= IK_PAGESIZE) { /* big bytevector */
+      if (large_object_tag == (segment_bits & large_object_mask)) {
+	retag_large_data(X - bytevector_tag, memreq, gc);
+	return X;
+      } else
+	Y = gc_alloc_new_large_data(memreq, gc) | bytevector_tag;
+    } else
+      Y = gc_alloc_new_data(memreq, gc) | bytevector_tag;
     IK_REF(Y, off_bytevector_length) = first_word;
     memcpy((char*)(long)(Y + off_bytevector_data),
            (char*)(long)(X + off_bytevector_data),
@@ -1733,6 +2388,17 @@ add_object_proc (gc_t* gc, ikptr X)
 }
 
 
+/* Store VAL  in the word  at PTR only  if it is  different from the
+   current value:  the code objects in the  static generation reference
+   objects which are never moved, so  scanning them leaves their pages
+   untouched and shared with the other processes. */
+#define IK_REF_UPDATE(PTR,OFF,VAL)		\
+  do {						\
+    ikptr	_val = (VAL);			\
+    if (IK_REF((PTR),(OFF)) != _val)		\
+      IK_REF((PTR),(OFF)) = _val;		\
+  } while (0)
+
 static void
 relocate_new_code (ikptr p_X, gc_t* gc)
 /* Process  the relocation  vector of  a code  object.  p_X  must be  an
@@ -1741,9 +2407,9 @@ relocate_new_code (ikptr p_X, gc_t* gc)
   This function has similarities with "ik_relocate_code()". */
 {
   const ikptr	s_reloc_vec = add_object(gc, IK_REF(p_X, disp_code_reloc_vector), "relocvec");
-  IK_REF(p_X, disp_code_reloc_vector) = s_reloc_vec;
-  IK_REF(p_X, disp_code_annotation)   = add_object(gc, IK_REF(p_X, disp_code_annotation),
-						 "annotation");
+  IK_REF_UPDATE(p_X, disp_code_reloc_vector, s_reloc_vec);
+  IK_REF_UPDATE(p_X, disp_code_annotation,
+		add_object(gc, IK_REF(p_X, disp_code_annotation), "annotation"));
   /* The variable P_RELOC_VEC_CUR is an  *untagged* pointer to the first
      word in the data area of the relocation vector VEC. */
   ikptr		p_reloc_vec_cur = s_reloc_vec + off_vector_data;
@@ -1772,7 +2438,7 @@ relocate_new_code (ikptr p_X, gc_t* gc)
 #endif
       ikptr	s_old_object = IK_RELOC_RECORD_2ND(p_reloc_vec_cur);
       ikptr	s_new_object = add_object(gc, s_old_object, "reloc1");
-      IK_REF(p_data, disp_code_word) = s_new_object;
+      IK_REF_UPDATE(p_data, disp_code_word, s_new_object);
       p_reloc_vec_cur += (2*wordsize);
       break;
     }
@@ -1782,7 +2448,7 @@ relocate_new_code (ikptr p_X, gc_t* gc)
       long	obj_off      = IK_UNFIX(IK_RELOC_RECORD_2ND(p_reloc_vec_cur));
       ikptr	s_old_object =          IK_RELOC_RECORD_3RD(p_reloc_vec_cur);
       ikptr	s_new_object = add_object(gc, s_old_object, "reloc2");
-      IK_REF(p_data, disp_code_word) = s_new_object + obj_off;
+      IK_REF_UPDATE(p_data, disp_code_word, s_new_object + obj_off);
       p_reloc_vec_cur += (3 * wordsize);
       break;
     }
@@ -1800,7 +2466,8 @@ relocate_new_code (ikptr p_X, gc_t* gc)
       ikptr	relative_distance = displaced_object - (long)next_word;
       if (((long)relative_distance) != ((long)((int)relative_distance)))
         ik_abort("relocation error with relative=0x%016lx", relative_distance);
-      *((int*)(p_data + disp_code_word)) = (int)relative_distance;
+      if (*((int*)(p_data + disp_code_word)) != (int)relative_distance)
+	*((int*)(p_data + disp_code_word)) = (int)relative_distance;
       p_reloc_vec_cur += (3*wordsize);
       break;
     }
@@ -1824,6 +2491,11 @@ collect_loop(gc_t* gc) {
   int done;
   do{
     done = 1;
+    /* scan the fields of the marked objects */
+    if (gc->mark_stack_len) {
+      done = 0;
+      drain_mark_stack(gc);
+    }
     { /* scan the pending pairs pages */
       qupages_t* qu = gc->queues[meta_pair];
       if (qu) {
@@ -1891,7 +2563,6 @@ collect_loop(gc_t* gc) {
           ikptr q = codes->q;
           while(p < q) {
             relocate_new_code(p, gc);
-            alloc_code_count--;
             p += IK_ALIGN(disp_code_data + IK_UNFIX(ref(p, disp_code_code_size)));
           }
           qupages_t* next = codes->next;
@@ -1961,7 +2632,6 @@ collect_loop(gc_t* gc) {
           do{
             meta->aq = q;
             do{
-              alloc_code_count--;
               relocate_new_code(p, gc);
               p += IK_ALIGN(disp_code_data + IK_UNFIX(ref(p, disp_code_code_size)));
             } while (p < q);
@@ -1972,6 +2642,10 @@ collect_loop(gc_t* gc) {
       }
     }
     /* phew */
+    /* When everything reachable has been collected: collect the cdrs of
+       the ephemerons whose car turned out to be live, and go on. */
+    if (done && collect_ephemerons(gc))
+      done = 0;
   } while (! done);
   {
     /* zero out remaining pointers */
@@ -2012,6 +2686,15 @@ collect_loop(gc_t* gc) {
         p += wordsize;
       }
     }
+    {
+      meta_t* meta = &gc->meta[meta_ephemeron];
+      ikptr p = meta->ap;
+      ikptr q = meta->ep;
+      while(p < q) {
+        ref(p, 0) = 0;
+        p += wordsize;
+      }
+    }
     {
       meta_t* meta = &gc->meta[meta_code];
       ikptr p = meta->ap;
@@ -2025,11 +2708,13 @@ collect_loop(gc_t* gc) {
 }
 
 static void
-fix_weak_pointers(gc_t* gc) {
+fix_weak_pointers_range (gc_t* gc, long lo_idx, long hi_idx)
+/* Sweep the pages from LO_IDX included to HI_IDX excluded: in every new
+   weak pairs  page, replace the  references to collected  objects with
+   the BWP object.  Only the words in the weak pages are mutated, so this
+   function can be applied concurrently to disjoint ranges. */
+{
   unsigned int* segment_vec = gc->segment_vector;
-  ikpcb* pcb = gc->pcb;
-  long lo_idx = IK_PAGE_INDEX(pcb->memory_base);
-  long hi_idx = IK_PAGE_INDEX(pcb->memory_end);
   long i = lo_idx;
   int collect_gen = gc->collect_gen;
   while(i < hi_idx) {
@@ -2050,7 +2735,7 @@ fix_weak_pointers(gc_t* gc) {
                 ref(p, 0) = ref(x, wordsize-tag);
               } else {
                 int x_gen = segment_vec[IK_PAGE_INDEX(x)] & gen_mask;
-                if (x_gen <= collect_gen) {
+                if ((x_gen <= collect_gen) && (! is_marked(gc, x))) {
                   ref(p, 0) = IK_BWP_OBJECT;
                 }
               }
@@ -2063,24 +2748,285 @@ fix_weak_pointers(gc_t* gc) {
     i++;
   }
 }
+static void
+fix_weak_pointers (gc_t* gc)
+{
+  gc_parallel_sweep(gc, fix_weak_pointers_range);
+}
+
 
+static void
+queue_ephemeron (gc_t* gc, ikptr Y)
+/* Register the moved ephemeron Y as having a live car. */
+{
+  if (gc->ephemerons_len == gc->ephemerons_size) {
+    long	size = (gc->ephemerons_size)? (2 * gc->ephemerons_size) : (IK_PAGESIZE / sizeof(ikptr));
+    ikptr *	vec  = ik_malloc(size * sizeof(ikptr));
+    if (gc->ephemerons) {
+      memcpy(vec, gc->ephemerons, gc->ephemerons_len * sizeof(ikptr));
+      ik_free(gc->ephemerons, gc->ephemerons_size * sizeof(ikptr));
+    }
+    gc->ephemerons	= vec;
+    gc->ephemerons_size	= size;
+  }
+  gc->ephemerons[gc->ephemerons_len++] = Y;
+}
+static inline long
+ephemeron_hash (gc_t* gc, ikptr key)
+{
+  return (long)((((ik_ulong)key) >> 3) ^ (((ik_ulong)key) >> 15)) & (gc->ephemeron_buckets_size - 1);
+}
+static void
+rehash_ephemerons (gc_t* gc)
+/* Double the  number of buckets of  the pending ephemerons and  rebuild the
+   chains from the nodes still pending. */
+{
+  long	size = (gc->ephemeron_buckets_size)? (2 * gc->ephemeron_buckets_size) : (IK_PAGESIZE / sizeof(long));
+  long	i;
+  if (gc->ephemeron_buckets)
+    ik_free(gc->ephemeron_buckets, gc->ephemeron_buckets_size * sizeof(long));
+  gc->ephemeron_buckets		= ik_malloc(size * sizeof(long));
+  gc->ephemeron_buckets_size	= size;
+  for (i=0; i<size; ++i)
+    gc->ephemeron_buckets[i] = -1;
+  for (i=0; i<gc->ephemeron_nodes_len; ++i) {
+    ephemeron_node_t *	node = &(gc->ephemeron_nodes[i]);
+    if (node->ephemeron) {
+      long	h = ephemeron_hash(gc, node->key);
+      node->next		= gc->ephemeron_buckets[h];
+      gc->ephemeron_buckets[h]	= i;
+    }
+  }
+}
+static void
+push_ephemeron (gc_t* gc, ikptr Y)
+/* Register the  moved ephemeron  Y: if its  car is already  live queue it,
+   else store it among the pending ones. */
+{
+  ikptr			key = IK_CAR(Y);
+  ephemeron_node_t *	node;
+  long			h;
+  if ((IK_BWP_OBJECT != key) && is_live(key, gc)) {
+    queue_ephemeron(gc, Y);
+    return;
+  }
+  if (gc->ephemeron_nodes_len == gc->ephemeron_nodes_size) {
+    long		size  = (gc->ephemeron_nodes_size)? (2 * gc->ephemeron_nodes_size) :
+      (IK_PAGESIZE / sizeof(ephemeron_node_t));
+    ephemeron_node_t *	nodes = ik_malloc(size * sizeof(ephemeron_node_t));
+    if (gc->ephemeron_nodes) {
+      memcpy(nodes, gc->ephemeron_nodes, gc->ephemeron_nodes_len * sizeof(ephemeron_node_t));
+      ik_free(gc->ephemeron_nodes, gc->ephemeron_nodes_size * sizeof(ephemeron_node_t));
+    }
+    gc->ephemeron_nodes		= nodes;
+    gc->ephemeron_nodes_size	= size;
+  }
+  if (gc->ephemerons_pending >= gc->ephemeron_buckets_size)
+    rehash_ephemerons(gc);
+  h			= ephemeron_hash(gc, key);
+  node			= &(gc->ephemeron_nodes[gc->ephemeron_nodes_len]);
+  node->key		= key;
+  node->ephemeron	= Y;
+  node->next		= gc->ephemeron_buckets[h];
+  gc->ephemeron_buckets[h] = gc->ephemeron_nodes_len++;
+  ++(gc->ephemerons_pending);
+}
+static void
+ephemeron_key_live (gc_t* gc, ikptr key)
+/* The object KEY has just been moved or  marked: queue the pending ephemerons
+   having it as car.  The cost is a single bucket lookup. */
+{
+  long *	link;
+  if (0 == gc->ephemerons_pending)
+    return;
+  link = &(gc->ephemeron_buckets[ephemeron_hash(gc, key)]);
+  while (0 <= *link) {
+    ephemeron_node_t *	node = &(gc->ephemeron_nodes[*link]);
+    if (key == node->key) {
+      queue_ephemeron(gc, node->ephemeron);
+      node->ephemeron = 0;
+      *link = node->next;
+      --(gc->ephemerons_pending);
+    } else
+      link = &(node->next);
+  }
+}
+static int
+collect_ephemerons (gc_t* gc)
+/* Collect the cdr of the queued ephemerons, whose car is live.  Return true
+   if at least one cdr has been collected: the caller must go on tracing
+   from it.  Collecting a cdr may queue further ephemerons, which are
+   processed in the same loop. */
+{
+  int	progress = 0;
+  while (gc->ephemerons_len) {
+    ikptr	Y = gc->ephemerons[--(gc->ephemerons_len)];
+    IK_CDR(Y) = add_object(gc, IK_CDR(Y), "ephemeron");
+    progress  = 1;
+  }
+  return progress;
+}
+static void
+queue_broken_bucket (gc_t* gc, ikptr Y)
+/* The ephemeron Y has a dead car: if it is an entry of a weak table, its
+   cdr references a pair whose  cdr is the index of the bucket  holding
+   it; queue the index.  The pair has not been collected, but its memory
+   is released only by "deallocate_unused_pages()"; if it has been moved
+   its cdr is the new address, which is not a fixnum.  The ephemerons not
+   in a weak table may queue a useless index, which is harmless. */
+{
+  ikptr	holder = IK_CDR(Y);
+  ikptr	index;
+  if (! IK_IS_PAIR(holder))
+    return;
+  index = IK_CDR(holder);
+  if (! IK_IS_FIXNUM(index) || (IK_UNFIX(index) < 0))
+    return;
+  if (gc->broken_buckets_len == gc->broken_buckets_size) {
+    long	size = (gc->broken_buckets_size)? (2 * gc->broken_buckets_size) : (IK_PAGESIZE / sizeof(long));
+    long *	vec  = ik_malloc(size * sizeof(long));
+    if (gc->broken_buckets) {
+      memcpy(vec, gc->broken_buckets, gc->broken_buckets_len * sizeof(long));
+      ik_free(gc->broken_buckets, gc->broken_buckets_size * sizeof(long));
+    }
+    gc->broken_buckets		= vec;
+    gc->broken_buckets_size	= size;
+  }
+  gc->broken_buckets[gc->broken_buckets_len++] = IK_UNFIX(index);
+}
+static void
+break_ephemerons (gc_t* gc)
+/* The ephemerons still pending have a dead car, which "fix_weak_pointers()"
+   has replaced with the BWP object: queue the weak table bucket holding
+   them, then replace their cdr with the BWP object, too, because it
+   references memory that is going to be released. */
+{
+  long	i;
+  for (i=0; i<gc->ephemeron_nodes_len; ++i) {
+    ephemeron_node_t *	node = &(gc->ephemeron_nodes[i]);
+    if (node->ephemeron) {
+      queue_broken_bucket(gc, node->ephemeron);
+      IK_CDR(node->ephemeron) = IK_BWP_OBJECT;
+    }
+  }
+  if (gc->ephemerons)
+    ik_free(gc->ephemerons, gc->ephemerons_size * sizeof(ikptr));
+  if (gc->ephemeron_nodes)
+    ik_free(gc->ephemeron_nodes, gc->ephemeron_nodes_size * sizeof(ephemeron_node_t));
+  if (gc->ephemeron_buckets)
+    ik_free(gc->ephemeron_buckets, gc->ephemeron_buckets_size * sizeof(long));
+  gc->ephemerons		= NULL;
+  gc->ephemerons_len		= 0;
+  gc->ephemerons_size		= 0;
+  gc->ephemeron_nodes		= NULL;
+  gc->ephemeron_nodes_len	= 0;
+  gc->ephemeron_nodes_size	= 0;
+  gc->ephemeron_buckets		= NULL;
+  gc->ephemeron_buckets_size	= 0;
+  gc->ephemerons_pending	= 0;
+}
+static int
+compare_bucket_indexes (const void * A, const void * B)
+{
+  long	a = *((const long *)A);
+  long	b = *((const long *)B);
+  return (a < b)? -1 : ((a > b)? 1 : 0);
+}
+static void
+clear_ephemeron_tables (gc_t* gc)
+/* Remove from the list "pcb->ephemeron_tables"  the nodes whose buckets
+   vector has been collected.  If ephemerons were broken in this run: in
+   the buckets  vectors still alive  visit only the buckets queued  by
+   "break_ephemerons()", unlink the entries whose ephemeron has a BWP car
+   and subtract  their number from the  count in the last  slot.  See
+   "ikrt_register_ephemeron_table()". */
+{
+  ikpcb *	pcb	  = gc->pcb;
+  unsigned *	dirty_vec = (unsigned *)(long)pcb->dirty_vector;
+  ikptr *	link	  = &(pcb->ephemeron_tables);
+  long *	indexes	  = gc->broken_buckets;
+  long		nindexes  = 0;
+  long		i;
+  /* Sort the queued indexes and drop the duplicates. */
+  if (gc->broken_buckets_len) {
+    qsort(indexes, gc->broken_buckets_len, sizeof(long), compare_bucket_indexes);
+    for (i=0; i<gc->broken_buckets_len; ++i)
+      if ((0 == nindexes) || (indexes[nindexes-1] != indexes[i]))
+	indexes[nindexes++] = indexes[i];
+  }
+  while (IK_NULL_OBJECT != *link) {
+    ikptr	node = *link;
+    ikptr	vec  = IK_CAR(node);
+    if (IK_BWP_OBJECT == vec) {
+      *link = IK_CDR(node);
+      if (link != &(pcb->ephemeron_tables))
+	dirty_vec[IK_PAGE_INDEX(link)] = (unsigned)-1;
+      continue;
+    }
+    if (nindexes) {
+      long	len	= IK_VECTOR_LENGTH(vec) - 1;
+      long	removed = 0;
+      for (i=0; (i<nindexes) && (indexes[i]<len); ++i) {
+	ikptr *	loc = (ikptr *)(long)(vec + off_vector_data + indexes[i] * wordsize);
+	while (IK_IS_PAIR(*loc)) {
+	  ikptr	spine = *loc;
+	  ikptr	entry = IK_CAR(spine);
+	  if (IK_IS_PAIR(entry) && (IK_BWP_OBJECT == IK_CAR(entry))) {
+	    *loc = IK_CDR(spine);
+	    dirty_vec[IK_PAGE_INDEX(loc)] = (unsigned)-1;
+	    ++removed;
+	  } else
+	    loc = (ikptr *)(long)(spine + off_cdr);
+	}
+      }
+      if (removed) {
+	ikptr	count = IK_REF(vec, off_vector_data + len * wordsize);
+	IK_REF(vec, off_vector_data + len * wordsize) = IK_FIX(IK_UNFIX(count) - removed);
+      }
+    }
+    link = (ikptr *)(long)(node + off_cdr);
+  }
+  if (gc->broken_buckets)
+    ik_free(gc->broken_buckets, gc->broken_buckets_size * sizeof(long));
+  gc->broken_buckets		= NULL;
+  gc->broken_buckets_len	= 0;
+  gc->broken_buckets_size	= 0;
+}
+
+/* Only the  pages of the static generation are older than the oldest
+   collected generation,  so  the last mask is applied only to them. */
 static unsigned int dirty_mask[generation_count] = {
   0x88888888,
   0xCCCCCCCC,
   0xEEEEEEEE,
   0xFFFFFFFF,
-  0x00000000
+  0xFFFFFFFF
 };
 
 
-static unsigned int cleanup_mask[generation_count] = {
+static unsigned int cleanup_mask[generation_count+1] = {
   0x00000000,
   0x88888888,
   0xCCCCCCCC,
   0xEEEEEEEE,
-  0xFFFFFFFF
+  0xFFFFFFFF,
+  0xFFFFFFFF	/* IK_STATIC_GENERATION */
 };
 
+/* The pages of  the oldest generation have no meta dirty bits, so a card
+   of the static generation referencing  them would be cleaned: set this
+   bit to keep it dirty, so that it is scanned by the major collections. */
+#define STATIC_CARD_DIRTY	(1 << meta_dirty_shift)
+
+static inline unsigned
+static_card_bits (unsigned page_bits, unsigned ref_bits)
+/* Return  the additional dirty bits of  a card in a page  with segment
+   bits PAGE_BITS referencing an object in a page with REF_BITS. */
+{
+  return ((IK_STATIC_GENERATION == (page_bits & gen_mask)) &&
+	  (IK_STATIC_GENERATION != (ref_bits  & gen_mask)))? STATIC_CARD_DIRTY : 0;
+}
+
 
 
 static void
@@ -2105,8 +3051,9 @@ scan_dirty_pointers_page(gc_t* gc, long page_idx, int mask) {
         } else {
           ikptr y = add_object(gc, x, "nothing");
           segment_vec = gc->segment_vector;
-          ref(p, 0) = y;
+          IK_REF_UPDATE(p, 0, y);
           card_d = card_d | segment_vec[IK_PAGE_INDEX(y)];
+          card_d = card_d | static_card_bits(t, segment_vec[IK_PAGE_INDEX(y)]);
         }
         p += wordsize;
       }
@@ -2119,7 +3066,8 @@ scan_dirty_pointers_page(gc_t* gc, long page_idx, int mask) {
   }
   dirty_vec = (unsigned int*)(long)gc->pcb->dirty_vector;
   new_d = new_d & cleanup_mask[t & gen_mask];
-  dirty_vec[page_idx] = new_d;
+  if (dirty_vec[page_idx] != new_d)
+    dirty_vec[page_idx] = new_d;
 }
 
 static void
@@ -2147,6 +3095,7 @@ scan_dirty_code_page (gc_t* gc, long page_idx)
       assert(((long)len) >= 0);
       unsigned long	i;
       unsigned long	code_d	= segment_vec[IK_PAGE_INDEX(rvec)];
+      code_d |= static_card_bits(t, segment_vec[IK_PAGE_INDEX(rvec)]);
       for (i=0; i<len; i+=wordsize) {
         ikptr		r = IK_REF(rvec, i+off_vector_data);
         if (IK_IS_FIXNUM(r) || (IK_TAGOF(r) == immediate_tag)) {
@@ -2155,6 +3104,7 @@ scan_dirty_code_page (gc_t* gc, long page_idx)
           r		= add_object(gc, r, "nothing2");
           segment_vec	= gc->segment_vector;
           code_d	= code_d | segment_vec[IK_PAGE_INDEX(r)];
+          code_d	= code_d | static_card_bits(t, segment_vec[IK_PAGE_INDEX(r)]);
         }
       }
       new_d	= new_d | (code_d << (j * meta_dirty_shift));
@@ -2163,7 +3113,8 @@ scan_dirty_code_page (gc_t* gc, long page_idx)
   }
   dirty_vec	= (unsigned int*)(long)gc->pcb->dirty_vector;
   new_d		= new_d & cleanup_mask[t & gen_mask];
-  dirty_vec[page_idx] = new_d;
+  if (dirty_vec[page_idx] != new_d)
+    dirty_vec[page_idx] = new_d;
 }
 
 
@@ -2187,6 +3138,8 @@ scan_dirty_pages(gc_t* gc) {
       int tgen = t & gen_mask;
       if (tgen > collect_gen) {
         int type = t & type_mask;
+        if (t & scannable_mask)
+          ++(gc->dirty_pages);
         if (type == pointers_type) {
           scan_dirty_pointers_page(gc, i, mask);
           dirty_vec = (unsigned int*)(long)pcb->dirty_vector;
@@ -2245,25 +3198,39 @@ deallocate_unused_pages(gc_t* gc)
 
 
 static void
-fix_new_pages(gc_t* gc) {
-  ikpcb* pcb = gc->pcb;
-  unsigned int* segment_vec = pcb->segment_vector;
-  ikptr memory_base = pcb->memory_base;
-  ikptr memory_end = pcb->memory_end;
-  ikptr lo_idx = IK_PAGE_INDEX(memory_base);
-  ikptr hi_idx = IK_PAGE_INDEX(memory_end);
-  ikptr i = lo_idx;
+fix_new_pages_range (gc_t* gc, long lo_idx, long hi_idx)
+/* Clear the  "new generation" bit  in the slots of  the segment vector
+   from LO_IDX  included to HI_IDX  excluded.  This function can  be applied
+   concurrently to disjoint ranges.
+
+   When pretenuring: the survivors moved into the target generation may
+   reference objects in  the generations between the collected one and
+   the target,  which the collection did not inspect;  so the new pages
+   are marked as  dirty for all the younger generations and the next
+   collection recomputes their dirty bits. */
+{
+  unsigned int* segment_vec = gc->pcb->segment_vector;
+  unsigned int* dirty_vec   = (unsigned int*)(long)gc->pcb->dirty_vector;
+  int pretenured = (gc->target_gen > next_gen(gc->collect_gen));
+  long i = lo_idx;
   while(i < hi_idx) {
-    segment_vec[i] &= ~new_gen_mask;
-    /*
+    /* Store only into  the slots to be changed: the  tables are mapped
+       lazily and,  after a "fork()",  shared copy-on-write; writing every
+       slot would commit and copy all of their pages. */
     unsigned int t = segment_vec[i];
     if (t & new_gen_mask) {
+      if (pretenured)
+	dirty_vec[i] = cleanup_mask[gc->target_gen];
       segment_vec[i] = t & ~new_gen_mask;
     }
-    */
     i++;
   }
 }
+static void
+fix_new_pages (gc_t* gc)
+{
+  gc_parallel_sweep(gc, fix_new_pages_range);
+}
 
 static void
 add_one_tconc(ikpcb* pcb, ikptr p) {
@@ -2310,5 +3277,491 @@ gc_add_tconcs(gc_t* gc) {
     qu = next;
   }
 }
+void
+ik_tcbucket_requeue (ikpcb* pcb, ikptr s_tcbucket)
+/* Append S_TCBUCKET to its tconc as the collector does when it moves the
+   key: the hashtable rehashes it at the next access.  Used when loading a
+   heap image, in which all the keys have new addresses. */
+{
+  ikptr p = ik_unsafe_alloc(pcb, 2*wordsize);
+  ref(p, 0) = s_tcbucket;
+  add_one_tconc(pcb, p);
+  ((int*)(long)pcb->dirty_vector)[IK_PAGE_INDEX(s_tcbucket)] = -1;
+}
+
+
+/** --------------------------------------------------------------------
+ ** Allocation profiler.
+ ** ----------------------------------------------------------------- */
+
+void
+ik_alloc_sample_arm (ikpcb * pcb)
+/* Set  the allocation redline  to the next sampling  point, or to the end
+   of the usable heap segment if the profiler is disabled or the sampling
+   point is beyond it. */
+{
+  ikptr	next = pcb->allocation_pointer + pcb->alloc_sample_interval;
+  pcb->alloc_sample_base = pcb->allocation_pointer;
+  if (pcb->alloc_sample_interval && (next < pcb->heap_redline))
+    pcb->allocation_redline = next;
+  else
+    pcb->allocation_redline = pcb->heap_redline;
+}
+void
+ik_alloc_sample_carry (ikpcb * pcb, ikptr segment, long carried)
+/* Arm the  allocation profiler after  switching to the new heap segment
+   starting at SEGMENT; CARRIED must be the number of bytes allocated in
+   the old segment since the last sample.  Such bytes count towards the
+   next sampling point, which is recorded at once if already crossed. */
+{
+  ikptr	next;
+  ik_alloc_sample_arm(pcb);
+  if (0 == pcb->alloc_sample_interval)
+    return;
+  pcb->alloc_sample_base = segment - carried;
+  next = pcb->alloc_sample_base + pcb->alloc_sample_interval;
+  if (next <= pcb->allocation_pointer)
+    ik_alloc_sample_record(pcb);
+  else if (next < pcb->heap_redline)
+    pcb->allocation_redline = next;
+}
+void
+ik_alloc_sample_record (ikpcb * pcb)
+/* If the allocation profiler is enabled: record a sample attributing the
+   bytes allocated since the profiler was last armed to the code objects
+   of the  innermost  frames on  the Scheme  stack, then re-arm  it.  It
+   allocates nothing on the Scheme heap, so it can be called by the C
+   allocation functions. */
+{
+  ikptr			top   = pcb->frame_pointer;
+  ikptr			end   = pcb->frame_base - wordsize;
+  long			bytes = pcb->allocation_pointer - pcb->alloc_sample_base;
+  ik_alloc_sample *	sample;
+  if (0 == pcb->alloc_sample_interval)
+    return;
+  if (bytes > 0) {
+    if (pcb->alloc_samples_count < IK_ALLOC_SAMPLES_COUNT) {
+      sample		= &(pcb->alloc_samples[pcb->alloc_samples_count++]);
+      sample->bytes	= bytes;
+      for (sample->depth=0; (sample->depth < IK_ALLOC_SAMPLE_DEPTH) && (top < end); ++(sample->depth)) {
+	ikptr	framesize = IK_CALLTABLE_FRAMESIZE(IK_REF(top, 0));
+	if (0 == framesize)
+	  framesize = IK_REF(top, wordsize);
+	sample->code[sample->depth] = ik_stack_frame_top_to_code_object(top);
+	top += framesize;
+      }
+    } else
+      pcb->alloc_samples_dropped += bytes;
+  }
+  ik_alloc_sample_arm(pcb);
+}
+
+ikptr
+ikrt_gc_allocation_sample_interval (ikptr s_bytes, ikpcb * pcb)
+/* Return a  fixnum representing the number of  bytes between two samples
+   of the  allocation profiler; zero means  the profiler is disabled.  If
+   S_BYTES is a fixnum: set it as new interval. */
+{
+  long	old = pcb->alloc_sample_interval;
+  if (IK_IS_FIXNUM(s_bytes)) {
+    pcb->alloc_sample_interval = IK_ALIGN(IK_UNFIX(s_bytes));
+    if (pcb->alloc_sample_interval && (NULL == pcb->alloc_samples))
+      pcb->alloc_samples = ik_malloc(IK_ALLOC_SAMPLES_COUNT * sizeof(ik_alloc_sample));
+    ik_alloc_sample_arm(pcb);
+  }
+  return IK_FIX(old);
+}
+ikptr
+ikrt_gc_allocation_sample_count (ikpcb * pcb)
+/* Return a fixnum representing the number of samples not yet drained. */
+{
+  return IK_FIX(pcb->alloc_samples_count);
+}
+ikptr
+ikrt_gc_allocation_sample (ikptr s_index, ikptr s_vec, ikpcb * pcb)
+/* Fill the vector S_VEC  with the sample at S_INDEX: the number of bytes
+   followed by the code objects, innermost first.  Return a fixnum being
+   the number of code objects. */
+{
+  ik_alloc_sample *	sample = &(pcb->alloc_samples[IK_UNFIX(s_index)]);
+  int			i;
+  IK_ITEM(s_vec, 0) = IK_FIX(sample->bytes);
+  for (i=0; i<sample->depth; ++i)
+    IK_ITEM(s_vec, 1+i) = sample->code[i];
+  return IK_FIX(sample->depth);
+}
+ikptr
+ikrt_gc_allocation_samples_discard (ikptr s_count, ikpcb * pcb)
+/* Remove the first S_COUNT samples from the buffer; return a fixnum being
+   the number of bytes of the samples dropped because the buffer was full,
+   and reset such number. */
+{
+  long	count	= IK_UNFIX(s_count);
+  long	dropped = pcb->alloc_samples_dropped;
+  memmove(pcb->alloc_samples, pcb->alloc_samples + count,
+	  (pcb->alloc_samples_count - count) * sizeof(ik_alloc_sample));
+  pcb->alloc_samples_count  -= count;
+  pcb->alloc_samples_dropped = 0;
+  return IK_FIX(dropped);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Generation selection policy and nursery size.
+ ** ----------------------------------------------------------------- */
+
+ikptr
+ikrt_gc_collection_policy (ikptr s_policy, ikpcb * pcb)
+/* If  S_POLICY is a fixnum: select  it as policy  for the  selection of
+   the generation to  collect.  Return a fixnum representing  the policy
+   in use before this call. */
+{
+  int	old = pcb->collect_policy;
+  if (IK_IS_FIXNUM(s_policy))
+    pcb->collect_policy = (IK_GC_POLICY_ADAPTIVE == IK_UNFIX(s_policy))?
+      IK_GC_POLICY_ADAPTIVE : IK_GC_POLICY_FIXED;
+  return IK_FIX(old);
+}
+ikptr
+ikrt_gc_generation_threshold (ikptr s_gen, ikptr s_bytes, ikpcb * pcb)
+/* Return an exact integer representing the occupancy above which the
+   adaptive policy collects the generation  S_GEN.  If S_BYTES is not
+   false: it must be an exact integer to be set as new threshold. */
+{
+  int	gen = IK_UNFIX(s_gen);
+  long	old = pcb->gen_threshold[gen];
+  if (IK_FALSE != s_bytes)
+    pcb->gen_threshold[gen] = ik_integer_to_long(s_bytes);
+  return ika_integer_from_long(pcb, old);
+}
+ikptr
+ikrt_gc_generation_occupancy (ikptr s_gen, ikpcb * pcb)
+/* Return an exact integer representing  the number of bytes moved into
+   the generation S_GEN since it was last collected. */
+{
+  return ika_integer_from_long(pcb, pcb->gen_occupancy[IK_UNFIX(s_gen)]);
+}
+ikptr
+ikrt_gc_collection_time_target (ikptr s_target, ikpcb * pcb)
+/* Return a fixnum representing, in  thousandths, the fraction of real time
+   the nursery  size is  adapted to spend  collecting; zero  means the
+   nursery size is fixed.  If S_TARGET is a fixnum: set it as new target. */
+{
+  int	old = pcb->collect_time_target;
+  if (IK_IS_FIXNUM(s_target))
+    pcb->collect_time_target = IK_UNFIX(s_target);
+  return IK_FIX(old);
+}
+ikptr
+ikrt_gc_mark_region (ikptr s_flag, ikpcb * pcb)
+/* Return  a boolean, true if the  collections of the oldest  generation
+   mark pairs  and symbols rather than  copying them.  If S_FLAG  is a
+   fixnum: enable such collections if it is non-zero, disable them if it
+   is zero. */
+{
+  int	old = pcb->collect_mark_region;
+  if (IK_IS_FIXNUM(s_flag))
+    pcb->collect_mark_region = (IK_FIX(0) != s_flag);
+  return IK_BOOLEAN_FROM_INT(old);
+}
+ikptr
+ikrt_gc_pretenure_generation (ikptr s_gen, ikpcb * pcb)
+/* Return a  fixnum representing the  generation into which  the survivors
+   of the  collections are moved directly; zero means  pretenuring is
+   disabled.  If S_GEN is a fixnum: set it as new generation. */
+{
+  int	old = pcb->pretenure_generation;
+  if (IK_IS_FIXNUM(s_gen))
+    pcb->pretenure_generation = IK_UNFIX(s_gen);
+  return IK_FIX(old);
+}
+ikptr
+ikrt_gc_seal_static_generation (ikpcb * pcb)
+/* Run a collection of all the generations, then move all the pages of
+   the oldest generation  into the static generation: the objects  in it
+   will never be moved nor  released.  Return the number of bytes in the
+   static generation.
+
+   Weak pairs pages are left in the oldest generation, so that their
+   references are still broken when the referenced objects are collected.
+   The pages of the oldest generation are never dirty for references to
+   that same generation: the sealed pages are marked as dirty, so that the
+   next collection  finds the ones referencing  weak pairs and keeps them
+   dirty. */
+{
+  unsigned *	segment_vec;
+  unsigned *	dirty_vec;
+  long		lo_idx, hi_idx, i;
+  pcb->collect_major_request = 1;
+  ik_collect(4096, pcb);
+  segment_vec	= pcb->segment_vector;
+  dirty_vec	= (unsigned *)(long)pcb->dirty_vector;
+  lo_idx	= IK_PAGE_INDEX(pcb->memory_base);
+  hi_idx	= IK_PAGE_INDEX(pcb->memory_end);
+  for (i=lo_idx; i<hi_idx; ++i) {
+    unsigned	t = segment_vec[i];
+    if (((generation_count-1) == (t & gen_mask)) &&
+	(t & dealloc_mask) &&
+	(weak_pairs_type != (t & type_mask))) {
+      segment_vec[i] = (t & ~(gen_mask|meta_dirty_mask)) | IK_STATIC_GENERATION;
+      dirty_vec[i]   = (unsigned)-1;
+      pcb->static_bytes += IK_PAGESIZE;
+    }
+  }
+  pcb->gen_occupancy[generation_count-1] = 0;
+  pcb->gen_major_live			 = 0;
+  return ika_integer_from_long(pcb, pcb->static_bytes);
+}
+ikptr
+ikrt_gc_static_generation_size (ikpcb * pcb)
+/* Return the number of bytes in the static generation. */
+{
+  return ika_integer_from_long(pcb, pcb->static_bytes);
+}
+ikptr
+ikrt_gc_pause_time_target (ikptr s_usecs, ikpcb * pcb)
+/* Return an exact integer representing the pause target in microseconds;
+   zero means no target.  If S_USECS is not false: it must be an exact
+   integer to be set as new target. */
+{
+  long	old = pcb->collect_pause_target;
+  if (IK_FALSE != s_usecs)
+    pcb->collect_pause_target = ik_integer_to_long(s_usecs);
+  return ika_integer_from_long(pcb, old);
+}
+ikptr
+ikrt_gc_generation_pause (ikptr s_gen, ikpcb * pcb)
+/* Return an exact integer representing the average pause, in microseconds,
+   caused by collecting the generation S_GEN. */
+{
+  return ika_integer_from_long(pcb, pcb->gen_pause[IK_UNFIX(s_gen)]);
+}
+ikptr
+ikrt_gc_nursery_size (ikpcb * pcb)
+/* Return an exact integer representing the current size of the nursery. */
+{
+  return ika_integer_from_long(pcb, pcb->nursery_size);
+}
+ikptr
+ikrt_gc_page_cache_limit (ikptr s_pages, ikpcb * pcb)
+/* Return a fixnum representing the number of cached pages left resident
+   after a collection.  If S_PAGES is a fixnum: set it as new limit and
+   resize the page cache accordingly; return false if S_PAGES is out of
+   range. */
+{
+  int	old = pcb->cached_pages_limit;
+  if (IK_IS_FIXNUM(s_pages)) {
+    long	pages = IK_UNFIX(s_pages);
+    if ((pages < 0) || (pages > IK_PAGE_CACHE_MAX_LIMIT) ||
+	ik_resize_page_cache(pcb, (int)pages))
+      return IK_FALSE_OBJECT;
+  }
+  return IK_FIX(old);
+}
+ikptr
+ikrt_gc_page_cache_resident (ikpcb * pcb)
+/* Return a fixnum representing the number of cached pages still backed
+   by memory. */
+{
+  return IK_FIX(pcb->cached_pages_resident);
+}
+ikptr
+ikrt_gc_trim_page_cache (ikpcb * pcb)
+/* Unmap all the cached pages; return a fixnum representing their number. */
+{
+  return IK_FIX(ik_trim_cached_pages(pcb));
+}
+ikptr
+ikrt_gc_event_count (ikpcb * pcb)
+/* Return an exact integer representing the number of collection records
+   written so far. */
+{
+  return ika_integer_from_long(pcb, pcb->gc_events_count);
+}
+ikptr
+ikrt_gc_event (ikptr s_index, ikptr s_vec, ikpcb * pcb)
+/* Fill  the vector S_VEC with  the fields of the  collection record at
+   S_INDEX and return true;  if the record has been overwritten or not yet
+   written: return false.  Do  not change the  order of the fields!!!  It
+   must match the function "gc-events" in "scheme/ikarus.collect.sls". */
+{
+  long		idx = ik_integer_to_long(s_index);
+  ik_gc_event *	event;
+  if ((idx < 0) || (idx >= pcb->gc_events_count) || (idx < pcb->gc_events_count - IK_GC_EVENTS_COUNT))
+    return IK_FALSE_OBJECT;
+  event = &(pcb->gc_events[idx % IK_GC_EVENTS_COUNT]);
+  IK_ITEM(s_vec,  0) = IK_FIX(event->collection_id);
+  IK_ITEM(s_vec,  1) = IK_FIX(event->generation);
+  IK_ITEM(s_vec,  2) = IK_FIX(event->pause);
+  IK_ITEM(s_vec,  3) = IK_FIX(event->heap_before);
+  IK_ITEM(s_vec,  4) = IK_FIX(event->heap_after);
+  IK_ITEM(s_vec,  5) = IK_FIX(event->bytes_scanned);
+  IK_ITEM(s_vec,  6) = IK_FIX(event->dirty_pages);
+  IK_ITEM(s_vec,  7) = IK_FIX(event->guardians);
+  IK_ITEM(s_vec,  8) = IK_FIX(event->copied_pairs);
+  IK_ITEM(s_vec,  9) = IK_FIX(event->copied_symbols);
+  IK_ITEM(s_vec, 10) = IK_FIX(event->copied_pointers);
+  IK_ITEM(s_vec, 11) = IK_FIX(event->copied_data);
+  IK_ITEM(s_vec, 12) = IK_FIX(event->copied_code);
+  IK_ITEM(s_vec, 13) = IK_FIX(event->copied_weak_pairs);
+  return IK_TRUE_OBJECT;
+}
+ikptr
+ikrt_gc_generation_survival_rate (ikptr s_gen, ikpcb * pcb)
+/* Return a fixnum  representing, in thousandths, the survival rate of
+   the last collection of the generation S_GEN. */
+{
+  return IK_FIX(pcb->gen_survival[IK_UNFIX(s_gen)]);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Parallel sweeps of the page tables.
+ ** ----------------------------------------------------------------- */
+
+/* The phases of  a collection which only inspect the  page tables and
+   mutate  disjoint  sets of  pages  can  be split  among  a pool  of
+   worker threads;  the tracing of  live objects is  always performed by
+   the thread running "ik_collect()".
+
+   The pool is  started the first time a collection  is performed with
+   "pcb->sweep_threads" greater  than 1;  the workers are  never
+   terminated: between  two sweeps  they sleep  waiting for  the start
+   condition.  The pool is shared  by all the isolates in the process:
+   a collector finding it busy performs its sweep sequentially. */
+
+#ifdef HAVE_PTHREAD
+
+typedef struct gc_sweep_job_t {
+  gc_sweep_fun_t *	fun;
+  gc_t *		gc;
+  long			lo_idx;
+  long			hi_idx;
+  /* The value of "sweep_id" when the worker was started: the sweeps up to
+     it were handed to the workers already running. */
+  unsigned long		start_id;
+} gc_sweep_job_t;
+
+static struct {
+  /* Number of started worker threads, excluding the collector thread. */
+  int			count;
+  /* Held by the collector using the pool. */
+  pthread_mutex_t	owner;
+  pthread_mutex_t	mutex;
+  /* Signaled when a new sweep is started. */
+  pthread_cond_t	start_cond;
+  /* Signaled when the last worker finishes its job. */
+  pthread_cond_t	done_cond;
+  /* Incremented every time a new sweep is started. */
+  unsigned long		sweep_id;
+  /* Number of jobs not yet completed. */
+  int			pending;
+  pthread_t		threads[IK_GC_MAX_THREADS];
+  gc_sweep_job_t	jobs[IK_GC_MAX_THREADS];
+} gc_pool = {
+  .count	= 0,
+  .owner	= PTHREAD_MUTEX_INITIALIZER,
+  .mutex	= PTHREAD_MUTEX_INITIALIZER,
+  .start_cond	= PTHREAD_COND_INITIALIZER,
+  .done_cond	= PTHREAD_COND_INITIALIZER,
+  .sweep_id	= 0,
+  .pending	= 0
+};
+
+static void *
+gc_pool_worker (void * data)
+{
+  gc_sweep_job_t *	job = data;
+  unsigned long		seen_id;
+  pthread_mutex_lock(&gc_pool.mutex);
+  seen_id = job->start_id;
+  pthread_mutex_unlock(&gc_pool.mutex);
+  for (;;) {
+    pthread_mutex_lock(&gc_pool.mutex);
+    while (seen_id == gc_pool.sweep_id)
+      pthread_cond_wait(&gc_pool.start_cond, &gc_pool.mutex);
+    seen_id = gc_pool.sweep_id;
+    pthread_mutex_unlock(&gc_pool.mutex);
+    if (job->fun)
+      job->fun(job->gc, job->lo_idx, job->hi_idx);
+    pthread_mutex_lock(&gc_pool.mutex);
+    if (0 == --gc_pool.pending)
+      pthread_cond_signal(&gc_pool.done_cond);
+    pthread_mutex_unlock(&gc_pool.mutex);
+  }
+  return NULL;
+}
+static void
+gc_pool_start (int count)
+/* Start the worker threads needed  to have COUNT workers in the pool.
+   Interprocess signals are blocked in the workers: they must be handled
+   by the thread running Scheme code. */
+{
+  sigset_t	all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  for (; gc_pool.count < count; ++gc_pool.count) {
+    gc_sweep_job_t *	job = &gc_pool.jobs[gc_pool.count];
+    job->fun = NULL;
+    /* Read by the worker  instead of the current "sweep_id", which may
+       already be the one of the sweep it must run. */
+    pthread_mutex_lock(&gc_pool.mutex);
+    job->start_id = gc_pool.sweep_id;
+    pthread_mutex_unlock(&gc_pool.mutex);
+    if (pthread_create(&gc_pool.threads[gc_pool.count], NULL, gc_pool_worker, job))
+      break;
+    pthread_detach(gc_pool.threads[gc_pool.count]);
+  }
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+#endif /* HAVE_PTHREAD */
+
+static void
+gc_parallel_sweep (gc_t * gc, gc_sweep_fun_t * fun)
+/* Apply FUN to all the slots of the page tables.  If the PCB requests
+   more than one thread and the tables are big enough: split the range in
+   chunks and  hand all  but the first  to the worker  threads; then
+   process the first chunk and wait for the workers to finish. */
+{
+  long	lo_idx	= IK_PAGE_INDEX(gc->pcb->memory_base);
+  long	hi_idx	= IK_PAGE_INDEX(gc->pcb->memory_end);
+#ifdef HAVE_PTHREAD
+  int	threads	= gc->pcb->sweep_threads;
+  if ((1 < threads) && (IK_GC_PARALLEL_MIN_PAGES <= (hi_idx - lo_idx)) &&
+      (0 == pthread_mutex_trylock(&gc_pool.owner))) {
+    if (gc_pool.count < threads - 1)
+      gc_pool_start(threads - 1);
+    int		workers	= ((threads - 1) < gc_pool.count)? (threads - 1) : gc_pool.count;
+    long	chunk	= ((hi_idx - lo_idx) + workers) / (workers + 1);
+    long	idx	= lo_idx + chunk;
+    int		i;
+    pthread_mutex_lock(&gc_pool.mutex);
+    for (i=0; i<gc_pool.count; ++i) {
+      gc_sweep_job_t *	job = &gc_pool.jobs[i];
+      if (i < workers) {
+	job->fun	= fun;
+	job->gc		= gc;
+	job->lo_idx	= (idx < hi_idx)? idx : hi_idx;
+	job->hi_idx	= ((idx + chunk) < hi_idx)? (idx + chunk) : hi_idx;
+	idx		+= chunk;
+      } else
+	job->fun	= NULL;
+    }
+    gc_pool.pending = gc_pool.count;
+    ++gc_pool.sweep_id;
+    pthread_cond_broadcast(&gc_pool.start_cond);
+    pthread_mutex_unlock(&gc_pool.mutex);
+    fun(gc, lo_idx, lo_idx + chunk);
+    pthread_mutex_lock(&gc_pool.mutex);
+    while (gc_pool.pending)
+      pthread_cond_wait(&gc_pool.done_cond, &gc_pool.mutex);
+    pthread_mutex_unlock(&gc_pool.mutex);
+    pthread_mutex_unlock(&gc_pool.owner);
+    return;
+  }
+#endif
+  fun(gc, lo_idx, hi_idx);
+}
 
 /* end of file */
@@ -29,6 +29,11 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#  include <signal.h>
+#endif
+
 #ifndef RTLD_DEFAULT
 #define RTLD_DEFAULT 0
 #endif
@@ -41,6 +46,10 @@ typedef struct {
   ikptr		code_ep;
   ikptr*	marks;
   int		marks_size;
+  /* The mark assigned by the next "m" object field. */
+  uint32_t	next_mark;
+  /* The allocation buffer from which the objects are allocated. */
+  ik_alloc_buffer *	buffer;
 } fasl_port;
 
 typedef struct {
@@ -50,9 +59,22 @@ typedef struct {
 } code_header;
 
 static ikptr ik_fasl_read(ikpcb* pcb, fasl_port* p);
+static long  lz_decompress (const uint8_t * src, long len, uint8_t * dst, long cap);
+static ikptr fasl_decode_indexed (ikpcb* pcb, char* fasl_file, char* mem, long filesize);
+static void  fasl_exec_indexed (ikpcb* pcb, char* fasl_file, ikptr s_codes);
 
 #define DEBUG_FASL	0
 
+static inline ikptr
+fasl_alloc (ikpcb * pcb, fasl_port * p, long size)
+/* Allocate SIZE bytes, filtered through "IK_ALIGN()", for an object read
+   from P; never runs a garbage collection.  The ports of an indexed boot
+   image are read concurrently: every one has its own buffer, while the
+   other mutations of the PCB are performed holding "ik_alloc_lock()". */
+{
+  return ik_buffer_alloc(pcb, p->buffer, size);
+}
+
 static int	object_count = 0;
 
 
@@ -64,8 +86,11 @@ ik_fasl_load (ikpcb* pcb, char* fasl_file)
   int		mapsize;
   char *	mem;
   fasl_port	p;
+  ik_alloc_buffer	buf;
   if (DEBUG_FASL)
     ik_debug_message("loading boot image file: %s", fasl_file);
+  if (ik_fasl_load_mapped(pcb, fasl_file))
+    return;
   fd = open(fasl_file, O_RDONLY);
   if (-1 == fd)
     ik_abort("failed to open boot file \"%s\": %s", fasl_file, strerror(errno));
@@ -82,17 +107,32 @@ ik_fasl_load (ikpcb* pcb, char* fasl_file)
   mem		= mmap(0, mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
   if (MAP_FAILED == mem)
     ik_abort("mapping failed for %s: %s", fasl_file, strerror(errno));
+  if ((filesize >= IK_FASL_INDEX_HEADER_LEN) &&
+      (0 == memcmp(mem, IK_FASL_INDEX_HEADER, IK_FASL_INDEX_HEADER_LEN))) {
+    ikptr	s_codes = fasl_decode_indexed(pcb, fasl_file, mem, filesize);
+    if (munmap(mem, mapsize))
+      ik_abort("failed to unmap fasl file: %s", strerror(errno));
+    close(fd);
+    fasl_exec_indexed(pcb, fasl_file, s_codes);
+    return;
+  }
   p.membase	= mem;	/* byte array in which to load the boot image */
   p.memp	= mem;	/* pointer to the next byte to fill */
   p.memq	= mem + filesize;	/* one-off end pointer */
   p.marks	= 0;
   p.marks_size	= 0;
+  p.next_mark	= 1;
+  p.buffer	= &buf;
   while (p.memp < p.memq) {
     p.code_ap	= 0;
     p.code_ep	= 0;
     if (DEBUG_FASL)
       ik_debug_message("read boot image super-object (it must be a code object)");
+    /* The  buffer  is registered  only while  reading: executing  the code
+       object may run a garbage collection. */
+    ik_alloc_buffer_register(pcb, &buf);
     ikptr v = ik_fasl_read(pcb, &p);
+    ik_alloc_buffer_unregister(pcb, &buf);
     /* Clear table of  marks.  Every super-object in the  boot image has
        its own table. */
     if (p.marks_size) {
@@ -100,6 +140,7 @@ ik_fasl_load (ikpcb* pcb, char* fasl_file)
       p.marks = 0;
       p.marks_size = 0;
     }
+    p.next_mark = 1;
     if (p.memp == p.memq) {
       if (DEBUG_FASL)
 	ik_debug_message("finished reading all the boot image");
@@ -132,7 +173,10 @@ alloc_code (long int size, ikpcb* pcb, fasl_port* p)
     p->code_ap = nap;
     return ap;
   } else if (asize < IK_PAGESIZE) {
-    ikptr	mem		= ik_mmap_code(IK_PAGESIZE, 0, pcb);
+    ikptr	mem;
+    ik_alloc_lock(pcb);
+    mem = ik_mmap_code(IK_PAGESIZE, 0, pcb);
+    ik_alloc_unlock(pcb);
     long	bytes_remaining = IK_PAGESIZE - asize;
     long	previous_bytes	= ((ik_ulong)p->code_ep) - ((ik_ulong)ap);
     if (bytes_remaining <= previous_bytes) {
@@ -144,7 +188,10 @@ alloc_code (long int size, ikpcb* pcb, fasl_port* p)
     }
   } else {
     long	asize = IK_ALIGN_TO_NEXT_PAGE(size);
-    ikptr	mem   = ik_mmap_code(asize, 0, pcb);
+    ikptr	mem;
+    ik_alloc_lock(pcb);
+    mem = ik_mmap_code(asize, 0, pcb);
+    ik_alloc_unlock(pcb);
     return mem;
   }
 }
@@ -267,6 +314,24 @@ fasl_read_byte (fasl_port* p)
     ik_abort("%s: read beyond EOF", __func__);
   return c;
 }
+static uint32_t
+fasl_read_uleb128 (fasl_port* p)
+/* Read an unsigned integer encoded with 7 bits per byte, least
+   significant group first; every byte but the last has the high bit
+   set. */
+{
+  uint32_t	n     = 0;
+  int		shift = 0;
+  unsigned char	c;
+  do {
+    c = (unsigned char)fasl_read_byte(p);
+    if (shift > 28)
+      ik_abort("%s: integer too big", __func__);
+    n |= ((uint32_t)(c & 0x7F)) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return n;
+}
 static void
 fasl_read_buf (fasl_port* p, void* buf, int n)
 /* Read a block of bytes from a FASL port.  N is the number of bytes and
@@ -295,6 +360,35 @@ fasl_read_buf (fasl_port* p, void* buf, int n)
 }
 
 
+static void
+fasl_reserve_mark (fasl_port* p, uint32_t idx)
+/* Make sure the  table of marks has a  slot for IDX and that  the slot is
+   still empty.  The table  starts small and grows by doubling, so its
+   size is proportional to the number of marks actually defined. */
+{
+#define MARKS_INITIAL_SIZE	((int)(IK_PAGESIZE / sizeof(ikptr)))
+  if (0 == idx)
+    ik_abort("%s: invalid mark 0", __func__);
+  if (idx < (uint32_t)p->marks_size) {
+    if (p->marks[idx] != 0)
+      ik_abort("%s: mark %u already set", __func__, idx);
+  } else {
+    long	size = (p->marks_size)? p->marks_size : MARKS_INITIAL_SIZE;
+    ikptr*	marks;
+    while (idx >= size)
+      size *= 2;
+    if (size > INT_MAX)
+      ik_abort("%s: mark too big: %u", __func__, idx);
+    marks = (ikptr*)(long)ik_mmap(size * sizeof(ikptr));
+    bzero(marks, size * sizeof(ikptr));
+    if (p->marks) {
+      memcpy(marks, p->marks, p->marks_size * sizeof(ikptr));
+      ik_munmap((ikptr)(long)p->marks, p->marks_size * sizeof(ikptr));
+    }
+    p->marks	  = marks;
+    p->marks_size = (int)size;
+  }
+}
 static ikptr
 do_read (ikpcb* pcb, fasl_port* p)
 /* Read and return an object form a FASL port.
@@ -317,23 +411,13 @@ do_read (ikpcb* pcb, fasl_port* p)
     put_mark_index = idx;
     /* Read the header of the next object. */
     c = fasl_read_byte(p);
-    /* if (idx <= 0) */
-    /*   ik_abort("%s: invalid index %d", __func__, idx); */
-    if (p->marks) {
-      if (idx >= p->marks_size)
-        ik_abort("%s: mark too big: %d", __func__, idx);
-      if (idx < p->marks_size) {
-        if (p->marks[idx] != 0)
-          ik_abort("%s: mark %d already set", __func__, idx);
-      }
-    } else {
-      /* This is the first mark read.  Allocate the marks array. */
-#define NUM_OF_MARKS		(4 * IK_CHUNK_SIZE)
-#define MARKS_BLOCK_SIZE	(NUM_OF_MARKS * sizeof(ikptr*))
-      p->marks = (ikptr*)(long)ik_mmap(MARKS_BLOCK_SIZE);
-      bzero(p->marks, MARKS_BLOCK_SIZE);
-      p->marks_size = NUM_OF_MARKS;
-    }
+    fasl_reserve_mark(p, idx);
+  } else if (c == 'm') {
+    /* Compact mark definition: the marks are assigned in order, so the
+       index is not stored in the file. */
+    put_mark_index = p->next_mark++;
+    c = fasl_read_byte(p);
+    fasl_reserve_mark(p, put_mark_index);
   }
   if (c == 'x') {	/* code object */
     if (DEBUG_FASL) ik_debug_message("open %d: code object", object_count++);
@@ -361,7 +445,7 @@ do_read (ikpcb* pcb, fasl_port* p)
   }
   else if (c == 'P') {
     if (DEBUG_FASL) ik_debug_message("open %d: pair object", object_count++);
-    ikptr pair = ik_unsafe_alloc(pcb, pair_size) | pair_tag;
+    ikptr pair = fasl_alloc(pcb, p, pair_size) | pair_tag;
     if (put_mark_index) {
       p->marks[put_mark_index] = pair;
     }
@@ -374,7 +458,9 @@ do_read (ikpcb* pcb, fasl_port* p)
     if (DEBUG_FASL) ik_debug_message("open %d: symbol object", object_count++);
     /* symbol */
     ikptr str = do_read(pcb, p);
+    ik_alloc_lock(pcb);
     ikptr sym = ikrt_string_to_symbol(str, pcb);
+    ik_alloc_unlock(pcb);
     if (put_mark_index) {
       p->marks[put_mark_index] = sym;
     }
@@ -388,7 +474,7 @@ do_read (ikpcb* pcb, fasl_port* p)
     fasl_read_buf(p, &len, sizeof(long));
     if (DEBUG_FASL) ik_debug_message("string length: %ld", len);
     long size = IK_ALIGN(len*IK_STRING_CHAR_SIZE + disp_string_data);
-    ikptr str = ik_unsafe_alloc(pcb, size) | string_tag;
+    ikptr str = fasl_alloc(pcb, p, size) | string_tag;
     IK_REF(str, off_string_length) = IK_FIX(len);
     fasl_read_buf(p, (char*)(long)str+off_string_data, len);
     if (DEBUG_FASL) fwrite((char*)(long)(str+off_string_data), 1, len, stderr);
@@ -413,7 +499,7 @@ do_read (ikpcb* pcb, fasl_port* p)
     long len = 0;
     fasl_read_buf(p, &len, sizeof(long));
     long size = IK_ALIGN(len*IK_STRING_CHAR_SIZE + disp_string_data);
-    ikptr str = ik_unsafe_alloc(pcb, size) | string_tag;
+    ikptr str = fasl_alloc(pcb, p, size) | string_tag;
     IK_REF(str, off_string_length) = IK_FIX(len);
     long i;
     for (i=0; i<len; i++) {
@@ -433,7 +519,7 @@ do_read (ikpcb* pcb, fasl_port* p)
     long len = 0;
     fasl_read_buf(p, &len, sizeof(long));
     long size = IK_ALIGN(len * wordsize + disp_vector_data);
-    ikptr vec = ik_unsafe_alloc(pcb, size) | vector_tag;
+    ikptr vec = fasl_alloc(pcb, p, size) | vector_tag;
     if (put_mark_index) {
       p->marks[put_mark_index] = vec;
     }
@@ -477,7 +563,9 @@ do_read (ikpcb* pcb, fasl_port* p)
     /* G is for gensym */
     ikptr pretty = do_read(pcb, p);
     ikptr unique = do_read(pcb, p);
+    ik_alloc_lock(pcb);
     ikptr sym = ikrt_strings_to_gensym(pretty, unique, pcb);
+    ik_alloc_unlock(pcb);
     if (put_mark_index) {
       p->marks[put_mark_index] = sym;
     }
@@ -494,7 +582,7 @@ do_read (ikpcb* pcb, fasl_port* p)
     if (n == 0) {
       fields = IK_NULL_OBJECT;
     } else {
-      fields = ik_unsafe_alloc(pcb, n * IK_ALIGN(pair_size)) | pair_tag;
+      fields = fasl_alloc(pcb, p, n * IK_ALIGN(pair_size)) | pair_tag;
       ikptr ptr = fields;
       for (i=0; i<n; i++) {
         IK_REF(ptr, off_car) = do_read(pcb, p);
@@ -504,10 +592,15 @@ do_read (ikpcb* pcb, fasl_port* p)
       ptr -= pair_size;
       IK_REF(ptr, off_cdr) = IK_NULL_OBJECT;
     }
-    ikptr gensym_val = IK_REF(symb, off_symbol_record_value);
+    /* The new RTD is  allocated before acquiring the lock, because a refill
+       of the buffer acquires it; it is garbage if the UID is already bound. */
+    ikptr new_rtd = fasl_alloc(pcb, p, IK_ALIGN(rtd_size)) | vector_tag;
+    ikptr gensym_val;
     ikptr rtd;
+    ik_alloc_lock(pcb);
+    gensym_val = IK_REF(symb, off_symbol_record_value);
     if (gensym_val == IK_UNBOUND_OBJECT) {
-      rtd = ik_unsafe_alloc(pcb, IK_ALIGN(rtd_size)) | vector_tag;
+      rtd = new_rtd;
       ikptr base_rtd = pcb->base_rtd;
       IK_REF(rtd, off_rtd_rtd)		= base_rtd;
       IK_REF(rtd, off_rtd_name)		= name;
@@ -521,6 +614,7 @@ do_read (ikpcb* pcb, fasl_port* p)
     } else {
       rtd = gensym_val;
     }
+    ik_alloc_unlock(pcb);
     if (put_mark_index) {
       p->marks[put_mark_index] = rtd;
     }
@@ -534,7 +628,7 @@ do_read (ikpcb* pcb, fasl_port* p)
     ikptr	s_struct;
     fasl_read_buf(p, &num_of_fields, sizeof(long));
     struct_size = IK_ALIGN((1 + num_of_fields) * sizeof(ikptr));
-    s_struct    = ik_unsafe_alloc(pcb, struct_size) | vector_tag;
+    s_struct    = fasl_alloc(pcb, p, struct_size) | vector_tag;
     s_rtd       = do_read(pcb, p);
     IK_REF(s_struct, 0) = s_rtd;
     for (i=0; i<num_of_fields; ++i) {
@@ -581,7 +675,7 @@ do_read (ikpcb* pcb, fasl_port* p)
 #endif
   else if (c == 'Q') { /* thunk */
     if (DEBUG_FASL) ik_debug_message("open %d: thunk object", object_count++);
-    ikptr s_proc = ik_unsafe_alloc(pcb, IK_ALIGN(disp_closure_data)) | closure_tag;
+    ikptr s_proc = fasl_alloc(pcb, p, IK_ALIGN(disp_closure_data)) | closure_tag;
     if (put_mark_index) {
       p->marks[put_mark_index] = s_proc;
     }
@@ -592,10 +686,43 @@ do_read (ikpcb* pcb, fasl_port* p)
     if (DEBUG_FASL) ik_debug_message("close %d: thunk object", --object_count);
     return s_proc;
   }
-  else if (c == '<') {
+  else if (c == 'z') { /* compressed section */
+    long	len = 0, packed_len = 0;
+    char *	mem;
+    char *	membase = p->membase;
+    char *	memq	= p->memq;
+    ikptr	x;
+    fasl_read_buf(p, &len,	  sizeof(long));
+    fasl_read_buf(p, &packed_len, sizeof(long));
+    if (put_mark_index || (len <= 0) || (packed_len < 0) || (packed_len > (p->memq - p->memp)))
+      ik_abort("%s: invalid compressed section", __func__);
+    /* Decompress the whole section into fresh pages, then read its object
+       fields from them as if they were in the file. */
+    mem = (char*)(long)ik_mmap(IK_ALIGN_TO_NEXT_PAGE(len));
+    if (len != lz_decompress((uint8_t*)p->memp, packed_len, (uint8_t*)mem, len))
+      ik_abort("%s: corrupted compressed section", __func__);
+    p->membase = mem;
+    p->memq    = mem + len;
+    {
+      char *	memp = p->memp + packed_len;
+      p->memp	 = mem;
+      x		 = do_read(pcb, p);
+      if (p->memp != p->memq)
+	ik_abort("%s: compressed section not fully read", __func__);
+      p->memp	 = memp;
+    }
+    p->membase = membase;
+    p->memq    = memq;
+    ik_munmap((ikptr)(long)mem, IK_ALIGN_TO_NEXT_PAGE(len));
+    return x;
+  }
+  else if ((c == '<') || (c == '=')) {
     if (DEBUG_FASL) ik_debug_message("open %d: marked object", object_count++);
     int idx = 0;
-    fasl_read_buf(p, &idx, sizeof(int));
+    if (c == '=')
+      idx = (int)fasl_read_uleb128(p);
+    else
+      fasl_read_buf(p, &idx, sizeof(int));
     if ((idx <= 0) || (idx >= p->marks_size))
       ik_abort("invalid index for ref %d", idx);
     ikptr obj = p->marks[idx];
@@ -613,7 +740,7 @@ do_read (ikpcb* pcb, fasl_port* p)
     long len = 0;
     fasl_read_buf(p, &len, sizeof(long));
     long  size = IK_ALIGN(len + disp_bytevector_data + 1);
-    ikptr x    = ik_unsafe_alloc(pcb, size) | bytevector_tag;
+    ikptr x    = fasl_alloc(pcb, p, size) | bytevector_tag;
     IK_REF(x, off_bytevector_length) = IK_FIX(len);
     fasl_read_buf(p, (void*)(long)(x+off_bytevector_data), len);
     ((char*)(long)x)[off_bytevector_data+len] = 0;
@@ -626,7 +753,7 @@ do_read (ikpcb* pcb, fasl_port* p)
   else if (c == 'l') {
     if (DEBUG_FASL) ik_debug_message("open %d: short list object", object_count++);
     int   len  = (unsigned char) fasl_read_byte(p);
-    ikptr pair = ik_unsafe_alloc(pcb, pair_size * (len+1)) | pair_tag;
+    ikptr pair = fasl_alloc(pcb, p, pair_size * (len+1)) | pair_tag;
     if (put_mark_index) {
       p->marks[put_mark_index] = pair;
     }
@@ -648,7 +775,7 @@ do_read (ikpcb* pcb, fasl_port* p)
     fasl_read_buf(p, &len, sizeof(long));
     if (len < 0)
       ik_abort("invalid len=%ld", len);
-    ikptr pair = ik_unsafe_alloc(pcb, pair_size * (len+1)) | pair_tag;
+    ikptr pair = fasl_alloc(pcb, p, pair_size * (len+1)) | pair_tag;
     if (put_mark_index) {
       p->marks[put_mark_index] = pair;
     }
@@ -666,7 +793,7 @@ do_read (ikpcb* pcb, fasl_port* p)
   }
   else if (c == 'f') {
     if (DEBUG_FASL) ik_debug_message("open %d: flonum object", object_count++);
-    ikptr x = ik_unsafe_alloc(pcb, flonum_size) | vector_tag;
+    ikptr x = fasl_alloc(pcb, p, flonum_size) | vector_tag;
     IK_REF(x, -vector_tag) = flonum_tag;
     fasl_read_buf(p, (void*)(long)(x+disp_flonum_data-vector_tag), 8);
     if (put_mark_index) {
@@ -709,7 +836,7 @@ do_read (ikpcb* pcb, fasl_port* p)
     first_word = bignum_tag			\
       | (sign << bignum_sign_shift)		\
       | (nlimbs << bignum_nlimbs_shift);
-    ikptr x = ik_unsafe_alloc(pcb, IK_ALIGN(number_of_octets + disp_bignum_data)) | vector_tag;
+    ikptr x = fasl_alloc(pcb, p, IK_ALIGN(number_of_octets + disp_bignum_data)) | vector_tag;
     IK_REF(x, -vector_tag) = (ikptr) first_word;
     /* Read the vector of limbs as vector of octets. */
     fasl_read_buf(p, (void*)(long)(x+off_bignum_data), number_of_octets);
@@ -726,12 +853,12 @@ do_read (ikpcb* pcb, fasl_port* p)
     ikptr x;
     if ((IK_TAGOF(real) == vector_tag)
 	&& (IK_REF(real, -vector_tag) == flonum_tag)) {
-      x = ik_unsafe_alloc(pcb, cflonum_size);
+      x = fasl_alloc(pcb, p, cflonum_size);
       IK_REF(x, 0) = cflonum_tag;;
       IK_REF(x, disp_cflonum_real) = real;
       IK_REF(x, disp_cflonum_imag) = imag;
     } else {
-      x = ik_unsafe_alloc(pcb, compnum_size);
+      x = fasl_alloc(pcb, p, compnum_size);
       IK_REF(x, 0) = compnum_tag;
       IK_REF(x, disp_compnum_real) = real;
       IK_REF(x, disp_compnum_imag) = imag;
@@ -764,4 +891,354 @@ ik_fasl_read (ikpcb* pcb, fasl_port* p)
   return s_bootimage;
 }
 
+
+/** --------------------------------------------------------------------
+ ** Indexed boot images.
+ ** ----------------------------------------------------------------- */
+
+/* An indexed boot image is the header IK_FASL_INDEX_HEADER, the number N
+   of sections and the length in bytes of every section, all of them as
+   64-bit little endian integers, followed by the N sections.  Every
+   section is a FASL object holding a code object, with its own table of
+   marks: the sections are independent, so they are decoded concurrently
+   by "pcb->fasl_load_threads" threads,  each reading from its own port
+   and allocating from its own buffer.  Then the thread running the PCB
+   executes the code objects in order. */
+
+typedef struct fasl_load_job_t {
+  ikpcb *	pcb;
+  /* Pointer to the first byte of the first section. */
+  char *	base;
+  /* Section I  goes from "base + offsets[I]" included to "base +
+     offsets[I+1]" excluded. */
+  long *	offsets;
+  long		count;
+  /* Vector of the decoded code objects. */
+  ikptr		s_codes;
+  /* Index of the next section to decode; incremented atomically. */
+  long		next;
+} fasl_load_job_t;
+
+static uint64_t
+fasl_read_u64le (const uint8_t * p)
+{
+  uint64_t	n = 0;
+  int		i;
+  for (i=7; i>=0; --i)
+    n = (n << 8) | p[i];
+  return n;
+}
+static void *
+fasl_load_worker (void * data)
+/* Decode the  sections of the job  DATA until none is left.  Run by the
+   worker threads and by the thread running the PCB. */
+{
+  fasl_load_job_t *	job = data;
+  ikpcb *		pcb = job->pcb;
+  ik_alloc_buffer	buf;
+  fasl_port		p;
+  long			i;
+  bzero(&p, sizeof(fasl_port));
+  p.buffer = &buf;
+  ik_alloc_buffer_register(pcb, &buf);
+  while ((i = __sync_fetch_and_add(&(job->next), 1)) < job->count) {
+    p.membase	= job->base + job->offsets[i];
+    p.memp	= p.membase;
+    p.memq	= job->base + job->offsets[i+1];
+    p.code_ap	= 0;
+    p.code_ep	= 0;
+    p.next_mark	= 1;
+    IK_ITEM(job->s_codes, i) = ik_fasl_read(pcb, &p);
+    if (p.memp != p.memq)
+      ik_abort("%s: section %ld of indexed boot image not fully read", __func__, i);
+    if (p.marks_size) {
+      ik_munmap((ikptr)(long)p.marks, p.marks_size*sizeof(ikptr*));
+      p.marks	   = 0;
+      p.marks_size = 0;
+    }
+  }
+  ik_alloc_buffer_unregister(pcb, &buf);
+  return NULL;
+}
+static ikptr
+fasl_decode_indexed (ikpcb* pcb, char* fasl_file, char* mem, long filesize)
+/* Decode the indexed boot image of FILESIZE bytes mapped at MEM; return a
+   vector holding its code objects.  No garbage collection is run. */
+{
+  const uint8_t *	index = (const uint8_t *)mem + IK_FASL_INDEX_HEADER_LEN;
+  long			avail = filesize - IK_FASL_INDEX_HEADER_LEN;
+  fasl_load_job_t	job;
+  long			i;
+  int			threads;
+  if (avail < 8)
+    ik_abort("invalid indexed boot image \"%s\"", fasl_file);
+  job.count = (long)fasl_read_u64le(index);
+  avail -= 8;
+  if ((job.count <= 0) || ((avail / 8) < job.count))
+    ik_abort("invalid number of sections in indexed boot image \"%s\"", fasl_file);
+  avail		-= 8 * job.count;
+  job.pcb	= pcb;
+  job.base	= (char *)(index + 8 + 8 * job.count);
+  job.next	= 0;
+  job.offsets	= ik_malloc((job.count + 1) * sizeof(long));
+  job.offsets[0] = 0;
+  for (i=0; i<job.count; ++i) {
+    uint64_t	len = fasl_read_u64le(index + 8 + 8 * i);
+    if (len > (uint64_t)(avail - job.offsets[i]))
+      ik_abort("invalid section length in indexed boot image \"%s\"", fasl_file);
+    job.offsets[i+1] = job.offsets[i] + (long)len;
+  }
+  if (job.offsets[job.count] != avail)
+    ik_abort("invalid indexed boot image \"%s\": trailing bytes", fasl_file);
+  job.s_codes = ik_unsafe_alloc(pcb, IK_ALIGN(disp_vector_data + job.count * wordsize)) | vector_tag;
+  IK_REF(job.s_codes, off_vector_length) = IK_FIX(job.count);
+  for (i=0; i<job.count; ++i)
+    IK_ITEM(job.s_codes, i) = IK_FALSE_OBJECT;
+  threads = pcb->fasl_load_threads;
+  if (threads > job.count)
+    threads = (int)job.count;
+#ifdef HAVE_PTHREAD
+  if (1 < threads) {
+    pthread_t	tids[IK_FASL_MAX_THREADS];
+    int		started;
+    sigset_t	all, old;
+    /* Interprocess signals must be handled by the thread running Scheme
+       code. */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (started=0; started < threads - 1; ++started)
+      if (pthread_create(&tids[started], NULL, fasl_load_worker, &job))
+	break;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    fasl_load_worker(&job);
+    for (i=0; i<started; ++i)
+      pthread_join(tids[i], NULL);
+  } else
+    fasl_load_worker(&job);
+#else
+  fasl_load_worker(&job);
+#endif
+  ik_free(job.offsets, (job.count + 1) * sizeof(long));
+  return job.s_codes;
+}
+static void
+fasl_exec_indexed (ikpcb* pcb, char* fasl_file, ikptr s_codes)
+/* Execute in  order the  code objects in  the vector S_CODES.  The vector
+   is a root: the code objects  not yet executed survive the collections
+   run by the executed ones. */
+{
+  long	i, count = IK_VECTOR_LENGTH(s_codes);
+  ik_push_root(pcb, &s_codes);
+  for (i=0; i<count; ++i) {
+    ikptr	s_code = IK_ITEM(s_codes, i);
+    ikptr	val;
+    IK_ITEM(s_codes, i) = IK_FALSE_OBJECT;
+    if (DEBUG_FASL)
+      ik_debug_message("executing boot image code object %ld", i);
+    val = ik_exec_code(pcb, s_code, 0, 0);
+    if (val != IK_VOID_OBJECT) {
+      ik_debug_message_no_newline("%s: code object from %s returned non-void value: ",
+				  __func__, fasl_file);
+      ik_print(val);
+    }
+  }
+  ik_pop_roots(pcb, 1);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Compressed sections.
+ ** ----------------------------------------------------------------- */
+
+/* The object fields  of a FASL object can be  stored in a "z" section,
+   compressed with an  in-tree LZ77 codec using  the LZ4 block format: a
+   sequence of records, each one a token byte  (high nibble: literals
+   count, low nibble:  match length minus 4, 15 meaning  that more length
+   bytes  follow), the  literal bytes,  a little endian 16-bit  match
+   offset and the further match length bytes.  The last record has only
+   literals.  Decompression is a loop of copies, so it costs about as
+   much as reading the uncompressed bytes. */
+
+#define LZ_MIN_MATCH		4
+#define LZ_HASH_BITS		12
+#define LZ_MAX_OFFSET		65535
+/* As required by the LZ4 block format: the  last 5 bytes are always
+   literals and no match starts in the last 12 bytes. */
+#define LZ_LAST_LITERALS	5
+#define LZ_MATCH_LIMIT		12
+
+static uint32_t
+lz_read32 (const uint8_t * p)
+{
+  uint32_t	v;
+  memcpy(&v, p, sizeof(uint32_t));
+  return v;
+}
+static uint8_t *
+lz_put_length (uint8_t * op, long len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = (uint8_t)len;
+  return op;
+}
+static uint8_t *
+lz_put_record (uint8_t * op, uint8_t * oend, const uint8_t * lit, long lit_len,
+	       long offset, long match_len)
+/* Append a record  to OP; a MATCH_LEN of  zero means no match. Return
+   the new output pointer, or NULL if the record does not fit. */
+{
+  long		mlen = (match_len)? (match_len - LZ_MIN_MATCH) : 0;
+  if ((oend - op) < (1 + lit_len + lit_len/255 + 1 + 2 + mlen/255 + 1))
+    return NULL;
+  *op++ = (uint8_t)((((lit_len < 15)? lit_len : 15) << 4) | ((mlen < 15)? mlen : 15));
+  if (lit_len >= 15)
+    op = lz_put_length(op, lit_len - 15);
+  memcpy(op, lit, lit_len);
+  op += lit_len;
+  if (match_len) {
+    *op++ = (uint8_t)(offset & 0xFF);
+    *op++ = (uint8_t)(offset >> 8);
+    if (mlen >= 15)
+      op = lz_put_length(op, mlen - 15);
+  }
+  return op;
+}
+static long
+lz_bound (long len)
+/* Return the maximum size of the compressed form of LEN bytes. */
+{
+  return len + len/255 + 16;
+}
+static long
+lz_compress (const uint8_t * src, long len, uint8_t * dst, long cap)
+/* Compress LEN bytes from SRC into the buffer DST of CAP bytes; return
+   the number of bytes written, or -1 if DST is too small. */
+{
+  long		table[1 << LZ_HASH_BITS];
+  uint8_t *	op     = dst;
+  uint8_t *	oend   = dst + cap;
+  long		anchor = 0, ip = 0;
+  memset(table, 0, sizeof(table));
+  while (ip + LZ_MATCH_LIMIT <= len) {
+    uint32_t	seq  = lz_read32(src + ip);
+    long	hash = (long)((seq * 2654435761U) >> (32 - LZ_HASH_BITS));
+    long	cand = table[hash];
+    table[hash] = ip;
+    if ((cand < ip) && ((ip - cand) <= LZ_MAX_OFFSET) && (lz_read32(src + cand) == seq)) {
+      long	mlen = LZ_MIN_MATCH;
+      while ((ip + mlen < len - LZ_LAST_LITERALS) && (src[cand + mlen] == src[ip + mlen]))
+	++mlen;
+      op = lz_put_record(op, oend, src + anchor, ip - anchor, ip - cand, mlen);
+      if (NULL == op)
+	return -1;
+      ip     += mlen;
+      anchor  = ip;
+    } else
+      ++ip;
+  }
+  op = lz_put_record(op, oend, src + anchor, len - anchor, 0, 0);
+  return (op)? (op - dst) : -1;
+}
+static long
+lz_decompress (const uint8_t * src, long len, uint8_t * dst, long cap)
+/* Decompress LEN bytes from  SRC into the buffer DST of CAP bytes;
+   return the number of bytes written, or -1 if SRC is invalid or DST is
+   too small. */
+{
+  const uint8_t *	ip   = src;
+  const uint8_t *	iend = src + len;
+  uint8_t *		op   = dst;
+  uint8_t *		oend = dst + cap;
+  while (ip < iend) {
+    unsigned	token = *ip++;
+    long	lit   = token >> 4;
+    long	mlen  = token & 15;
+    long	offset;
+    unsigned	b;
+    if (15 == lit) {
+      do {
+	if (ip == iend)
+	  return -1;
+	b    = *ip++;
+	lit += b;
+      } while (255 == b);
+    }
+    if ((lit > (iend - ip)) || (lit > (oend - op)))
+      return -1;
+    memcpy(op, ip, lit);
+    op += lit;
+    ip += lit;
+    if (ip == iend)
+      break;
+    if ((iend - ip) < 2)
+      return -1;
+    offset = ip[0] | (ip[1] << 8);
+    ip    += 2;
+    if ((0 == offset) || (offset > (op - dst)))
+      return -1;
+    if (15 == mlen) {
+      do {
+	if (ip == iend)
+	  return -1;
+	b     = *ip++;
+	mlen += b;
+      } while (255 == b);
+    }
+    mlen += LZ_MIN_MATCH;
+    if (mlen > (oend - op))
+      return -1;
+    if (offset >= mlen) {
+      memcpy(op, op - offset, mlen);
+      op += mlen;
+    } else {
+      /* Overlapping match: a run repeating the last OFFSET bytes. */
+      const uint8_t *	match = op - offset;
+      while (mlen--)
+	*op++ = *match++;
+    }
+  }
+  return op - dst;
+}
+ikptr
+ikrt_fasl_compress (ikptr s_bytes, ikpcb * pcb)
+/* Return a new bytevector holding  the compressed form of the bytevector
+   S_BYTES, or false if memory allocation fails. */
+{
+  long		len = IK_BYTEVECTOR_LENGTH(s_bytes);
+  long		cap = lz_bound(len);
+  uint8_t *	buf = malloc(cap);
+  ikptr		s_packed;
+  long		n;
+  if (NULL == buf)
+    return IK_FALSE;
+  n = lz_compress(IK_BYTEVECTOR_DATA_UINT8P(s_bytes), len, buf, cap);
+  if (n < 0) {
+    free(buf);
+    return IK_FALSE;
+  }
+  s_packed = ika_bytevector_alloc(pcb, n);
+  memcpy(IK_BYTEVECTOR_DATA_VOIDP(s_packed), buf, n);
+  free(buf);
+  return s_packed;
+}
+ikptr
+ikrt_fasl_decompress (ikptr s_packed, ikptr s_len, ikpcb * pcb)
+/* Return a  new bytevector of S_LEN  bytes holding the  decompressed form
+   of the bytevector S_PACKED, or false if S_PACKED is not a valid
+   compressed section of S_LEN bytes. */
+{
+  long		len = IK_UNFIX(s_len);
+  ikptr		s_bytes;
+  pcb->root0 = &s_packed;
+  {
+    s_bytes = ika_bytevector_alloc(pcb, len);
+  }
+  pcb->root0 = NULL;
+  if (len != lz_decompress(IK_BYTEVECTOR_DATA_UINT8P(s_packed), IK_BYTEVECTOR_LENGTH(s_packed),
+			      IK_BYTEVECTOR_DATA_UINT8P(s_bytes), len))
+    return IK_FALSE;
+  return s_bytes;
+}
+
 /* end of file */
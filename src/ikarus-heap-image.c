@@ -0,0 +1,889 @@
+/*
+ * Vicare Scheme -- heap images and mapped FASL files
+ *
+ * This program is free software:  you can redistribute it and/or modify
+ * it under  the terms of  the GNU General  Public License version  3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is  distributed in the hope that it  will be useful, but
+ * WITHOUT  ANY   WARRANTY;  without   even  the  implied   warranty  of
+ * MERCHANTABILITY  or FITNESS FOR  A PARTICULAR  PURPOSE.  See  the GNU
+ * General Public License for more details.
+ *
+ * You should  have received  a copy of  the GNU General  Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** --------------------------------------------------------------------
+ ** Headers.
+ ** ----------------------------------------------------------------- */
+
+#include "internals.h"
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* A heap image is  a copy of the objects reachable from  a thunk and from
+   the symbol tables, laid out in pages as the collector lays them out; it
+   is written by  "ikrt_save_heap_image()" and it is loaded  at startup, in
+   place of a boot file, by "ik_heap_image_run()".
+
+   The  sections  of the  image  are mapped  from  the file  with a  single
+   "mmap()" and adopted as pages of the static generation; references are
+   stored as offsets  from the start of the mapping  and the relocation table
+   lists  the words holding them,  so loading is a single  pass adding the
+   mapping address to them.  Code objects are then processed with
+   "ik_relocate_code()",  to fix the addresses in the machine code and to
+   resolve again the foreign symbols.
+
+   File layout, every table item is a 64-bit word:
+
+     header		an "image_header_t", padded to a page
+     sections		one after the other, each one page aligned
+     relocations	offsets of the words holding references
+     code objects	offsets of the code objects
+     buckets		tagged offsets of the tcbuckets whose key is in the heap
+     dirty pages	indexes of the static pages referencing weak pairs
+     symbols		pairs of tagged offsets: name string, unique string
+     fixups		pairs: offset of a word, fixup code
+
+   A mapped FASL file  is the same layout with  a different magic: it is
+   written by  "ikrt_fasl_write_mapped()" from  the code objects  of the
+   boot image and loaded by "ik_fasl_load()", which executes them in order
+   like  the  code  objects  read from  a  boot  file.   Symbols  and the
+   base  RTD are not copied,  because they  must be the  ones of the new
+   process: the words referencing them are listed in the fixups table and
+   set when loading,  after interning the symbols.   Struct type
+   descriptors  are copied,  but references to them are fixups too: as
+   with the "R"  FASL objects, the  descriptor already bound  to the UID
+   symbol wins. */
+
+#define IK_HEAP_IMAGE_MAGIC	"VICIMG01"
+#define IK_MAPPED_FASL_MAGIC	"VICFSL01"
+
+enum {
+  SECTION_POINTERS = 0,		/* the roots vector is the first object */
+  SECTION_PAIRS,
+  SECTION_SYMBOLS,
+  SECTION_CODE,
+  SECTION_DATA,
+  SECTION_WEAK_PAIRS,
+  SECTION_EPHEMERONS,
+  SECTIONS_COUNT
+};
+
+/* Section of  the symbols in a mapped  FASL file: they are not copied,
+   the offset of their object is their index in the symbols table. */
+#define SECTION_FIXUP		SECTIONS_COUNT
+
+/* Weak pairs and ephemerons go in  the oldest generation, so that major
+   collections still break them. */
+static const unsigned section_type[SECTIONS_COUNT] = {
+  pointers_mt			| IK_STATIC_GENERATION,
+  pointers_mt | pairs_page_tag	| IK_STATIC_GENERATION,
+  symbols_mt			| IK_STATIC_GENERATION,
+  code_mt			| IK_STATIC_GENERATION,
+  data_mt			| IK_STATIC_GENERATION,
+  weak_pairs_mt			| (generation_count-1),
+  ephemerons_mt			| (generation_count-1)
+};
+#define IS_WEAK_SECTION(S)	((SECTION_WEAK_PAIRS == (S)) || (SECTION_EPHEMERONS == (S)))
+
+/* Items of the roots vector. */
+#define ROOT_THUNK		0
+#define ROOT_SYMBOL_TABLE	1
+#define ROOT_GENSYM_TABLE	2
+#define ROOT_BASE_RTD		3
+#define ROOTS_COUNT		4
+
+/* Kinds of fixups, in the low bits of the fixup codes; the other bits of
+   a symbol fixup are the index of the symbol. */
+#define FIXUP_SYMBOL		0
+#define FIXUP_BASE_RTD		1
+#define FIXUP_RTD		2
+#define FIXUP_KIND_MASK		3
+#define FIXUP_SHIFT		2
+
+typedef struct image_header_t {
+  char		magic[8];
+  uint64_t	word_size;
+  uint64_t	section_size[SECTIONS_COUNT];
+  uint64_t	roots;
+  uint64_t	relocations_count;
+  uint64_t	codes_count;
+  uint64_t	buckets_count;
+  uint64_t	dirty_count;
+  uint64_t	symbols_count;
+  uint64_t	fixups_count;
+} image_header_t;
+
+typedef struct table_t {
+  uint64_t *	items;
+  long		len;
+  long		size;
+} table_t;
+
+typedef struct object_t {
+  ikptr		X;		/* tagged reference in the running heap */
+  int		section;
+  long		offset;		/* untagged offset in the section */
+  long		size;
+} object_t;
+
+typedef struct image_t {
+  ikpcb *	pcb;
+  /* True when writing a mapped FASL file. */
+  int		fasl;
+  long		first_page;
+  long		pages_count;
+  object_t *	objects;
+  long		objects_len;
+  long		objects_size;
+  /* Open addressing  map from untagged addresses to indexes in OBJECTS,
+     plus one; zero marks a free slot. */
+  long *	map;
+  long		map_size;
+  /* Objects whose references are not yet scheduled. */
+  long *	stack;
+  long		stack_len;
+  long		stack_size;
+  long		cursor[SECTIONS_COUNT];
+  long		base[SECTIONS_COUNT];
+  char *	data[SECTIONS_COUNT];
+  table_t	relocations;
+  table_t	codes;
+  table_t	buckets;
+  table_t	dirty;
+  table_t	symbols;
+  table_t	fixups;
+  long		symbols_len;
+  int		failed;
+} image_t;
+
+
+/** --------------------------------------------------------------------
+ ** Helpers.
+ ** ----------------------------------------------------------------- */
+
+static void
+table_add (table_t * T, uint64_t v)
+{
+  if (T->len == T->size) {
+    T->size  = (T->size)? (2 * T->size) : 4096;
+    T->items = realloc(T->items, T->size * sizeof(uint64_t));
+    if (NULL == T->items)
+      ik_abort("%s: memory allocation failed", __func__);
+  }
+  T->items[T->len++] = v;
+}
+static int
+is_heap_object (image_t * I, ikptr X)
+/* Return true if X is a reference to an object in the Scheme heap. */
+{
+  long	idx;
+  if (IK_IS_FIXNUM(X) || (immediate_tag == IK_TAGOF(X)))
+    return 0;
+  idx = IK_PAGE_INDEX(X);
+  if ((idx < I->first_page) || (idx >= I->first_page + I->pages_count))
+    return 0;
+  return (hole_type != (I->pcb->segment_vector[idx] & type_mask));
+}
+static long
+map_slot (image_t * I, ikptr X)
+/* Return the slot of the map holding X or the free slot for it. */
+{
+  ik_ulong	key  = ((ik_ulong)(X - IK_TAGOF(X))) >> 3;
+  long		mask = I->map_size - 1;
+  long		i    = (long)((key * 2654435761UL) & mask);
+  while (I->map[i]) {
+    object_t *	O = &(I->objects[I->map[i] - 1]);
+    if ((O->X - IK_TAGOF(O->X)) == (X - IK_TAGOF(X)))
+      break;
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+static long
+lookup (image_t * I, ikptr X)
+/* Return the index of X in the objects array, or -1. */
+{
+  long	i = map_slot(I, X);
+  return (I->map[i])? (I->map[i] - 1) : -1;
+}
+static void
+map_grow (image_t * I)
+{
+  long *	old	 = I->map;
+  long		old_size = I->map_size;
+  long		i;
+  I->map_size = (old_size)? (2 * old_size) : (1 << 16);
+  I->map      = calloc(I->map_size, sizeof(long));
+  if (NULL == I->map)
+    ik_abort("%s: memory allocation failed", __func__);
+  for (i=0; i<old_size; ++i)
+    if (old[i])
+      I->map[map_slot(I, I->objects[old[i] - 1].X)] = old[i];
+  free(old);
+}
+static long
+place (image_t * I, int section, long size)
+/* Reserve SIZE bytes in SECTION; return their offset.  Code objects do
+   not  cross page boundaries, unless they are  bigger than a page: in
+   this case they start and end at a page boundary. */
+{
+  long	offset = I->cursor[section];
+  if (SECTION_CODE == section) {
+    long	room = IK_PAGESIZE - (offset & (IK_PAGESIZE - 1));
+    if ((size > room) && (room < IK_PAGESIZE))
+      offset = IK_ALIGN_TO_NEXT_PAGE(offset);
+    I->cursor[section] = offset + size;
+    if (size > IK_PAGESIZE)
+      I->cursor[section] = IK_ALIGN_TO_NEXT_PAGE(I->cursor[section]);
+  } else
+    I->cursor[section] = offset + size;
+  return offset;
+}
+
+
+/** --------------------------------------------------------------------
+ ** Objects layout.
+ ** ----------------------------------------------------------------- */
+
+static int
+object_layout (image_t * I, ikptr X, int * section, long * size)
+/* Store in SECTION and SIZE the section and the aligned size of X; return
+   false if X cannot be saved in an image. */
+{
+  int		tag	   = IK_TAGOF(X);
+  ikptr		first_word = IK_REF(X, -tag);
+  unsigned	bits	   = I->pcb->segment_vector[IK_PAGE_INDEX(X)];
+  if (pair_tag == tag) {
+    if (weak_pairs_type == (bits & type_mask))
+      *section = (bits & ephemerons_page_mask)? SECTION_EPHEMERONS : SECTION_WEAK_PAIRS;
+    else
+      *section = SECTION_PAIRS;
+    *size = pair_size;
+  }
+  else if (closure_tag == tag) {
+    *section = SECTION_POINTERS;
+    *size    = IK_ALIGN(disp_closure_data + IK_REF(first_word, disp_code_freevars - disp_code_data));
+  }
+  else if (string_tag == tag) {
+    *section = SECTION_DATA;
+    *size    = IK_ALIGN(IK_UNFIX(first_word) * IK_STRING_CHAR_SIZE + disp_string_data);
+  }
+  else if (bytevector_tag == tag) {
+    *section = SECTION_DATA;
+    *size    = IK_ALIGN(IK_UNFIX(first_word) + disp_bytevector_data + 1);
+  }
+  else if (vector_tag != tag)
+    ik_abort("%s: unhandled tag %d", __func__, tag);
+  else if (IK_IS_FIXNUM(first_word)) {
+    *section = SECTION_POINTERS;
+    *size    = IK_ALIGN(first_word + disp_vector_data);
+  }
+  else if (symbol_tag == first_word) {
+    *section = SECTION_SYMBOLS;
+    *size    = symbol_record_size;
+  }
+  else if (rtd_tag == IK_TAGOF(first_word)) {
+    *section = SECTION_POINTERS;
+    *size    = IK_ALIGN(IK_REF(first_word, off_rtd_length) + wordsize);
+  }
+  else if (code_tag == first_word) {
+    *section = SECTION_CODE;
+    *size    = IK_ALIGN(IK_UNFIX(IK_REF(X, disp_code_code_size - code_primary_tag)) + disp_code_data);
+  }
+  else if ((continuation_tag == first_word) || (system_continuation_tag == first_word))
+    return 0;
+  else if (pair_tag == IK_TAGOF(first_word)) {
+    *section = SECTION_POINTERS;
+    *size    = tcbucket_size;
+  }
+  else if (port_tag == (((long)first_word) & port_mask)) {
+    *section = SECTION_POINTERS;
+    *size    = port_size;
+  }
+  else if (flonum_tag == first_word) {
+    *section = SECTION_DATA;
+    *size    = flonum_size;
+  }
+  else if (bignum_tag == (first_word & bignum_mask)) {
+    *section = SECTION_DATA;
+    *size    = IK_ALIGN(disp_bignum_data + (((ik_ulong)first_word) >> bignum_nlimbs_shift) * wordsize);
+  }
+  else if ((ratnum_tag == first_word) || (compnum_tag == first_word) || (cflonum_tag == first_word)) {
+    *section = SECTION_POINTERS;
+    *size    = ratnum_size;
+  }
+  else if (pointer_tag == first_word) {
+    *section = SECTION_DATA;
+    *size    = pointer_size;
+  }
+  else
+    ik_abort("%s: unhandled vector with first_word=0x%016lx", __func__, (long)first_word);
+  return 1;
+}
+static void
+add_object (image_t * I, ikptr X)
+/* If X is a heap object not yet in the image: reserve its place and
+   schedule its references. */
+{
+  object_t *	O;
+  int		section = SECTION_DATA;
+  long		size	= 0;
+  int		symbol	= 0;
+  if ((! is_heap_object(I, X)) || (0 <= lookup(I, X)))
+    return;
+  if (I->fasl && (X == I->pcb->base_rtd))
+    return;
+  if (I->fasl && (vector_tag == IK_TAGOF(X)) && (symbol_tag == IK_REF(X, -vector_tag))) {
+    ikptr	s_ustring = IK_REF(X, off_symbol_record_ustring);
+    /* The names of gensyms are generated lazily: they must be already
+       there. */
+    if ((string_tag != IK_TAGOF(IK_REF(X, off_symbol_record_string))) ||
+	((IK_FALSE_OBJECT != s_ustring) && (string_tag != IK_TAGOF(s_ustring)))) {
+      I->failed = 1;
+      return;
+    }
+    symbol  = 1;
+    section = SECTION_FIXUP;
+  } else if (! object_layout(I, X, &section, &size)) {
+    I->failed = 1;
+    return;
+  }
+  if (I->objects_len == I->objects_size) {
+    I->objects_size = (I->objects_size)? (2 * I->objects_size) : 4096;
+    I->objects	    = realloc(I->objects, I->objects_size * sizeof(object_t));
+    if (NULL == I->objects)
+      ik_abort("%s: memory allocation failed", __func__);
+  }
+  if (2 * I->objects_len >= I->map_size)
+    map_grow(I);
+  O	     = &(I->objects[I->objects_len]);
+  O->X	     = X;
+  O->section = section;
+  O->offset  = (symbol)? (I->symbols_len++) : place(I, section, size);
+  O->size    = size;
+  I->map[map_slot(I, X)] = ++(I->objects_len);
+  if (symbol) {
+    add_object(I, IK_REF(X, off_symbol_record_string));
+    add_object(I, IK_REF(X, off_symbol_record_ustring));
+    return;
+  }
+  if (I->stack_len == I->stack_size) {
+    I->stack_size = (I->stack_size)? (2 * I->stack_size) : 4096;
+    I->stack	  = realloc(I->stack, I->stack_size * sizeof(long));
+    if (NULL == I->stack)
+      ik_abort("%s: memory allocation failed", __func__);
+  }
+  I->stack[I->stack_len++] = I->objects_len - 1;
+}
+
+
+/** --------------------------------------------------------------------
+ ** Objects copying.
+ ** ----------------------------------------------------------------- */
+
+static ikptr
+translate (image_t * I, ikptr v)
+/* Return the reference to V in the image. */
+{
+  object_t *	T = &(I->objects[lookup(I, v)]);
+  return (ikptr)(I->base[T->section] + T->offset + IK_TAGOF(v));
+}
+static void
+add_fixup (image_t * I, long at, long code)
+{
+  table_add(&(I->fixups), at);
+  table_add(&(I->fixups), code);
+}
+static void
+store (image_t * I, int section, long offset, ikptr v)
+/* Store in the image word at OFFSET of SECTION the translation of v. */
+{
+  long		at = I->base[section] + offset;
+  ikptr *	p  = (ikptr *)(I->data[section] + offset);
+  if (I->fasl && is_heap_object(I, v) && (v == I->pcb->base_rtd)) {
+    *p = IK_FALSE_OBJECT;
+    add_fixup(I, at, FIXUP_BASE_RTD);
+  } else if (I->fasl && is_heap_object(I, v) && (SECTION_FIXUP == I->objects[lookup(I, v)].section)) {
+    *p = IK_FALSE_OBJECT;
+    add_fixup(I, at, (I->objects[lookup(I, v)].offset << FIXUP_SHIFT) | FIXUP_SYMBOL);
+  } else if (is_heap_object(I, v)) {
+    object_t *	T = &(I->objects[lookup(I, v)]);
+    *p = translate(I, v);
+    table_add(&(I->relocations), at);
+    if (I->fasl && (vector_tag == IK_TAGOF(v)) && (I->pcb->base_rtd == IK_REF(v, -vector_tag)))
+      add_fixup(I, at, FIXUP_RTD);
+    if (IS_WEAK_SECTION(T->section) && (! IS_WEAK_SECTION(section))) {
+      uint64_t	page = at >> IK_PAGESHIFT;
+      if ((0 == I->dirty.len) || (page != I->dirty.items[I->dirty.len - 1]))
+	table_add(&(I->dirty), page);
+    }
+  } else
+    *p = v;
+}
+static void
+field (image_t * I, long idx, long disp, int copy)
+/* Process the field at DISP of the object IDX: with COPY false schedule
+   it, else store its translation. */
+{
+  object_t	O = I->objects[idx];
+  ikptr		v = IK_REF(O.X - IK_TAGOF(O.X), disp);
+  if (copy)
+    store(I, O.section, O.offset + disp, v);
+  else
+    add_object(I, v);
+}
+static void
+process_object (image_t * I, long idx, int copy)
+/* With COPY  false: schedule the references  of the object IDX.  With
+   COPY true: copy the object in its section and translate its
+   references. */
+{
+  object_t	O	   = I->objects[idx];
+  int		tag	   = IK_TAGOF(O.X);
+  ikptr		x	   = O.X - tag;
+  ikptr		first_word = IK_REF(x, 0);
+  long		i;
+  if (SECTION_FIXUP == O.section)
+    return;
+  if (copy)
+    memcpy(I->data[O.section] + O.offset, (char *)(long)x, O.size);
+  if (pair_tag == tag) {
+    /* The car of a weak pair is retained, else it would dangle. */
+    field(I, idx, disp_car, copy);
+    field(I, idx, disp_cdr, copy);
+  }
+  else if (closure_tag == tag) {
+    ikptr	code = (first_word - disp_code_data) | code_primary_tag;
+    long	size = disp_closure_data + IK_REF(first_word, disp_code_freevars - disp_code_data);
+    if (copy) {
+      object_t *	T = &(I->objects[lookup(I, code)]);
+      *((ikptr *)(I->data[O.section] + O.offset)) = (ikptr)(I->base[T->section] + T->offset + disp_code_data);
+      table_add(&(I->relocations), I->base[O.section] + O.offset);
+    } else
+      add_object(I, code);
+    for (i=disp_closure_data; i<size; i+=wordsize)
+      field(I, idx, i, copy);
+  }
+  else if ((string_tag == tag) || (bytevector_tag == tag))
+    return;
+  else if (IK_IS_FIXNUM(first_word)) {
+    for (i=0; i<first_word; i+=wordsize)
+      field(I, idx, disp_vector_data + i, copy);
+  }
+  else if (symbol_tag == first_word) {
+    field(I, idx, disp_symbol_record_string,  copy);
+    field(I, idx, disp_symbol_record_ustring, copy);
+    field(I, idx, disp_symbol_record_value,   copy);
+    field(I, idx, disp_symbol_record_proc,    copy);
+    field(I, idx, disp_symbol_record_plist,   copy);
+  }
+  else if (rtd_tag == IK_TAGOF(first_word)) {
+    long	nbytes = IK_REF(first_word, off_rtd_length);
+    for (i=0; i<=nbytes; i+=wordsize)
+      field(I, idx, i, copy);
+  }
+  else if (code_tag == first_word) {
+    field(I, idx, disp_code_reloc_vector, copy);
+    field(I, idx, disp_code_annotation,   copy);
+    if (copy)
+      table_add(&(I->codes), I->base[O.section] + O.offset);
+  }
+  else if (pair_tag == IK_TAGOF(first_word)) {
+    for (i=0; i<tcbucket_size; i+=wordsize)
+      field(I, idx, i, copy);
+    /* The  hashtable hashes keys by address: buckets  with a heap key
+       are requeued when loading. */
+    if (copy && is_heap_object(I, IK_REF(x, disp_tcbucket_key)))
+      table_add(&(I->buckets), I->base[O.section] + O.offset + vector_tag);
+  }
+  else if (port_tag == (((long)first_word) & port_mask)) {
+    field(I, idx, disp_port_buffer,	  copy);
+    field(I, idx, disp_port_id,		  copy);
+    field(I, idx, disp_port_read,	  copy);
+    field(I, idx, disp_port_write,	  copy);
+    field(I, idx, disp_port_get_position, copy);
+    field(I, idx, disp_port_set_position, copy);
+    field(I, idx, disp_port_close,	  copy);
+    field(I, idx, disp_port_cookie,	  copy);
+  }
+  else if ((ratnum_tag == first_word) || (compnum_tag == first_word) || (cflonum_tag == first_word)) {
+    /* Ratnums, compnums and cflonums share the same layout. */
+    field(I, idx, disp_ratnum_num, copy);
+    field(I, idx, disp_ratnum_den, copy);
+  }
+  else if (pointer_tag == first_word) {
+    /* Foreign addresses are meaningless in another process. */
+    if (copy)
+      *((ikptr *)(I->data[O.section] + O.offset + disp_pointer_data)) = 0;
+  }
+}
+static void
+mark_weak_code (image_t * I)
+/* The dirty bits of a code page  depend on the objects referenced by the
+   relocation vectors: mark as dirty the code pages whose code objects
+   reference weak pairs. */
+{
+  long	i, j;
+  for (i=0; i<I->objects_len; ++i) {
+    object_t *	O = &(I->objects[i]);
+    ikptr	rvec, len;
+    if ((SECTION_CODE != O->section) || (code_tag != IK_REF(O->X, -vector_tag)))
+      continue;
+    rvec = IK_REF(O->X, off_code_reloc_vector);
+    len  = IK_VECTOR_LENGTH_FX(rvec);
+    for (j=0; j<len; j+=wordsize) {
+      ikptr	r = IK_REF(rvec, off_vector_data + j);
+      if (is_heap_object(I, r) && IS_WEAK_SECTION(I->objects[lookup(I, r)].section)) {
+	table_add(&(I->dirty), (I->base[SECTION_CODE] + O->offset) >> IK_PAGESHIFT);
+	break;
+      }
+    }
+  }
+}
+
+
+/** --------------------------------------------------------------------
+ ** Writing images.
+ ** ----------------------------------------------------------------- */
+
+static void
+write_table (FILE * stream, table_t * T)
+{
+  fwrite(T->items, sizeof(uint64_t), T->len, stream);
+}
+static int
+write_image (image_t * I, FILE * stream)
+/* Write the image to STREAM; return true on success. */
+{
+  image_header_t	H;
+  char *		page = calloc(1, IK_PAGESIZE);
+  int			s;
+  if (NULL == page)
+    ik_abort("%s: memory allocation failed", __func__);
+  bzero(&H, sizeof(image_header_t));
+  memcpy(H.magic, (I->fasl)? IK_MAPPED_FASL_MAGIC : IK_HEAP_IMAGE_MAGIC, sizeof(H.magic));
+  H.word_size	      = wordsize;
+  for (s=0; s<SECTIONS_COUNT; ++s)
+    H.section_size[s] = I->cursor[s];
+  H.roots	      = vector_tag;
+  H.relocations_count = I->relocations.len;
+  H.codes_count	      = I->codes.len;
+  H.buckets_count     = I->buckets.len;
+  H.dirty_count	      = I->dirty.len;
+  H.symbols_count     = I->symbols.len / 2;
+  H.fixups_count      = I->fixups.len  / 2;
+  memcpy(page, &H, sizeof(image_header_t));
+  fwrite(page, 1, IK_PAGESIZE, stream);
+  free(page);
+  for (s=0; s<SECTIONS_COUNT; ++s)
+    fwrite(I->data[s], 1, I->cursor[s], stream);
+  write_table(stream, &(I->relocations));
+  write_table(stream, &(I->codes));
+  write_table(stream, &(I->buckets));
+  write_table(stream, &(I->dirty));
+  write_table(stream, &(I->symbols));
+  write_table(stream, &(I->fixups));
+  return ! ferror(stream);
+}
+static void
+image_free (image_t * I)
+{
+  int	s;
+  for (s=0; s<SECTIONS_COUNT; ++s)
+    free(I->data[s]);
+  free(I->objects);
+  free(I->map);
+  free(I->stack);
+  free(I->relocations.items);
+  free(I->codes.items);
+  free(I->buckets.items);
+  free(I->dirty.items);
+  free(I->symbols.items);
+  free(I->fixups.items);
+}
+static ikptr
+save_image (ikpcb * pcb, char * filename, ikptr * roots, long roots_count, int fasl)
+/* Write to FILENAME the image of the objects reachable from ROOTS, which
+   become the items of the roots vector.  Return an exact integer
+   representing the number of objects written, or false if the image
+   cannot be written. */
+{
+  image_t	I;
+  FILE *	stream;
+  long		i;
+  int		s, failed;
+  bzero(&I, sizeof(image_t));
+  I.pcb		= pcb;
+  I.fasl	= fasl;
+  I.first_page	= IK_PAGE_INDEX(pcb->memory_base);
+  I.pages_count	= IK_PAGE_INDEX(pcb->memory_end) - I.first_page;
+  /* The roots vector comes first, so its offset is zero. */
+  place(&I, SECTION_POINTERS, IK_ALIGN(disp_vector_data + roots_count * wordsize));
+  for (i=0; i<roots_count; ++i)
+    add_object(&I, roots[i]);
+  while (I.stack_len && (! I.failed))
+    process_object(&I, I.stack[--I.stack_len], 0);
+  if (I.failed) {
+    image_free(&I);
+    return IK_FALSE;
+  }
+  for (s=0; s<SECTIONS_COUNT; ++s) {
+    I.cursor[s] = IK_ALIGN_TO_NEXT_PAGE(I.cursor[s]);
+    I.base[s]	= (s)? (I.base[s-1] + I.cursor[s-1]) : 0;
+    I.data[s]	= calloc(1, I.cursor[s]? I.cursor[s] : 1);
+    if (NULL == I.data[s])
+      ik_abort("%s: memory allocation failed", __func__);
+  }
+  IK_REF(I.data[SECTION_POINTERS], 0) = IK_FIX(roots_count);
+  for (i=0; i<roots_count; ++i)
+    store(&I, SECTION_POINTERS, disp_vector_data + i * wordsize, roots[i]);
+  for (i=0; i<I.objects_len; ++i) {
+    object_t *	O = &(I.objects[i]);
+    if (SECTION_FIXUP == O->section) {
+      /* Symbols are appended in the order of their indexes. */
+      ikptr	s_ustring = IK_REF(O->X, off_symbol_record_ustring);
+      table_add(&(I.symbols), translate(&I, IK_REF(O->X, off_symbol_record_string)));
+      table_add(&(I.symbols), (IK_FALSE_OBJECT == s_ustring)? 0 : translate(&I, s_ustring));
+    } else
+      process_object(&I, i, 1);
+  }
+  mark_weak_code(&I);
+  stream = fopen(filename, "wb");
+  if (NULL == stream) {
+    image_free(&I);
+    return IK_FALSE;
+  }
+  failed = ! write_image(&I, stream);
+  failed = fclose(stream) || failed;
+  image_free(&I);
+  return (failed)? IK_FALSE : ika_integer_from_long(pcb, I.objects_len);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Loading images.
+ ** ----------------------------------------------------------------- */
+
+static int
+open_image (char * filename, const char * magic, image_header_t * H)
+/* Open FILENAME and read its header; return the file descriptor, or -1
+   if FILENAME is not an image with MAGIC. */
+{
+  int	fd = open(filename, O_RDONLY);
+  if (-1 == fd)
+    return -1;
+  if ((sizeof(image_header_t) != pread(fd, H, sizeof(image_header_t), 0)) ||
+      memcmp(H->magic, magic, sizeof(H->magic))) {
+    close(fd);
+    return -1;
+  }
+  if (wordsize != H->word_size)
+    ik_abort("image \"%s\" was written with a different word size", filename);
+  return fd;
+}
+static uint64_t *
+read_table (int fd, off_t * offset, uint64_t count, char * filename)
+{
+  size_t	size  = count * sizeof(uint64_t);
+  uint64_t *	items = malloc(size? size : 1);
+  if (NULL == items)
+    ik_abort("%s: memory allocation failed", __func__);
+  if (size != (size_t)pread(fd, items, size, *offset))
+    ik_abort("failed reading image \"%s\": %s", filename, strerror(errno));
+  *offset += size;
+  return items;
+}
+static void
+apply_fixups (ikpcb * pcb, ikptr mem, image_header_t * H, uint64_t * symbols, uint64_t * fixups)
+/* Intern the symbols  and store them, the base RTD  and the struct type
+   descriptors in the words listed in the fixups table. */
+{
+  unsigned *	dirty_vec = (unsigned *)(long)pcb->dirty_vector;
+  ikptr *	syms	  = malloc((H->symbols_count + 1) * sizeof(ikptr));
+  uint64_t	i;
+  if (NULL == syms)
+    ik_abort("%s: memory allocation failed", __func__);
+  /* Nothing here can trigger a collection, so SYMS needs no rooting. */
+  for (i=0; i<H->symbols_count; ++i) {
+    ikptr	s_string  = mem + symbols[2*i];
+    if (symbols[2*i+1])
+      syms[i] = ikrt_strings_to_gensym(s_string, mem + symbols[2*i+1], pcb);
+    else
+      syms[i] = ikrt_string_to_symbol(s_string, pcb);
+  }
+  /* Struct type descriptors are resolved after the symbols, because the
+     UID symbol of a mapped descriptor is itself a fixup. */
+  for (i=0; i<H->fixups_count; ++i) {
+    ikptr	p    = mem + fixups[2*i];
+    uint64_t	code = fixups[2*i+1];
+    if (FIXUP_SYMBOL == (code & FIXUP_KIND_MASK))
+      IK_REF(p, 0) = syms[code >> FIXUP_SHIFT];
+    else if (FIXUP_BASE_RTD == (code & FIXUP_KIND_MASK))
+      IK_REF(p, 0) = pcb->base_rtd;
+    dirty_vec[IK_PAGE_INDEX(p)] = (unsigned)-1;
+  }
+  for (i=0; i<H->fixups_count; ++i) {
+    ikptr	p = mem + fixups[2*i];
+    if (FIXUP_RTD == (fixups[2*i+1] & FIXUP_KIND_MASK)) {
+      ikptr	s_uid = IK_REF(IK_REF(p, 0), off_rtd_symbol);
+      if (IK_UNBOUND_OBJECT == IK_REF(s_uid, off_symbol_record_value)) {
+	IK_REF(s_uid, off_symbol_record_value) = IK_REF(p, 0);
+	dirty_vec[IK_PAGE_INDEX(s_uid + off_symbol_record_value)] = (unsigned)-1;
+      }
+      IK_REF(p, 0) = IK_REF(s_uid, off_symbol_record_value);
+    }
+  }
+  free(syms);
+}
+static ikptr
+load_image (ikpcb * pcb, int fd, image_header_t * H, char * filename, int fasl)
+/* Map the sections of the image  open on FD, relocate them and adopt them
+   as pages of the heap; close FD and return the roots vector. */
+{
+  unsigned *	segment_vec;
+  unsigned *	dirty_vec;
+  uint64_t *	relocations;
+  uint64_t *	codes;
+  uint64_t *	buckets;
+  uint64_t *	dirty;
+  uint64_t *	symbols;
+  uint64_t *	fixups;
+  ikptr		mem;
+  ik_ulong	total = 0, i;
+  off_t		offset;
+  int		s;
+  for (s=0; s<SECTIONS_COUNT; ++s)
+    total += H->section_size[s];
+  mem	      = ik_mmap_file(fd, IK_PAGESIZE, total, pcb);
+  offset      = IK_PAGESIZE + total;
+  relocations = read_table(fd, &offset, H->relocations_count, filename);
+  codes	      = read_table(fd, &offset, H->codes_count,	      filename);
+  buckets     = read_table(fd, &offset, H->buckets_count,     filename);
+  dirty	      = read_table(fd, &offset, H->dirty_count,	      filename);
+  symbols     = read_table(fd, &offset, 2 * H->symbols_count, filename);
+  fixups      = read_table(fd, &offset, 2 * H->fixups_count,  filename);
+  close(fd);
+  /* The single relocation pass. */
+  for (i=0; i<H->relocations_count; ++i)
+    IK_REF(mem, relocations[i]) += mem;
+  /* Adopt the pages. */
+  segment_vec = pcb->segment_vector;
+  dirty_vec   = (unsigned *)(long)pcb->dirty_vector;
+  {
+    ikptr	p = mem;
+    for (s=0; s<SECTIONS_COUNT; ++s) {
+      ikptr	q = p + H->section_size[s];
+      for (; p < q; p += IK_PAGESIZE) {
+	segment_vec[IK_PAGE_INDEX(p)] = section_type[s];
+	/* The code of  a mapped FASL file references  symbols of the
+	   nursery. */
+	dirty_vec[IK_PAGE_INDEX(p)]   = (fasl && (SECTION_CODE == s))? (unsigned)-1 : 0;
+      }
+      pcb->heap_pages_count += IK_PAGE_INDEX(H->section_size[s]);
+      if (! IS_WEAK_SECTION(s))
+	pcb->static_bytes += H->section_size[s];
+    }
+  }
+  for (i=0; i<H->dirty_count; ++i)
+    dirty_vec[IK_PAGE_INDEX(mem) + dirty[i]] = (unsigned)-1;
+  apply_fixups(pcb, mem, H, symbols, fixups);
+  for (i=0; i<H->codes_count; ++i) {
+    ikptr	p_code = mem + codes[i];
+    long	size   = IK_ALIGN(IK_UNFIX(IK_REF(p_code, disp_code_code_size)) + disp_code_data);
+    ikptr	p;
+    ik_relocate_code(p_code);
+    for (p = p_code + IK_PAGESIZE; p < p_code + size; p += IK_PAGESIZE)
+      segment_vec[IK_PAGE_INDEX(p)] = data_mt | IK_STATIC_GENERATION;
+  }
+  for (i=0; i<H->buckets_count; ++i)
+    ik_tcbucket_requeue(pcb, mem + buckets[i]);
+  free(relocations);
+  free(codes);
+  free(buckets);
+  free(dirty);
+  free(symbols);
+  free(fixups);
+  return mem + H->roots;
+}
+int
+ik_heap_image_run (ikpcb * pcb, char * filename)
+/* If FILENAME is a heap image: load it, run its thunk and return true.
+   Else return false and leave the PCB untouched. */
+{
+  image_header_t	H;
+  ikptr			roots, s_thunk;
+  int			fd = open_image(filename, IK_HEAP_IMAGE_MAGIC, &H);
+  if (-1 == fd)
+    return 0;
+  roots		    = load_image(pcb, fd, &H, filename, 0);
+  pcb->symbol_table = IK_ITEM(roots, ROOT_SYMBOL_TABLE);
+  pcb->gensym_table = IK_ITEM(roots, ROOT_GENSYM_TABLE);
+  pcb->base_rtd	    = IK_ITEM(roots, ROOT_BASE_RTD);
+  s_thunk	    = IK_ITEM(roots, ROOT_THUNK);
+  ik_exec_code(pcb, IK_REF(s_thunk, off_closure_code) - off_code_data, IK_FIX(0), s_thunk);
+  return 1;
+}
+int
+ik_fasl_load_mapped (ikpcb * pcb, char * filename)
+/* If FILENAME is a mapped FASL file:  load it, execute its code objects
+   in order and return true.  Else return false and leave the PCB
+   untouched. */
+{
+  image_header_t	H;
+  ikptr			roots;
+  long			i, len;
+  int			fd = open_image(filename, IK_MAPPED_FASL_MAGIC, &H);
+  if (-1 == fd)
+    return 0;
+  roots = load_image(pcb, fd, &H, filename, 1);
+  len	= IK_VECTOR_LENGTH(roots);
+  for (i=0; i<len; ++i) {
+    /* The roots vector is in the static generation: its items are not
+       moved by the collections triggered by the code. */
+    ikptr	val = ik_exec_code(pcb, IK_ITEM(roots, i), 0, 0);
+    if (val != IK_VOID_OBJECT) {
+      ik_debug_message_no_newline("%s: code object from %s returned non-void value: ",
+				  __func__, filename);
+      ik_print(val);
+    }
+  }
+  return 1;
+}
+
+
+/** --------------------------------------------------------------------
+ ** Scheme interface.
+ ** ----------------------------------------------------------------- */
+
+ikptr
+ikrt_save_heap_image (ikptr s_filename, ikptr s_thunk, ikpcb * pcb)
+/* Write to the file whose pathname is the bytevector S_FILENAME an image
+   of the objects reachable from the closure S_THUNK and from the symbol
+   tables; when the image is loaded  the thunk is called.  Return an exact
+   integer representing the number of objects written, or false if the
+   image cannot be written. */
+{
+  ikptr		roots[ROOTS_COUNT];
+  roots[ROOT_THUNK]	   = s_thunk;
+  roots[ROOT_SYMBOL_TABLE] = pcb->symbol_table;
+  roots[ROOT_GENSYM_TABLE] = pcb->gensym_table;
+  roots[ROOT_BASE_RTD]	   = pcb->base_rtd;
+  return save_image(pcb, IK_BYTEVECTOR_DATA_CHARP(s_filename), roots, ROOTS_COUNT, 0);
+}
+ikptr
+ikrt_fasl_write_mapped (ikptr s_codes, ikptr s_filename, ikpcb * pcb)
+/* Write to the file whose pathname is the bytevector S_FILENAME a mapped
+   FASL file  holding the code  objects in the vector S_CODES.  Return an
+   exact integer representing the number of objects written, or false if
+   the file cannot be written. */
+{
+  return save_image(pcb, IK_BYTEVECTOR_DATA_CHARP(s_filename),
+		    (ikptr *)(long)(s_codes + off_vector_data), IK_VECTOR_LENGTH(s_codes), 1);
+}
+
+/* end of file */
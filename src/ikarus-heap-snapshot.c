@@ -0,0 +1,500 @@
+/*
+ * Vicare Scheme -- heap snapshots
+ *
+ * This program is free software:  you can redistribute it and/or modify
+ * it under  the terms of  the GNU General  Public License version  3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is  distributed in the hope that it  will be useful, but
+ * WITHOUT  ANY   WARRANTY;  without   even  the  implied   warranty  of
+ * MERCHANTABILITY  or FITNESS FOR  A PARTICULAR  PURPOSE.  See  the GNU
+ * General Public License for more details.
+ *
+ * You should  have received  a copy of  the GNU General  Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** --------------------------------------------------------------------
+ ** Headers.
+ ** ----------------------------------------------------------------- */
+
+#include "internals.h"
+#include "vicare-heap-snapshot.h"
+#include <stdint.h>
+
+/* A snapshot is  written by visiting the objects reachable  from the same
+   roots  used by  "ik_collect()",  with  the same  type  dispatch  of
+   "add_object_proc()";  the objects are not moved and  the heap is not
+   mutated.  The visited objects are recorded in bitmaps with one bit for
+   every  granule of  memory,  allocated only for  the pages  actually
+   holding visited objects. */
+
+#define GRANULE_SIZE		(2 * wordsize)
+#define BITMAP_SIZE		(IK_PAGESIZE / GRANULE_SIZE / 8)
+
+/* Bit planes of the page bitmaps. */
+#define VISITED_PLANE		0
+#define NAMED_PLANE		1
+
+/* Maximum number of bytes in a name record. */
+#define NAME_SIZE		256
+
+typedef struct snapshot_t {
+  ikpcb *		pcb;
+  FILE *		stream;
+  /* For every page  in the memory  range of the PCB: NULL  or a pointer
+     to two bitmaps of BITMAP_SIZE bytes, one for each bit plane. */
+  unsigned char **	pages;
+  long			first_page;
+  long			pages_count;
+  /* Stack of visited objects not yet written. */
+  ikptr *		stack;
+  long			stack_len;
+  long			stack_size;
+  /* References of the object being written. */
+  uint64_t *		refs;
+  long			refs_len;
+  long			refs_size;
+  /* Number of objects written. */
+  long			objects;
+} snapshot_t;
+
+
+/** --------------------------------------------------------------------
+ ** Helpers.
+ ** ----------------------------------------------------------------- */
+
+static int
+is_heap_object (snapshot_t * S, ikptr X)
+/* Return true if X is a reference to an object in the Scheme heap. */
+{
+  long	idx;
+  if (IK_IS_FIXNUM(X) || (immediate_tag == IK_TAGOF(X)))
+    return 0;
+  idx = IK_PAGE_INDEX(X);
+  if ((idx < S->first_page) || (idx >= S->first_page + S->pages_count))
+    return 0;
+  return (hole_type != (S->pcb->segment_vector[idx] & type_mask));
+}
+static int
+test_and_set (snapshot_t * S, ikptr X, int plane)
+/* Set the bit of X in the bit plane PLANE; return its old value. */
+{
+  long			page  = IK_PAGE_INDEX(X) - S->first_page;
+  long			bit   = (((ik_ulong)X) & (IK_PAGESIZE - 1)) / GRANULE_SIZE;
+  unsigned char *	bits  = S->pages[page];
+  unsigned char		mask  = (unsigned char)(1 << (bit & 7));
+  if (NULL == bits) {
+    bits = S->pages[page] = calloc(2, BITMAP_SIZE);
+    if (NULL == bits)
+      ik_abort("%s: memory allocation failed", __func__);
+  }
+  bits += plane * BITMAP_SIZE + (bit >> 3);
+  if (*bits & mask)
+    return 1;
+  *bits |= mask;
+  return 0;
+}
+static void
+push_object (snapshot_t * S, ikptr X)
+{
+  if (S->stack_len == S->stack_size) {
+    S->stack_size = (S->stack_size)? (2 * S->stack_size) : 4096;
+    S->stack      = realloc(S->stack, S->stack_size * sizeof(ikptr));
+    if (NULL == S->stack)
+      ik_abort("%s: memory allocation failed", __func__);
+  }
+  S->stack[S->stack_len++] = X;
+}
+static void
+add_ref (snapshot_t * S, ikptr X)
+/* Append X to the references of  the object being written and, if not
+   yet visited, schedule it to be written. */
+{
+  if (! is_heap_object(S, X))
+    return;
+  if (S->refs_len == S->refs_size) {
+    S->refs_size = (S->refs_size)? (2 * S->refs_size) : 1024;
+    S->refs      = realloc(S->refs, S->refs_size * sizeof(uint64_t));
+    if (NULL == S->refs)
+      ik_abort("%s: memory allocation failed", __func__);
+  }
+  S->refs[S->refs_len++] = (uint64_t)X;
+  if (! test_and_set(S, X, VISITED_PLANE))
+    push_object(S, X);
+}
+static void
+put_u8 (snapshot_t * S, unsigned char v)
+{
+  putc(v, S->stream);
+}
+static void
+put_u32 (snapshot_t * S, uint32_t v)
+{
+  fwrite(&v, sizeof(uint32_t), 1, S->stream);
+}
+static void
+put_u64 (snapshot_t * S, uint64_t v)
+{
+  fwrite(&v, sizeof(uint64_t), 1, S->stream);
+}
+static void
+write_object (snapshot_t * S, ikptr X, int type, long size, ikptr class)
+/* Write the object record of X, with the references accumulated so far. */
+{
+  put_u8(S, IK_SNAPSHOT_OBJECT);
+  put_u64(S, (uint64_t)X);
+  put_u8(S, (unsigned char)type);
+  put_u64(S, (uint64_t)size);
+  put_u64(S, (uint64_t)class);
+  put_u32(S, (uint32_t)S->refs_len);
+  fwrite(S->refs, sizeof(uint64_t), S->refs_len, S->stream);
+  S->refs_len = 0;
+  ++(S->objects);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Names.
+ ** ----------------------------------------------------------------- */
+
+static long
+string_name (ikptr s_str, char * buf, long size)
+/* Store in BUF the UTF-8 encoding of the Scheme string S_STR, truncated
+   to SIZE bytes; return the number of bytes. */
+{
+  long	len = IK_STRING_LENGTH(s_str);
+  long	i, n = 0;
+  for (i=0; i<len; ++i) {
+    ik_ulong	ch = IK_CHAR_TO_INTEGER(IK_CHAR32(s_str, i));
+    if (ch < 0x80) {
+      if (n + 1 > size) break;
+      buf[n++] = (char)ch;
+    } else if (ch < 0x800) {
+      if (n + 2 > size) break;
+      buf[n++] = (char)(0xC0 | (ch >> 6));
+      buf[n++] = (char)(0x80 | (ch & 0x3F));
+    } else if (ch < 0x10000) {
+      if (n + 3 > size) break;
+      buf[n++] = (char)(0xE0 | (ch >> 12));
+      buf[n++] = (char)(0x80 | ((ch >> 6) & 0x3F));
+      buf[n++] = (char)(0x80 | (ch & 0x3F));
+    } else {
+      if (n + 4 > size) break;
+      buf[n++] = (char)(0xF0 | (ch >> 18));
+      buf[n++] = (char)(0x80 | ((ch >> 12) & 0x3F));
+      buf[n++] = (char)(0x80 | ((ch >> 6) & 0x3F));
+      buf[n++] = (char)(0x80 | (ch & 0x3F));
+    }
+  }
+  return n;
+}
+static long
+object_name (snapshot_t * S, ikptr X, char * buf, long size, int depth)
+/* Store in BUF a name for X: the characters of strings and symbols; for
+   a pair, the name of its car or cdr.  Return the number of bytes. */
+{
+  long	n;
+  if ((! is_heap_object(S, X)) || (depth > 2))
+    return 0;
+  if (string_tag == IK_TAGOF(X))
+    return string_name(X, buf, size);
+  if ((vector_tag == IK_TAGOF(X)) && (symbol_tag == IK_REF(X, -vector_tag))) {
+    ikptr	s_str = IK_REF(X, off_symbol_record_string);
+    if (is_heap_object(S, s_str) && (string_tag == IK_TAGOF(s_str)))
+      return string_name(s_str, buf, size);
+    s_str = IK_REF(X, off_symbol_record_ustring);
+    if (is_heap_object(S, s_str) && (string_tag == IK_TAGOF(s_str)))
+      return string_name(s_str, buf, size);
+    return 0;
+  }
+  if (pair_tag == IK_TAGOF(X)) {
+    n = object_name(S, IK_CAR(X), buf, size, 1+depth);
+    return (n)? n : object_name(S, IK_CDR(X), buf, size, 1+depth);
+  }
+  return 0;
+}
+static void
+write_name (snapshot_t * S, ikptr X, ikptr s_name)
+/* If the name object S_NAME has a printable name: write a name record for
+   X, unless one was already written. */
+{
+  char	buf[NAME_SIZE];
+  long	len;
+  if (! is_heap_object(S, X))
+    return;
+  len = object_name(S, s_name, buf, NAME_SIZE, 0);
+  if ((0 == len) || test_and_set(S, X, NAMED_PLANE))
+    return;
+  put_u8(S, IK_SNAPSHOT_NAME);
+  put_u64(S, (uint64_t)X);
+  put_u32(S, (uint32_t)len);
+  fwrite(buf, 1, len, S->stream);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Objects.
+ ** ----------------------------------------------------------------- */
+
+static void
+scan_stack (snapshot_t * S, ikptr top, ikptr end)
+/* Add  to the references of the  object being written the code objects
+   and the live values of the stack frames from TOP to END.  See the
+   function "collect_stack()" for the layout of stack frames. */
+{
+  while (top < end) {
+    ikptr	rp		= IK_REF(top, 0);
+    long	offset_field	= IK_UNFIX(IK_CALLTABLE_OFFSET(rp));
+    long	code_offset	= offset_field - disp_call_table_offset;
+    long	framesize	= IK_CALLTABLE_FRAMESIZE(rp);
+    if (offset_field <= 0)
+      ik_abort("%s: invalid offset_field %ld", __func__, offset_field);
+    add_ref(S, (rp - code_offset - disp_code_data) | code_primary_tag);
+    if (framesize < 0) {
+      ik_abort("%s: invalid frame size %ld", __func__, framesize);
+    } else if (0 == framesize) {
+      ikptr	base;
+      framesize = IK_REF(top, wordsize);
+      if (framesize <= 0)
+	ik_abort("%s: invalid redirected frame size %ld", __func__, framesize);
+      for (base=top+framesize-wordsize; base > top; base-=wordsize)
+	add_ref(S, IK_REF(base, 0));
+    } else {
+      long	frame_cells	= framesize >> fx_shift;
+      long	bytes_in_mask	= (frame_cells+7) >> 3;
+      char *	mask		= (char*)(long)(rp + disp_call_table_size - bytes_in_mask);
+      ikptr *	fp		= (ikptr*)(long)(top + framesize);
+      long	i;
+      int	j;
+      for (i=0; i<bytes_in_mask; i++, fp-=8) {
+	unsigned char	m = mask[i];
+	for (j=0; j<8; ++j)
+	  if (m & (1 << j))
+	    add_ref(S, fp[-j]);
+      }
+    }
+    top += framesize;
+  }
+}
+static void
+scan_object (snapshot_t * S, ikptr X)
+/* Write the object record of X and schedule its references. */
+{
+  int		tag	   = IK_TAGOF(X);
+  ikptr		first_word = IK_REF(X, -tag);
+  unsigned	bits	   = S->pcb->segment_vector[IK_PAGE_INDEX(X)];
+  long		i;
+  if (pair_tag == tag) {
+    if ((weak_pairs_type == (bits & type_mask)) && (bits & ephemerons_page_mask)) {
+      /* Both  references  of  an  ephemeron are  weak edges;  the
+	 analyzer decides if the key keeps the value alive. */
+      add_ref(S, IK_CAR(X));
+      add_ref(S, IK_CDR(X));
+      write_object(S, X, IK_SNAPSHOT_TYPE_EPHEMERON, pair_size, 0);
+    } else if (weak_pairs_type == (bits & type_mask)) {
+      /* The car of a weak pair does not retain its value. */
+      add_ref(S, IK_CDR(X));
+      write_object(S, X, IK_SNAPSHOT_TYPE_WEAK_PAIR, pair_size, 0);
+    } else {
+      add_ref(S, IK_CAR(X));
+      add_ref(S, IK_CDR(X));
+      write_object(S, X, IK_SNAPSHOT_TYPE_PAIR, pair_size, 0);
+    }
+  }
+  else if (closure_tag == tag) {
+    ikptr	code = (first_word - disp_code_data) | code_primary_tag;
+    long	size = disp_closure_data + IK_REF(first_word, disp_code_freevars - disp_code_data);
+    add_ref(S, code);
+    for (i=disp_closure_data; i<size; i+=wordsize)
+      add_ref(S, IK_REF(X, i - closure_tag));
+    write_object(S, X, IK_SNAPSHOT_TYPE_CLOSURE, IK_ALIGN(size), code);
+  }
+  else if (string_tag == tag) {
+    long	len = IK_UNFIX(first_word);
+    write_object(S, X, IK_SNAPSHOT_TYPE_STRING, IK_ALIGN(len * IK_STRING_CHAR_SIZE + disp_string_data), 0);
+  }
+  else if (bytevector_tag == tag) {
+    long	len = IK_UNFIX(first_word);
+    write_object(S, X, IK_SNAPSHOT_TYPE_BYTEVECTOR, IK_ALIGN(len + disp_bytevector_data + 1), 0);
+  }
+  else if (vector_tag != tag) {
+    ik_abort("%s: unhandled tag %d", __func__, tag);
+  }
+  else if (IK_IS_FIXNUM(first_word)) {
+    for (i=0; i<first_word; i+=wordsize)
+      add_ref(S, IK_REF(X, off_vector_data + i));
+    write_object(S, X, IK_SNAPSHOT_TYPE_VECTOR, IK_ALIGN(first_word + disp_vector_data), 0);
+  }
+  else if (symbol_tag == first_word) {
+    add_ref(S, IK_REF(X, off_symbol_record_string));
+    add_ref(S, IK_REF(X, off_symbol_record_ustring));
+    add_ref(S, IK_REF(X, off_symbol_record_value));
+    add_ref(S, IK_REF(X, off_symbol_record_proc));
+    add_ref(S, IK_REF(X, off_symbol_record_plist));
+    write_object(S, X, IK_SNAPSHOT_TYPE_SYMBOL, symbol_record_size, 0);
+    write_name(S, X, X);
+  }
+  else if (rtd_tag == IK_TAGOF(first_word)) {
+    /* A struct or record instance; as integer, the number of fields of the
+       type descriptor is the number of bytes of the fields. */
+    long	nbytes = IK_REF(first_word, off_rtd_length);
+    add_ref(S, first_word);
+    for (i=0; i<nbytes; i+=wordsize)
+      add_ref(S, IK_REF(X, off_record_data + i));
+    write_object(S, X, IK_SNAPSHOT_TYPE_RECORD, IK_ALIGN(nbytes + wordsize), first_word);
+    write_name(S, first_word, IK_REF(first_word, off_rtd_name));
+  }
+  else if (code_tag == first_word) {
+    long	code_size = IK_UNFIX(IK_REF(X, disp_code_code_size - code_primary_tag));
+    add_ref(S, IK_REF(X, off_code_reloc_vector));
+    add_ref(S, IK_REF(X, off_code_annotation));
+    write_object(S, X, IK_SNAPSHOT_TYPE_CODE, IK_ALIGN(code_size + disp_code_data), 0);
+    write_name(S, X, IK_REF(X, off_code_annotation));
+  }
+  else if (continuation_tag == first_word) {
+    ikptr	top  = IK_REF(X, off_continuation_top);
+    long	size = IK_REF(X, off_continuation_size);
+    add_ref(S, IK_REF(X, off_continuation_next));
+    scan_stack(S, top, top + size);
+    write_object(S, X, IK_SNAPSHOT_TYPE_CONTINUATION, continuation_size + IK_ALIGN(size), 0);
+  }
+  else if (system_continuation_tag == first_word) {
+    add_ref(S, IK_REF(X, off_system_continuation_next));
+    write_object(S, X, IK_SNAPSHOT_TYPE_CONTINUATION, system_continuation_size, 0);
+  }
+  else if (pair_tag == IK_TAGOF(first_word)) {
+    add_ref(S, first_word);
+    add_ref(S, IK_REF(X, off_tcbucket_key));
+    add_ref(S, IK_REF(X, off_tcbucket_val));
+    add_ref(S, IK_REF(X, off_tcbucket_next));
+    write_object(S, X, IK_SNAPSHOT_TYPE_TCBUCKET, tcbucket_size, 0);
+  }
+  else if (port_tag == (((long)first_word) & port_mask)) {
+    add_ref(S, IK_REF(X, off_port_buffer));
+    add_ref(S, IK_REF(X, off_port_id));
+    add_ref(S, IK_REF(X, off_port_read));
+    add_ref(S, IK_REF(X, off_port_write));
+    add_ref(S, IK_REF(X, off_port_get_position));
+    add_ref(S, IK_REF(X, off_port_set_position));
+    add_ref(S, IK_REF(X, off_port_close));
+    add_ref(S, IK_REF(X, off_port_cookie));
+    write_object(S, X, IK_SNAPSHOT_TYPE_PORT, port_size, 0);
+  }
+  else if (flonum_tag == first_word) {
+    write_object(S, X, IK_SNAPSHOT_TYPE_NUMBER, flonum_size, 0);
+  }
+  else if (bignum_tag == (first_word & bignum_mask)) {
+    long	len = ((unsigned long)first_word) >> bignum_nlimbs_shift;
+    write_object(S, X, IK_SNAPSHOT_TYPE_NUMBER, IK_ALIGN(disp_bignum_data + len*wordsize), 0);
+  }
+  else if (ratnum_tag == first_word) {
+    add_ref(S, IK_REF(X, off_ratnum_num));
+    add_ref(S, IK_REF(X, off_ratnum_den));
+    write_object(S, X, IK_SNAPSHOT_TYPE_NUMBER, ratnum_size, 0);
+  }
+  else if (compnum_tag == first_word) {
+    add_ref(S, IK_REF(X, off_compnum_real));
+    add_ref(S, IK_REF(X, off_compnum_imag));
+    write_object(S, X, IK_SNAPSHOT_TYPE_NUMBER, compnum_size, 0);
+  }
+  else if (cflonum_tag == first_word) {
+    add_ref(S, IK_REF(X, off_cflonum_real));
+    add_ref(S, IK_REF(X, off_cflonum_imag));
+    write_object(S, X, IK_SNAPSHOT_TYPE_NUMBER, cflonum_size, 0);
+  }
+  else if (pointer_tag == first_word) {
+    write_object(S, X, IK_SNAPSHOT_TYPE_POINTER, pointer_size, 0);
+  }
+  else
+    ik_abort("%s: unhandled vector with first_word=0x%016lx", __func__, (long)first_word);
+}
+static void
+scan_roots (snapshot_t * S)
+/* Write the pseudo object referencing the roots used by "ik_collect()". */
+{
+  ikpcb *	pcb = S->pcb;
+  int		gen, i;
+  scan_stack(S, pcb->frame_pointer, pcb->frame_base - wordsize);
+  {
+    ik_callback_locative *	loc;
+    for (loc = pcb->callbacks; loc; loc = loc->next)
+      add_ref(S, loc->data);
+  }
+  {
+    ik_gc_avoidance_registry_t *	R = &(pcb->not_to_be_collected);
+    long	j;
+    for (j=0; j<R->live_count; ++j)
+      add_ref(S, R->live[j]->obj);
+  }
+  for (gen=0; gen<generation_count; ++gen) {
+    ik_ptr_page *	page;
+    for (page = pcb->protected_list[gen]; page; page = page->next)
+      for (i=0; i<page->count; ++i)
+	add_ref(S, page->ptr[i]);
+  }
+  add_ref(S, pcb->next_k);
+  add_ref(S, pcb->symbol_table);
+  add_ref(S, pcb->gensym_table);
+  add_ref(S, pcb->arg_list);
+  add_ref(S, pcb->base_rtd);
+  if (pcb->root0) add_ref(S, *(pcb->root0));
+  if (pcb->root1) add_ref(S, *(pcb->root1));
+  if (pcb->root2) add_ref(S, *(pcb->root2));
+  if (pcb->root3) add_ref(S, *(pcb->root3));
+  if (pcb->root4) add_ref(S, *(pcb->root4));
+  if (pcb->root5) add_ref(S, *(pcb->root5));
+  if (pcb->root6) add_ref(S, *(pcb->root6));
+  if (pcb->root7) add_ref(S, *(pcb->root7));
+  if (pcb->root8) add_ref(S, *(pcb->root8));
+  if (pcb->root9) add_ref(S, *(pcb->root9));
+  for (i=0; i<pcb->root_stack_count; ++i)
+    add_ref(S, *(pcb->root_stack[i]));
+  write_object(S, 0, IK_SNAPSHOT_TYPE_ROOTS, 0, 0);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Scheme interface.
+ ** ----------------------------------------------------------------- */
+
+ikptr
+ikrt_gc_heap_snapshot (ikptr s_filename, ikpcb * pcb)
+/* Write  a snapshot of  the objects  reachable from the  roots to the
+   file whose pathname is the  bytevector S_FILENAME.  Return an exact
+   integer representing the number of objects written, or false if the
+   file cannot be written. */
+{
+  snapshot_t	S;
+  uint32_t	header[2] = { wordsize, 0 };
+  long		i;
+  int		failed;
+  bzero(&S, sizeof(snapshot_t));
+  S.pcb		= pcb;
+  S.stream	= fopen(IK_BYTEVECTOR_DATA_CHARP(s_filename), "wb");
+  if (NULL == S.stream)
+    return IK_FALSE;
+  setvbuf(S.stream, NULL, _IOFBF, 1024 * 1024);
+  S.first_page	= IK_PAGE_INDEX(pcb->memory_base);
+  S.pages_count	= IK_PAGE_INDEX(pcb->memory_end) - S.first_page;
+  S.pages	= calloc(S.pages_count, sizeof(unsigned char *));
+  if (NULL == S.pages)
+    ik_abort("%s: memory allocation failed", __func__);
+  fwrite(IK_SNAPSHOT_MAGIC, 1, strlen(IK_SNAPSHOT_MAGIC), S.stream);
+  fwrite(header, sizeof(uint32_t), 2, S.stream);
+  scan_roots(&S);
+  while (S.stack_len)
+    scan_object(&S, S.stack[--S.stack_len]);
+  put_u8(&S, IK_SNAPSHOT_END);
+  failed = ferror(S.stream);
+  failed = fclose(S.stream) || failed;
+  for (i=0; i<S.pages_count; ++i)
+    free(S.pages[i]);
+  free(S.pages);
+  free(S.stack);
+  free(S.refs);
+  return (failed)? IK_FALSE : ika_integer_from_long(pcb, S.objects);
+}
+
+/* end of file */
@@ -0,0 +1,408 @@
+/*
+ * Vicare Scheme -- isolates
+ *
+ * This program is free software:  you can redistribute it and/or modify
+ * it under  the terms of  the GNU General  Public License version  3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is  distributed in the hope that it  will be useful, but
+ * WITHOUT  ANY   WARRANTY;  without   even  the  implied   warranty  of
+ * MERCHANTABILITY  or FITNESS FOR  A PARTICULAR  PURPOSE.  See  the GNU
+ * General Public License for more details.
+ *
+ * You should  have received  a copy of  the GNU General  Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/** --------------------------------------------------------------------
+ ** Headers.
+ ** ----------------------------------------------------------------- */
+
+#include "internals.h"
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#  include <signal.h>
+#endif
+
+/* An isolate  is a PCB  running on its own  thread, with its own heap,
+   garbage collector and symbol table; it loads the boot file and runs it
+   with its own command line arguments, like the "vicare" process does.
+   Isolates share nothing: they communicate by sending bytevectors, which
+   are copied into the mailbox of the receiver and then into its heap.
+
+   The isolate  running "ikarus_main()" has  identifier zero; the others
+   are numbered from one  in order of creation.  An isolate that calls
+   "exit" terminates its thread, not the process; its exit status is
+   retrieved with "ikrt_isolate_join()". */
+
+typedef struct ik_isolate_message_t	ik_isolate_message_t;
+struct ik_isolate_message_t {
+  ik_isolate_message_t *	next;
+  long				len;
+  char				data[];
+};
+
+typedef struct ik_isolate_t		ik_isolate_t;
+struct ik_isolate_t {
+  /* Next isolate in the registry. */
+  ik_isolate_t *		next;
+  long				id;
+  /* The PCB, NULL when the isolate has terminated. */
+  ikpcb *			pcb;
+  /* Command line arguments, released when the thread starts. */
+  int				argc;
+  char **			argv;
+  /* Options of the runtime copied from the creator. */
+  ik_runtime_options_t		options;
+  /* Queue of messages received and not yet consumed. */
+  ik_isolate_message_t *	head;
+  ik_isolate_message_t *	tail;
+  /* Exit status, meaningful when "done" is true. */
+  int				status;
+  int				done;
+#ifdef HAVE_PTHREAD
+  pthread_t			thread;
+  pthread_cond_t		cond;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+
+/* The registry of the isolates, protected by "registry_mutex"; it also
+   protects the mailboxes. */
+static pthread_mutex_t	registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ik_isolate_t *	registry       = NULL;
+static long		next_id        = 1;
+static long		running        = 0;
+
+/* The boot file loaded by every isolate. */
+static char *		isolates_boot_file = NULL;
+
+
+/** --------------------------------------------------------------------
+ ** Registry.
+ ** ----------------------------------------------------------------- */
+
+static ik_isolate_t *
+isolate_alloc (long id)
+{
+  ik_isolate_t *	iso = calloc(1, sizeof(ik_isolate_t));
+  if (NULL == iso)
+    ik_abort("not enough memory to allocate an isolate");
+  iso->id = id;
+  pthread_cond_init(&iso->cond, NULL);
+  return iso;
+}
+static ik_isolate_t *
+isolate_lookup (long id)
+/* Must be called with the registry locked. */
+{
+  ik_isolate_t *	iso;
+  for (iso = registry; iso; iso = iso->next)
+    if (id == iso->id)
+      return iso;
+  return NULL;
+}
+static void
+isolate_free_messages (ik_isolate_t * iso)
+/* Must be called with the registry locked. */
+{
+  while (iso->head) {
+    ik_isolate_message_t *	next = iso->head->next;
+    free(iso->head);
+    iso->head = next;
+  }
+  iso->tail = NULL;
+}
+void
+ik_isolates_init (ikpcb * pcb, char * boot_file)
+/* Register PCB as the main isolate;  BOOT_FILE is the pathname of the
+   boot file to be loaded by the other isolates. */
+{
+  ik_isolate_t *	iso = isolate_alloc(0);
+  iso->pcb		= pcb;
+  iso->thread		= pthread_self();
+  pcb->isolate		= iso;
+  isolates_boot_file	= boot_file;
+  pthread_mutex_lock(&registry_mutex);
+  iso->next		= registry;
+  registry		= iso;
+  pthread_mutex_unlock(&registry_mutex);
+}
+long
+ik_isolates_running (void)
+/* Return the number of isolates, other than the main one, whose thread
+   is still running. */
+{
+  long	count;
+  pthread_mutex_lock(&registry_mutex);
+  count = running;
+  pthread_mutex_unlock(&registry_mutex);
+  return count;
+}
+
+
+/** --------------------------------------------------------------------
+ ** Threads.
+ ** ----------------------------------------------------------------- */
+
+static void
+isolate_terminate (ik_isolate_t * iso, int status)
+/* Release the PCB of ISO and record its exit status. */
+{
+  ik_delete_pcb(iso->pcb);
+  pthread_mutex_lock(&registry_mutex);
+  iso->pcb	= NULL;
+  iso->status	= status;
+  iso->done	= 1;
+  --running;
+  isolate_free_messages(iso);
+  pthread_mutex_unlock(&registry_mutex);
+}
+static void *
+isolate_main (void * data)
+{
+  ik_isolate_t *	iso = data;
+  ikpcb *		pcb = ik_make_pcb(&(iso->options));
+  pcb->isolate		= iso;
+  ik_set_the_pcb(pcb);
+  pthread_mutex_lock(&registry_mutex);
+  iso->pcb = pcb;
+  pthread_mutex_unlock(&registry_mutex);
+  { /* Set up  the list of  arguments like "ikarus_main()"  does, then
+       release the C strings. */
+    ikptr	arg_list = IK_NULL_OBJECT;
+    int		i;
+    for (i=iso->argc-1; i > 0; --i) {
+      int	n  = strlen(iso->argv[i]);
+      ikptr	bv = ik_unsafe_alloc(pcb, IK_ALIGN(disp_bytevector_data+n+1)) | bytevector_tag;
+      ikptr	p;
+      IK_REF(bv, off_bytevector_length) = IK_FIX(n);
+      memcpy((char*)(bv+off_bytevector_data), iso->argv[i], n+1);
+      p = ik_unsafe_alloc(pcb, pair_size);
+      IK_REF(p, disp_car) = bv;
+      IK_REF(p, disp_cdr) = arg_list;
+      arg_list = p | pair_tag;
+    }
+    pcb->argv0    = iso->argv[0];
+    pcb->arg_list = arg_list;
+    for (i=1; i<iso->argc; ++i)
+      free(iso->argv[i]);
+  }
+  if (! ik_heap_image_run(pcb, isolates_boot_file))
+    ik_fasl_load(pcb, isolates_boot_file);
+  /* The boot  file returned  without calling  "exit". */
+  free(iso->argv);
+  iso->argv = NULL;
+  isolate_terminate(iso, 0);
+  return NULL;
+}
+void
+ik_isolate_exit (ikpcb * pcb, int status)
+/* Called by "ikrt_exit()": if PCB is not the main isolate terminate its
+   thread rather than the process, else return. */
+{
+  ik_isolate_t *	iso = pcb->isolate;
+  if ((NULL == iso) || (0 == iso->id))
+    return;
+  free(iso->argv);
+  iso->argv = NULL;
+  isolate_terminate(iso, status);
+  pthread_exit(NULL);
+}
+
+#else /* HAVE_PTHREAD */
+
+void
+ik_isolates_init (ikpcb * pcb, char * boot_file)
+{
+  pcb->isolate = NULL;
+}
+long
+ik_isolates_running (void)
+{
+  return 0;
+}
+void
+ik_isolate_exit (ikpcb * pcb, int status)
+{
+  return;
+}
+
+#endif /* HAVE_PTHREAD */
+
+
+/** --------------------------------------------------------------------
+ ** Scheme interface.
+ ** ----------------------------------------------------------------- */
+
+ikptr
+ikrt_isolate_spawn (ikptr s_args, ikpcb * pcb)
+/* Start a new isolate running  the boot file with S_ARGS as command line
+   arguments; S_ARGS must be a list of bytevectors.  Return a fixnum
+   identifying the isolate, or false if the thread cannot be created. */
+{
+#ifdef HAVE_PTHREAD
+  ik_isolate_t *	iso;
+  sigset_t		all, old;
+  ikptr			s_spine;
+  int			argc, i, rv;
+  for (argc=1, s_spine=s_args; IK_NULL_OBJECT != s_spine; s_spine=IK_CDR(s_spine))
+    ++argc;
+  pthread_mutex_lock(&registry_mutex);
+  iso = isolate_alloc(next_id++);
+  pthread_mutex_unlock(&registry_mutex);
+  iso->argc		= argc;
+  iso->argv		= calloc(argc + 1, sizeof(char *));
+  if (NULL == iso->argv)
+    ik_abort("not enough memory to allocate the arguments of an isolate");
+  iso->argv[0]		= pcb->argv0;
+  for (i=1, s_spine=s_args; IK_NULL_OBJECT != s_spine; s_spine=IK_CDR(s_spine), ++i) {
+    ikptr	s_bv = IK_CAR(s_spine);
+    long	len  = IK_BYTEVECTOR_LENGTH(s_bv);
+    iso->argv[i] = malloc(len + 1);
+    if (NULL == iso->argv[i])
+      ik_abort("not enough memory to allocate the arguments of an isolate");
+    memcpy(iso->argv[i], IK_BYTEVECTOR_DATA_VOIDP(s_bv), len);
+    iso->argv[i][len] = '\0';
+  }
+  iso->options.sweep_threads	= pcb->sweep_threads;
+  iso->options.huge_pages	= pcb->huge_pages;
+  iso->options.fasl_load_threads	= pcb->fasl_load_threads;
+  /* Interprocess  signals are  blocked in the  new thread: they  are
+     handled by the main isolate. */
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  pthread_mutex_lock(&registry_mutex);
+  rv = pthread_create(&iso->thread, NULL, isolate_main, iso);
+  if (0 == rv) {
+    iso->next	= registry;
+    registry	= iso;
+    ++running;
+  }
+  pthread_mutex_unlock(&registry_mutex);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (rv) {
+    for (i=1; i<argc; ++i)
+      free(iso->argv[i]);
+    free(iso->argv);
+    pthread_cond_destroy(&iso->cond);
+    free(iso);
+    return IK_FALSE_OBJECT;
+  }
+  return IK_FIX(iso->id);
+#else
+  return IK_FALSE_OBJECT;
+#endif
+}
+ikptr
+ikrt_isolate_self (ikpcb * pcb)
+/* Return a fixnum identifying the isolate running PCB. */
+{
+#ifdef HAVE_PTHREAD
+  ik_isolate_t *	iso = pcb->isolate;
+  return IK_FIX(iso? iso->id : 0);
+#else
+  return IK_FIX(0);
+#endif
+}
+ikptr
+ikrt_isolate_send (ikptr s_id, ikptr s_bv, ikpcb * pcb)
+/* Append a copy of the bytevector S_BV to the mailbox of the isolate
+   S_ID.  Return true, or false if the isolate does not exist or has
+   terminated. */
+{
+#ifdef HAVE_PTHREAD
+  long			len = IK_BYTEVECTOR_LENGTH(s_bv);
+  ik_isolate_message_t *	msg = malloc(sizeof(ik_isolate_message_t) + len);
+  ik_isolate_t *	iso;
+  if (NULL == msg)
+    ik_abort("not enough memory to allocate an isolate message");
+  msg->next = NULL;
+  msg->len  = len;
+  memcpy(msg->data, IK_BYTEVECTOR_DATA_VOIDP(s_bv), len);
+  pthread_mutex_lock(&registry_mutex);
+  iso = isolate_lookup(IK_UNFIX(s_id));
+  if (iso && (! iso->done)) {
+    if (iso->tail)
+      iso->tail->next = msg;
+    else
+      iso->head = msg;
+    iso->tail = msg;
+    pthread_cond_signal(&iso->cond);
+    msg = NULL;
+  }
+  pthread_mutex_unlock(&registry_mutex);
+  if (msg) {
+    free(msg);
+    return IK_FALSE_OBJECT;
+  } else
+    return IK_TRUE_OBJECT;
+#else
+  return IK_FALSE_OBJECT;
+#endif
+}
+ikptr
+ikrt_isolate_receive (ikptr s_block, ikpcb * pcb)
+/* Remove the first message from the mailbox of the isolate running PCB
+   and return it as a new bytevector.  If the mailbox is empty: if S_BLOCK
+   is true wait for a message, else return false. */
+{
+#ifdef HAVE_PTHREAD
+  ik_isolate_t *	iso = pcb->isolate;
+  ik_isolate_message_t *	msg;
+  ikptr			s_bv;
+  if (NULL == iso)
+    return IK_FALSE_OBJECT;
+  pthread_mutex_lock(&registry_mutex);
+  while ((NULL == iso->head) && (IK_FALSE_OBJECT != s_block))
+    pthread_cond_wait(&iso->cond, &registry_mutex);
+  msg = iso->head;
+  if (msg) {
+    iso->head = msg->next;
+    if (NULL == iso->head)
+      iso->tail = NULL;
+  }
+  pthread_mutex_unlock(&registry_mutex);
+  if (NULL == msg)
+    return IK_FALSE_OBJECT;
+  s_bv = ika_bytevector_from_memory_block(pcb, msg->data, msg->len);
+  free(msg);
+  return s_bv;
+#else
+  return IK_FALSE_OBJECT;
+#endif
+}
+ikptr
+ikrt_isolate_join (ikptr s_id, ikpcb * pcb)
+/* Wait for the termination of the isolate S_ID, remove it from the
+   registry  and return its exit status as fixnum.  Return false if the
+   isolate does not exist or is the calling one. */
+{
+#ifdef HAVE_PTHREAD
+  ik_isolate_t *	iso;
+  ik_isolate_t **	link;
+  pthread_mutex_lock(&registry_mutex);
+  iso = isolate_lookup(IK_UNFIX(s_id));
+  if ((NULL == iso) || (0 == iso->id) || (iso == pcb->isolate)) {
+    pthread_mutex_unlock(&registry_mutex);
+    return IK_FALSE_OBJECT;
+  }
+  for (link = &registry; *link != iso; link = &((*link)->next));
+  *link = iso->next;
+  pthread_mutex_unlock(&registry_mutex);
+  pthread_join(iso->thread, NULL);
+  {
+    int	status = iso->status;
+    pthread_cond_destroy(&iso->cond);
+    free(iso);
+    return IK_FIX(status);
+  }
+#else
+  return IK_FALSE_OBJECT;
+#endif
+}
+
+/* end of file */
@@ -33,14 +33,21 @@
 extern int cpu_has_sse2();
 static void register_handlers();
 static void register_alt_stack();
+static int  parse_runtime_options (ik_runtime_options_t * options, int argc, char ** argv);
 
-ikpcb* the_pcb;
+/* Every isolate runs on its own thread with its own PCB. */
+static __thread ikpcb *	the_pcb;
 
 ikpcb *
 ik_the_pcb (void)
 {
   return the_pcb;
 }
+void
+ik_set_the_pcb (ikpcb * pcb)
+{
+  the_pcb = pcb;
+}
 
 
 int
@@ -56,8 +63,9 @@ ikarus_main (int argc, char** argv, char* boot_file)
    "boot_file" must  be a string  representing the filename of  the boot
    file to use. */
 {
-  ikpcb *	pcb;
-  int		repl_on_sigint	= 0;
+  ikpcb *		pcb;
+  ik_runtime_options_t	options;
+  int			repl_on_sigint	= 0;
   if (! cpu_has_sse2()) {
     fprintf(stderr, "Vicare Scheme cannot run on your computer because\n");
     fprintf(stderr, "your CPU does not support the SSE2 instruction set.\n");
@@ -69,7 +77,9 @@ ikarus_main (int argc, char** argv, char* boot_file)
     ik_abort("limb size does not match");
   if (mp_bits_per_limb != (8*sizeof(long int)))
     ik_abort("invalid bits_per_limb=%d\n", mp_bits_per_limb);
-  the_pcb = pcb = ik_make_pcb();
+  /* The options select how the PCB memory is allocated: parse them first. */
+  argc = parse_runtime_options(&options, argc, argv);
+  the_pcb = pcb = ik_make_pcb(&options);
   { /* Set up arg_list from the  last "argv" to the first; the resulting
        list will end in COMMAND-LINE. */
 
@@ -96,12 +106,71 @@ ikarus_main (int argc, char** argv, char* boot_file)
   }
   register_handlers(repl_on_sigint);
   register_alt_stack();
-  ik_fasl_load(pcb, boot_file);
+  ik_isolates_init(pcb, boot_file);
+  if (! ik_heap_image_run(pcb, boot_file))
+    ik_fasl_load(pcb, boot_file);
   ik_delete_pcb(pcb);
   return 0;
 }
 
 
+static int
+parse_runtime_options (ik_runtime_options_t * options, int argc, char ** argv)
+/* Scan the command  line arguments for options configuring  the runtime
+   system, store their values in OPTIONS and remove them from "argv", so
+   that  the Scheme  code never  sees them.   Stop at  the end-of-options
+   marker "--".  Return the new number of arguments. */
+{
+  int	i, j;
+  bzero(options, sizeof(ik_runtime_options_t));
+  for (i=1, j=1; i<argc; ++i) {
+    if (0 == strcmp(argv[i], "--")) {
+      for (; i<argc; ++i, ++j)
+	argv[j] = argv[i];
+      break;
+    } else if (0 == strcmp(argv[i], "--gc-sweep-threads")) {
+      if (i+1 < argc) {
+	char *	tail;
+	long	count = strtol(argv[++i], &tail, 10);
+	if (('\0' == *tail) && (0 < count) && (count <= IK_GC_MAX_THREADS)) {
+	  options->sweep_threads = (int)count;
+	} else {
+	  fprintf(stderr, "*** %s error: invalid argument to option --gc-sweep-threads: %s\n",
+		  argv[0], argv[i]);
+	  exit(2);
+	}
+      } else {
+	fprintf(stderr, "*** %s error: option --gc-sweep-threads needs a threads count as argument\n",
+		argv[0]);
+	exit(2);
+      }
+    } else if (0 == strcmp(argv[i], "--fasl-load-threads")) {
+      if (i+1 < argc) {
+	char *	tail;
+	long	count = strtol(argv[++i], &tail, 10);
+	if (('\0' == *tail) && (0 < count) && (count <= IK_FASL_MAX_THREADS)) {
+	  options->fasl_load_threads = (int)count;
+	} else {
+	  fprintf(stderr, "*** %s error: invalid argument to option --fasl-load-threads: %s\n",
+		  argv[0], argv[i]);
+	  exit(2);
+	}
+      } else {
+	fprintf(stderr, "*** %s error: option --fasl-load-threads needs a threads count as argument\n",
+		argv[0]);
+	exit(2);
+      }
+    } else if (0 == strcmp(argv[i], "--gc-huge-pages")) {
+      options->huge_pages = 1;
+    } else {
+      argv[j++] = argv[i];
+    }
+  }
+  argv[j] = NULL;
+  return j;
+}
+
+
 /** --------------------------------------------------------------------
  ** Special functions.
  ** ----------------------------------------------------------------- */
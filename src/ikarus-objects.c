@@ -1622,8 +1622,10 @@ ikrt_debug_bignum_from_bytevector (ikptr s_bv, ikpcb * pcb)
  ** Garbage collection avoidance.
  ** ----------------------------------------------------------------- */
 
-static ik_gc_avoidance_collection_t *
-ik_allocate_avoidance_collection (void)
+static void
+ik_allocate_avoidance_collection (ik_gc_avoidance_registry_t * R)
+/* Allocate a new chunk of slots, push it on the list of chunks and push
+   all its slots on the free list. */
 {
   ik_gc_avoidance_collection_t *	collection;
   int	i;
@@ -1631,9 +1633,25 @@ ik_allocate_avoidance_collection (void)
   if (NULL == collection) {
     ik_abort("not enough memory to allocate a garbage collection avoidance list");
   }
-  for (i=0; i<IK_GC_AVOIDANCE_ARRAY_LEN; ++i)
-    collection->slots[i] = IK_VOID;
-  return collection;
+  for (i=IK_GC_AVOIDANCE_ARRAY_LEN-1; i>=0; --i) {
+    collection->slots[i].obj		= IK_VOID;
+    collection->slots[i].u.next_free	= R->free_slots;
+    R->free_slots			= &(collection->slots[i]);
+  }
+  collection->next	= R->collections;
+  R->collections	= collection;
+}
+static void
+ik_release_avoidance_slot (ik_gc_avoidance_registry_t * R, ik_gc_avoidance_slot_t * slot)
+/* Remove  a used  SLOT from  the array  of used  slots, moving  the last
+   used slot in its place, then push it on the free list. */
+{
+  ik_gc_avoidance_slot_t *	last = R->live[--(R->live_count)];
+  last->u.index			= slot->u.index;
+  R->live[last->u.index]	= last;
+  slot->obj		= IK_VOID;
+  slot->u.next_free	= R->free_slots;
+  R->free_slots		= slot;
 }
 ikptr
 ik_register_to_avoid_collecting (ikptr s_obj, ikpcb * pcb)
@@ -1641,49 +1659,36 @@ ik_register_to_avoid_collecting (ikptr s_obj, ikpcb * pcb)
   if (IK_VOID == s_obj) {
     return ika_pointer_alloc(pcb, (ik_ulong)NULL);
   } else {
-    ik_gc_avoidance_collection_t *	collection = pcb->not_to_be_collected;
-    ikptr *				slot = NULL;
-    { /* If no collections are present: allocate a new one and store it in
-	 the PCB. */
-      if (NULL == collection)
-	pcb->not_to_be_collected = collection = ik_allocate_avoidance_collection();
-    }
-    { /* At  least  one  collection  is   present.   Search  the  list  of
-	 collections for the first with a free slot in its array. */
-      while (collection) {
-	int	i;
-	for (i=0; i<IK_GC_AVOIDANCE_ARRAY_LEN; ++i) {
-	  if (IK_VOID == collection->slots[i]) {
-	    slot = &collection->slots[i];
-	    goto out;
-	  }
-	}
-	collection = collection->next;
+    ik_gc_avoidance_registry_t *	R = &(pcb->not_to_be_collected);
+    ik_gc_avoidance_slot_t *		slot;
+    if (NULL == R->free_slots)
+      ik_allocate_avoidance_collection(R);
+    if (R->live_count == R->live_size) {
+      long	new_size = (R->live_size)? (2 * R->live_size) : IK_GC_AVOIDANCE_ARRAY_LEN;
+      ik_gc_avoidance_slot_t **	new_live = realloc(R->live, new_size * sizeof(ik_gc_avoidance_slot_t *));
+      if (NULL == new_live) {
+	ik_abort("not enough memory to enlarge the garbage collection avoidance list");
       }
+      R->live		= new_live;
+      R->live_size	= new_size;
     }
-  out:
-    /* If no collection has a free slot: allocate a new one and push it on
-       the PCB. */
-    {
-      if (NULL == slot) {
-	collection		= ik_allocate_avoidance_collection();
-	collection->next	= pcb->not_to_be_collected;
-	pcb->not_to_be_collected= collection;
-	slot = &(collection->slots[0]);
-      }
-    }
-    /* Now SLOT references a free slot. */
-    *slot = s_obj;
+    /* Pop a slot from the free list and append it to the used ones. */
+    slot			= R->free_slots;
+    R->free_slots		= slot->u.next_free;
+    slot->obj			= s_obj;
+    slot->serial		= R->next_serial++;
+    slot->u.index		= R->live_count;
+    R->live[R->live_count++]	= slot;
     return ika_pointer_alloc(pcb, (ik_ulong)slot);
   }
 }
 ikptr
 ik_forget_to_avoid_collecting (ikptr s_ptr, ikpcb * pcb)
 {
-  ikptr *	P = IK_POINTER_DATA_VOIDP(s_ptr);
-  if (P) {
-    ikptr	s_obj = *P;
-    *P = IK_VOID;
+  ik_gc_avoidance_slot_t *	P = IK_POINTER_DATA_VOIDP(s_ptr);
+  if (P && (IK_VOID != P->obj)) {
+    ikptr	s_obj = P->obj;
+    ik_release_avoidance_slot(&(pcb->not_to_be_collected), P);
     return s_obj;
   } else
     return IK_VOID;
@@ -1691,68 +1696,65 @@ ik_forget_to_avoid_collecting (ikptr s_ptr, ikpcb * pcb)
 ikptr
 ik_retrieve_to_avoid_collecting (ikptr s_ptr, ikpcb * pcb)
 {
-  ikptr *	P = IK_POINTER_DATA_VOIDP(s_ptr);
-  return (P)? *P : IK_VOID;
+  ik_gc_avoidance_slot_t *	P = IK_POINTER_DATA_VOIDP(s_ptr);
+  return (P)? P->obj : IK_VOID;
 }
 ikptr
 ik_replace_to_avoid_collecting (ikptr s_ptr, ikptr s_new_obj, ikpcb * pcb)
-{
-  ikptr *	P = IK_POINTER_DATA_VOIDP(s_ptr);
-  if (P) {
-    ikptr	s_old_obj = *P;
-    *P = s_new_obj;
+/* Store S_NEW_OBJ in a used slot; storing IK_VOID releases the slot.  A
+   slot already released is left untouched. */
+{
+  ik_gc_avoidance_slot_t *	P = IK_POINTER_DATA_VOIDP(s_ptr);
+  if (P && (IK_VOID != P->obj)) {
+    ikptr	s_old_obj = P->obj;
+    if (IK_VOID == s_new_obj)
+      ik_release_avoidance_slot(&(pcb->not_to_be_collected), P);
+    else
+      P->obj = s_new_obj;
     return s_old_obj;
   } else
     return IK_VOID;
 }
+static int
+ik_compare_avoidance_slots (const void * A, const void * B)
+{
+  long	a = (*((ik_gc_avoidance_slot_t **)A))->serial;
+  long	b = (*((ik_gc_avoidance_slot_t **)B))->serial;
+  return (a < b)? -1 : ((a > b)? 1 : 0);
+}
 ikptr
 ik_collection_avoidance_list (ikpcb * pcb)
+/* Return a list of the  registered values in the order of registration.
+   The array of used slots is sorted  in place: this does not invalidate
+   it, we only have to update the indexes. */
 {
-  ik_gc_avoidance_collection_t *	collection = pcb->not_to_be_collected;
+  ik_gc_avoidance_registry_t *	R = &(pcb->not_to_be_collected);
   ikptr		s_list		= IK_NULL;
   ikptr		s_spine		= IK_NULL;
-  if (NULL == collection)
-    return IK_NULL;
-  else {
-    pcb->root0 = &s_list;
-    pcb->root1 = &s_spine;
-    {
-      while (collection) {
-	int	i;
-	for (i=0; i<IK_GC_AVOIDANCE_ARRAY_LEN; ++i) {
-	  /* fprintf(stderr, "%d=%ld ", i, collection->slots[i]); */
-	  if (IK_VOID != collection->slots[i]) {
-	    if (IK_NULL == s_spine) {
-	      s_spine = ika_pair_alloc(pcb);
-	    } else {
-	      IK_ASS(IK_CDR(s_spine), ika_pair_alloc(pcb));
-	      s_spine = IK_CDR(s_spine);
-	    }
-	    IK_CAR(s_spine) = collection->slots[i];
-	    if (IK_NULL == s_list)
-	      s_list = s_spine;
-	  }
-	}
-	collection = collection->next;
-      }
-      if (IK_NULL != s_spine)
-	IK_CDR(s_spine) = IK_NULL;
+  long		i;
+  qsort(R->live, R->live_count, sizeof(ik_gc_avoidance_slot_t *), ik_compare_avoidance_slots);
+  for (i=0; i<R->live_count; ++i)
+    R->live[i]->u.index = i;
+  pcb->root0 = &s_list;
+  pcb->root1 = &s_spine;
+  {
+    for (i=R->live_count-1; i>=0; --i) {
+      s_spine = ika_pair_alloc(pcb);
+      IK_CAR(s_spine) = R->live[i]->obj;
+      IK_CDR(s_spine) = s_list;
+      s_list = s_spine;
     }
-    pcb->root1 = NULL;
-    pcb->root0 = NULL;
-    return s_list;
   }
+  pcb->root1 = NULL;
+  pcb->root0 = NULL;
+  return s_list;
 }
 ikptr
 ik_purge_collection_avoidance_list (ikpcb * pcb)
 {
-  ik_gc_avoidance_collection_t *	collection = pcb->not_to_be_collected;
-  while (collection) {
-    int		i;
-    for (i=0; i<IK_GC_AVOIDANCE_ARRAY_LEN; ++i)
-      collection->slots[i] = IK_VOID;
-    collection = collection->next;
-  }
+  ik_gc_avoidance_registry_t *	R = &(pcb->not_to_be_collected);
+  while (R->live_count)
+    ik_release_avoidance_slot(R, R->live[R->live_count - 1]);
   return IK_VOID;
 }
 
@@ -2845,10 +2845,12 @@ ikrt_posix_inet_ntop (ikptr s_af, ikptr s_host_address, ikpcb * pcb)
 static ikptr
 hostent_to_struct (ikptr s_rtd, struct hostent * src, ikpcb * pcb)
 /* Convert  a  C  language  "struct  hostent"  into  a  Scheme  language
-   "struct-hostent".  Makes use of "pcb->root6,7,8". */
+   "struct-hostent".  Makes use of the root stack, so it can be called by
+   functions using "pcb->root0,...". */
 {
   ikptr s_dst = ika_struct_alloc_and_init(pcb, s_rtd); /* this uses "pcb->root9" */
-  pcb->root8 = &s_dst;
+  IK_BEGIN_ROOTS(pcb);
+  IK_PUSH_ROOT(pcb, s_dst);
   { /* store the official host name */
     IK_ASS(IK_FIELD(s_dst, 0), ika_bytevector_from_cstring(pcb, src->h_name));
   }
@@ -2856,8 +2858,8 @@ hostent_to_struct (ikptr s_rtd, struct hostent * src, ikpcb * pcb)
     if (src->h_aliases[0]) {
       ikptr	s_list_of_aliases, s_spine;
       s_list_of_aliases = s_spine = ika_pair_alloc(pcb);
-      pcb->root6 = &s_list_of_aliases;
-      pcb->root7 = &s_spine;
+      IK_PUSH_ROOT(pcb, s_list_of_aliases);
+      IK_PUSH_ROOT(pcb, s_spine);
       {
 	int	i;
 	for (i=0; src->h_aliases[i];) {
@@ -2871,8 +2873,7 @@ hostent_to_struct (ikptr s_rtd, struct hostent * src, ikpcb * pcb)
 	  }
 	}
       }
-      pcb->root7 = NULL;
-      pcb->root6 = NULL;
+      ik_pop_roots(pcb, 2);
       IK_FIELD(s_dst, 1) = s_list_of_aliases;
     } else
       IK_FIELD(s_dst, 1) = IK_NULL_OBJECT;
@@ -2887,8 +2888,8 @@ hostent_to_struct (ikptr s_rtd, struct hostent * src, ikpcb * pcb)
     if (src->h_addr_list[0]) {
       ikptr	s_list_of_addrs, s_spine;
       s_list_of_addrs = s_spine = ika_pair_alloc(pcb);
-      pcb->root6 = &s_list_of_addrs;
-      pcb->root7 = &s_spine;
+      IK_PUSH_ROOT(pcb, s_list_of_addrs);
+      IK_PUSH_ROOT(pcb, s_spine);
       {
 	int	i;
 	for (i=0; src->h_addr_list[i];) {
@@ -2903,8 +2904,7 @@ hostent_to_struct (ikptr s_rtd, struct hostent * src, ikpcb * pcb)
 	  }
 	}
       }
-      pcb->root7 = NULL;
-      pcb->root6 = NULL;
+      ik_pop_roots(pcb, 2);
       IK_FIELD(s_dst, 4) = s_list_of_addrs;
     } else
       IK_FIELD(s_dst, 4) = IK_NULL_OBJECT;
@@ -2912,7 +2912,7 @@ hostent_to_struct (ikptr s_rtd, struct hostent * src, ikpcb * pcb)
   {/* store the first in the list of addresses */
     IK_FIELD(s_dst, 5) = IK_CAR(IK_FIELD(s_dst, 4));
   }
-  pcb->root8 = NULL;
+  IK_END_ROOTS(pcb);
   return s_dst;
 }
 #endif
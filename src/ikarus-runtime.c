@@ -39,6 +39,7 @@
  ** Prototypes and internal definitions.
  ** ----------------------------------------------------------------- */
 
+/* Shared by all the isolates: updated with atomic operations. */
 static int total_allocated_pages = 0;
 static int total_malloced = 0;
 
@@ -46,9 +47,80 @@ static int total_malloced = 0;
 #define SEGMENT_SHIFT		(IK_PAGESHIFT + IK_PAGESHIFT - 2)
 #define SEGMENT_INDEX(x)	(((ik_ulong)(x)) >> SEGMENT_SHIFT)
 
+/* Minimum number  of "ikpage" descriptors in  the page cache;  the array
+   is sized  to  twice the  limit of  resident pages,  so that the  pages
+   released to the OS can still be cached. */
 #define CACHE_SIZE		(IK_PAGESIZE * 1) /* must be multiple of IK_PAGESIZE */
 
 
+/* The segment  and dirty vectors  are sized to cover the  whole range of
+   addresses  between the lowest and highest  pages used by Vicare;  on
+   64-bit platforms  such range  can be  very sparse.   So the  tables are
+   mapped with  "table_mmap()", which does  not touch the memory:  the OS
+   commits only the pages  of the tables actually used, and  it maps the
+   others to the  shared zero page.  When possible, tables  are grown by
+   moving their pages with "mremap()" rather than copying them. */
+
+#ifndef MAP_NORESERVE
+#  define MAP_NORESERVE		0
+#endif
+
+static ikptr
+table_mmap (ik_ulong size)
+/* Map SIZE bytes of zero-filled memory for a table. */
+{
+#ifndef __CYGWIN__
+  char * mem = mmap(0, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON|MAP_NORESERVE, -1, 0);
+  if (MAP_FAILED == mem)
+    ik_abort("mapping table (0x%lx bytes) failed: %s", size, strerror(errno));
+  return (ikptr)(long)mem;
+#else
+  ikptr mem = ik_mmap(size);
+  bzero((char*)(long)mem, size);
+  return mem;
+#endif
+}
+static void
+table_munmap (ikptr mem, ik_ulong size)
+{
+#ifndef __CYGWIN__
+  if (munmap((char*)(long)mem, size))
+    ik_abort("unmapping table failed: %s", strerror(errno));
+#else
+  ik_munmap(mem, size);
+#endif
+}
+static ikptr
+table_grow (ikptr old, ik_ulong old_size, ik_ulong new_size, int prepend)
+/* Return a new  table of NEW_SIZE bytes holding the  OLD_SIZE bytes of
+   the table OLD: at its end if PREPEND is true, at its beginning otherwise;
+   the other bytes  are zero.  OLD is released.  Both sizes must be
+   multiples of the page size. */
+{
+  ikptr	mem;
+#if ((defined HAVE_MREMAP) && (defined MREMAP_MAYMOVE) && (! defined __CYGWIN__))
+  if (prepend) {
+#  ifdef MREMAP_FIXED
+    /* Move the pages of OLD at the end of a new reservation. */
+    mem = table_mmap(new_size);
+    if (MAP_FAILED != mremap((void*)(long)old, old_size, old_size, MREMAP_MAYMOVE|MREMAP_FIXED,
+			     (void*)(long)(mem + new_size - old_size)))
+      return mem;
+    table_munmap(mem, new_size);
+#  endif
+  } else {
+    /* Extend OLD in place or move its pages somewhere else. */
+    void *	ptr = mremap((void*)(long)old, old_size, new_size, MREMAP_MAYMOVE);
+    if (MAP_FAILED != ptr)
+      return (ikptr)(long)ptr;
+  }
+#endif
+  mem = table_mmap(new_size);
+  memcpy((char*)(long)(prepend? (mem + new_size - old_size) : mem), (char*)(long)old, old_size);
+  table_munmap(old, old_size);
+  return mem;
+}
+
 static void
 extend_table_maybe (ikptr p, ik_ulong size, ikpcb* pcb)
 {
@@ -60,20 +132,10 @@ extend_table_maybe (ikptr p, ik_ulong size, ikpcb* pcb)
     ik_ulong hi           = SEGMENT_INDEX(pcb->memory_end);
     ik_ulong new_vec_size = (hi - new_lo) * IK_PAGESIZE;
     ik_ulong old_vec_size = (hi - old_lo) * IK_PAGESIZE;
-    ikptr v = ik_mmap(new_vec_size);
-    bzero((char*)(long)v, new_vec_size - old_vec_size);
-    memcpy((char*)(long)(v+new_vec_size-old_vec_size),
-           (char*)(long)pcb->dirty_vector_base,
-           old_vec_size);
-    ik_munmap((ikptr)(long)pcb->dirty_vector_base, old_vec_size);
+    ikptr v = table_grow((ikptr)(long)pcb->dirty_vector_base, old_vec_size, new_vec_size, 1);
     pcb->dirty_vector_base = (unsigned*)(long)v;
     pcb->dirty_vector      = (v - new_lo * IK_PAGESIZE);
-    ikptr s = ik_mmap(new_vec_size);
-    bzero((char*)(long)s, new_vec_size - old_vec_size);
-    memcpy((char*)(long)(s+new_vec_size-old_vec_size),
-           (char*)(long)(pcb->segment_vector_base),
-           old_vec_size);
-    ik_munmap((ikptr)(long)pcb->segment_vector_base, old_vec_size);
+    ikptr s = table_grow((ikptr)(long)pcb->segment_vector_base, old_vec_size, new_vec_size, 1);
     pcb->segment_vector_base = (unsigned*)(long)s;
     pcb->segment_vector = (unsigned*)(long)(s - new_lo * IK_PAGESIZE);
     pcb->memory_base = (new_lo * SEGMENT_SIZE);
@@ -84,39 +146,82 @@ extend_table_maybe (ikptr p, ik_ulong size, ikpcb* pcb)
     ik_ulong new_hi       = SEGMENT_INDEX(q+SEGMENT_SIZE-1);
     ik_ulong new_vec_size = (new_hi - lo) * IK_PAGESIZE;
     ik_ulong old_vec_size = (old_hi - lo) * IK_PAGESIZE;
-    ikptr v = ik_mmap(new_vec_size);
-    memcpy((char*)(long)v,
-           (char*)(long)pcb->dirty_vector_base,
-           old_vec_size);
-    bzero((char*)(long)(v+old_vec_size), new_vec_size - old_vec_size);
-    ik_munmap((ikptr)(long)pcb->dirty_vector_base, old_vec_size);
+    ikptr v = table_grow((ikptr)(long)pcb->dirty_vector_base, old_vec_size, new_vec_size, 0);
     pcb->dirty_vector_base = (unsigned*)(long)v;
     pcb->dirty_vector      = (v - lo * IK_PAGESIZE);
-    ikptr s = ik_mmap(new_vec_size);
-    memcpy((char*)(long)s, pcb->segment_vector_base, old_vec_size);
-    bzero((char*)(long)(s+old_vec_size), new_vec_size - old_vec_size);
-    ik_munmap((ikptr)(long)pcb->segment_vector_base, old_vec_size);
+    ikptr s = table_grow((ikptr)(long)pcb->segment_vector_base, old_vec_size, new_vec_size, 0);
     pcb->segment_vector_base = (unsigned*)(long) s;
     pcb->segment_vector      = (unsigned*)(s - lo * IK_PAGESIZE);
     pcb->memory_end          = (new_hi * SEGMENT_SIZE);
   }
 }
-
+
 static void
 set_segment_type (ikptr base, ik_ulong size, unsigned type, ikpcb* pcb)
 /* Set to TYPE all the entries in "pcb->segment_vector" corresponding to
-   the memory block starting at BASE and SIZE bytes wide. */
+   the memory block starting at BASE and SIZE bytes wide.  The pages which
+   were holes are accounted in "pcb->heap_pages_count". */
 {
   assert(base >= pcb->memory_base);
   assert((base+size) <= pcb->memory_end);
   assert(size == IK_ALIGN_TO_NEXT_PAGE(size));
+  assert(hole_mt != type);
   unsigned * p = pcb->segment_vector + IK_PAGE_INDEX(base);
   unsigned * q = p                   + IK_PAGE_INDEX(size);
-  for (; p < q; ++p)
+  for (; p < q; ++p) {
+    if (hole_mt == *p)
+      ++(pcb->heap_pages_count);
     *p = type;
+  }
 }
 
 
+static ikptr
+ik_mmap_huge (ik_ulong size)
+/* Like "ik_mmap()", but  the returned memory is aligned  to a huge page
+   and the kernel is advised to back it with transparent huge pages. */
+{
+#if ((! defined __CYGWIN__) && (defined HAVE_MADVISE) && (defined MADV_HUGEPAGE))
+  ik_ulong	mapsize = size + IK_HUGE_PAGE_SIZE;
+  char *	mem	= mmap(0, mapsize, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE|MAP_ANON, -1, 0);
+  char *	base;
+  if (mem == MAP_FAILED)
+    ik_abort("mapping (0x%lx bytes) failed: %s", mapsize, strerror(errno));
+  /* Unmap the misaligned head and the tail. */
+  base = (char*)((((ik_ulong)mem) + IK_HUGE_PAGE_SIZE - 1) & ~((ik_ulong)(IK_HUGE_PAGE_SIZE - 1)));
+  if (base > mem)
+    munmap(mem, base - mem);
+  if (mem + mapsize > base + size)
+    munmap(base + size, (mem + mapsize) - (base + size));
+  madvise(base, size, MADV_HUGEPAGE);
+  __sync_fetch_and_add(&total_allocated_pages, size / IK_PAGESIZE);
+  memset(base, -1, size);
+  return (ikptr)(long)base;
+#else
+  return ik_mmap(size);
+#endif
+}
+static ikptr
+ik_mmap_from_huge_region (ik_ulong size, ikpcb* pcb)
+/* Allocate  a segment  of SIZE bytes from huge  page regions: segments
+   at least as big as a region get their own mapping; smaller segments are
+   carved from the current region,  so that pages allocated close in time
+   share the same TLB entry. */
+{
+  ikptr	segment;
+  if (size >= IK_HUGE_PAGE_SIZE)
+    return ik_mmap_huge(IK_ALIGN_TO_NEXT_PAGE(size));
+  if (pcb->huge_pages_ap + size > pcb->huge_pages_ep) {
+    if (pcb->huge_pages_ap < pcb->huge_pages_ep)
+      ik_munmap(pcb->huge_pages_ap, pcb->huge_pages_ep - pcb->huge_pages_ap);
+    pcb->huge_pages_ap = ik_mmap_huge(IK_HUGE_PAGE_SIZE);
+    pcb->huge_pages_ep = pcb->huge_pages_ap + IK_HUGE_PAGE_SIZE;
+  }
+  segment = pcb->huge_pages_ap;
+  pcb->huge_pages_ap += size;
+  return segment;
+}
+
 ikptr
 ik_mmap_typed (ik_ulong size, unsigned type, ikpcb* pcb)
 {
@@ -132,10 +237,13 @@ ik_mmap_typed (ik_ulong size, unsigned type, ikpcb* pcb)
 	 pages. */
       pages->next	  = pcb->uncached_pages;
       pcb->uncached_pages = pages;
+      --(pcb->cached_pages_count);
+      if (pcb->cached_pages_resident)
+	--(pcb->cached_pages_resident);
     } else
-      segment = ik_mmap(size);
+      segment = (pcb->huge_pages)? ik_mmap_from_huge_region(size, pcb) : ik_mmap(size);
   } else {
-    segment = ik_mmap(size);
+    segment = (pcb->huge_pages)? ik_mmap_from_huge_region(size, pcb) : ik_mmap(size);
   }
   extend_table_maybe(segment, size, pcb);
   set_segment_type(segment, size, type, pcb);
@@ -166,13 +274,150 @@ ik_mmap_mixed (ik_ulong size, ikpcb* pcb)
   return ik_mmap_typed(size, mainheap_mt, pcb);
 }
 
+
+/* Pages  released by the  garbage collector are  prepended to  the list
+   "pcb->cached_pages" and reused by "ik_mmap_typed()" from the head of the
+   list; so the first "cached_pages_resident" pages in the list are still
+   backed by memory.  After a collection the resident pages exceeding the
+   high-water mark "cached_pages_limit" are returned to the OS, but left
+   mapped: reusing them costs a page fault rather than a system call.  The
+   released pages are coalesced in runs of adjacent pages,  so that a freed
+   nursery costs few system calls. */
+
+#if ((defined HAVE_MADVISE) && (! defined __CYGWIN__))
+#  if (defined MADV_FREE)
+#    define IK_MADV_RELEASE	MADV_FREE
+#  elif (defined MADV_DONTNEED)
+#    define IK_MADV_RELEASE	MADV_DONTNEED
+#  endif
+#endif
+
+static void
+release_pages_run (ikptr base, ik_ulong size)
+{
+#ifdef IK_MADV_RELEASE
+  if (madvise((void*)(long)base, size, IK_MADV_RELEASE)) {
+#  if ((defined MADV_FREE) && (defined MADV_DONTNEED))
+    /* MADV_FREE is not supported by kernels older than 4.5. */
+    madvise((void*)(long)base, size, MADV_DONTNEED);
+#  endif
+  }
+#endif
+}
+static ikpage *
+walk_pages_runs (ikpage * pages, int count, void (*fun) (ikptr base, ik_ulong size))
+/* Apply FUN to the runs of adjacent pages among the first COUNT pages in
+   the list PAGES; return the rest of the list. */
+{
+  while (pages && count) {
+    ikptr	lo = pages->base;
+    ikptr	hi = lo + IK_PAGESIZE;
+    for (pages = pages->next, --count; pages && count; pages = pages->next, --count) {
+      if (pages->base == lo - IK_PAGESIZE)
+	lo = pages->base;
+      else if (pages->base == hi)
+	hi += IK_PAGESIZE;
+      else
+	break;
+    }
+    fun(lo, hi - lo);
+  }
+  return pages;
+}
+void
+ik_release_cached_pages (ikpcb* pcb)
+/* Return to the OS the resident cached pages above the high-water mark. */
+{
+  int	limit = pcb->cached_pages_limit;
+  if (pcb->cached_pages_resident > limit) {
+    ikpage *	pages = pcb->cached_pages;
+    int		i;
+    for (i=0; i<limit; ++i)
+      pages = pages->next;
+    walk_pages_runs(pages, pcb->cached_pages_resident - limit, release_pages_run);
+    pcb->cached_pages_resident = limit;
+  }
+}
+static void
+unmap_pages_run (ikptr base, ik_ulong size)
+{
+  ik_munmap(base, size);
+}
+long
+ik_trim_cached_pages (ikpcb* pcb)
+/* Unmap all the cached pages; return their number. */
+{
+  long		count = pcb->cached_pages_count;
+  ikpage *	pages = pcb->cached_pages;
+  walk_pages_runs(pages, count, unmap_pages_run);
+  /* Move all the page descriptors to the uncached list. */
+  while (pages) {
+    ikpage *	next = pages->next;
+    pages->next	        = pcb->uncached_pages;
+    pcb->uncached_pages = pages;
+    pages = next;
+  }
+  pcb->cached_pages          = NULL;
+  pcb->cached_pages_count    = 0;
+  pcb->cached_pages_resident = 0;
+  return count;
+}
+int
+ik_resize_page_cache (ikpcb* pcb, int limit)
+/* Set LIMIT  as number of  cached pages left  resident after a collection
+   and reallocate the  array of "ikpage" descriptors to  hold twice LIMIT
+   pages.  The cached pages  are moved to the new array in the same order;
+   those not fitting in it are unmapped.  Return 0 if successful, -1 if
+   LIMIT is out of range. */
+{
+  long		capacity;
+  ikpage *	base;
+  ikpage *	cur;
+  ikpage *	pages = pcb->cached_pages;
+  ikpage **	tail;
+  int		count = 0;
+  if ((limit < 0) || (limit > IK_PAGE_CACHE_MAX_LIMIT))
+    return -1;
+  capacity = 2 * (long)limit;
+  if (capacity < CACHE_SIZE)
+    capacity = CACHE_SIZE;
+  capacity = IK_ALIGN_TO_NEXT_PAGE(capacity * sizeof(ikpage)) / sizeof(ikpage);
+  base = (ikpage*)(long)ik_mmap(capacity * sizeof(ikpage));
+  /* Copy the cached pages in the new array, preserving their order. */
+  cur  = base;
+  tail = &(pcb->cached_pages);
+  for (; pages && (count < capacity); pages = pages->next, ++cur, ++count) {
+    cur->base = pages->base;
+    *tail     = cur;
+    tail      = &(cur->next);
+  }
+  *tail = NULL;
+  /* Unmap the cached pages exceeding the capacity. */
+  walk_pages_runs(pages, pcb->cached_pages_count - count, unmap_pages_run);
+  pcb->cached_pages_count = count;
+  if (pcb->cached_pages_resident > count)
+    pcb->cached_pages_resident = count;
+  /* Link the remaining descriptors in the uncached list. */
+  pcb->uncached_pages = NULL;
+  for (; cur < base + capacity; ++cur) {
+    cur->next           = pcb->uncached_pages;
+    pcb->uncached_pages = cur;
+  }
+  if (pcb->cached_pages_base)
+    ik_munmap(pcb->cached_pages_base, pcb->cached_pages_size);
+  pcb->cached_pages_base  = (ikptr)(long)base;
+  pcb->cached_pages_size  = capacity * sizeof(ikpage);
+  pcb->cached_pages_limit = limit;
+  return 0;
+}
+
 
 ikptr
 ik_mmap (ik_ulong size)
 {
   ik_ulong pages   = (size + IK_PAGESIZE - 1) / IK_PAGESIZE;
   ik_ulong mapsize = pages * IK_PAGESIZE;
-  total_allocated_pages += pages;
+  __sync_fetch_and_add(&total_allocated_pages, pages);
   // fprintf(stderr,
   //   "size=%lu, pages=%lu, mapsize=%lu, size/PGSIZE=%lu, mapsize/PGSIZE=%lu\n",
   //   size, pages, mapsize, size/IK_PAGESIZE, mapsize/IK_PAGESIZE);
@@ -191,6 +436,33 @@ ik_mmap (ik_ulong size)
 #endif
   return (ikptr)(long)mem;
 }
+ikptr
+ik_mmap_file (int fd, long offset, ik_ulong size, ikpcb* pcb)
+/* Map SIZE bytes of the file FD, starting at OFFSET, as private writable
+   memory and register  them in the tables of PCB;  the caller sets the
+   segment types.  The pages are released with "ik_munmap()". */
+{
+  assert(size == IK_ALIGN_TO_NEXT_PAGE(size));
+#ifndef __CYGWIN__
+  char* mem = mmap(0, size, PROT_READ|PROT_WRITE|PROT_EXEC, MAP_PRIVATE, fd, (off_t)offset);
+  if (mem == MAP_FAILED)
+    ik_abort("mapping (0x%lx bytes) of file failed: %s", size, strerror(errno));
+#else
+  char* mem = NULL;
+  ik_abort("mapping files is not supported on this platform");
+#endif
+  __sync_fetch_and_add(&total_allocated_pages, size / IK_PAGESIZE);
+  extend_table_maybe((ikptr)(long)mem, size, pcb);
+  return (ikptr)(long)mem;
+}
+long
+ik_heap_bytes (ikpcb* pcb)
+/* Return the number of bytes in the pages  registered in the segment vector
+   of PCB, excluding holes: the pages in use by its heap.  The cached pages
+   and the pages of other isolates are holes for PCB. */
+{
+  return pcb->heap_pages_count * IK_PAGESIZE;
+}
 void
 ik_munmap (ikptr mem, ik_ulong size)
 {
@@ -198,7 +470,7 @@ ik_munmap (ikptr mem, ik_ulong size)
   ik_ulong mapsize = pages * IK_PAGESIZE;
   assert(size == mapsize);
   assert(((-IK_PAGESIZE) & (int)mem) == (int)mem);
-  total_allocated_pages -= pages;
+  __sync_fetch_and_sub(&total_allocated_pages, pages);
 #ifndef __CYGWIN__
   int err = munmap((char*)mem, mapsize);
   if (err)
@@ -218,22 +490,33 @@ ik_malloc (int size)
   void* x = malloc(size);
   if (NULL == x)
     ik_abort("malloc failed: %s", strerror(errno));
-  total_malloced += size;
+  __sync_fetch_and_add(&total_malloced, size);
   return x;
 }
 void
 ik_free (void* x, int size)
 {
-  total_malloced -= size;
+  __sync_fetch_and_sub(&total_malloced, size);
   free(x);
 }
 
 
 ikpcb*
-ik_make_pcb (void)
+ik_make_pcb (const ik_runtime_options_t * options)
+/* Build and return a new PCB.  OPTIONS can be NULL to select the defaults;
+   they are set first, so that the heap and the stack are allocated
+   accordingly. */
 {
   ikpcb * pcb = ik_malloc(sizeof(ikpcb));
   bzero(pcb, sizeof(ikpcb));
+  if (options) {
+    pcb->sweep_threads	= options->sweep_threads;
+    pcb->huge_pages	= options->huge_pages;
+    pcb->fasl_load_threads	= options->fasl_load_threads;
+  }
+#ifdef HAVE_PTHREAD
+  pthread_mutex_init(&(pcb->alloc_mutex), NULL);
+#endif
 
   /* The  Scheme heap  grows from  low memory  addresses to  high memory
    * addresses:
@@ -250,10 +533,30 @@ ik_make_pcb (void)
    * installed   as  Scheme   heap.   See   for  example   the  function
    * "ik_unsafe_alloc()". */
   {
-    pcb->heap_base          = ik_mmap(IK_HEAPSIZE);
+    pcb->heap_base          = (pcb->huge_pages)? ik_mmap_from_huge_region(IK_HEAPSIZE, pcb) : ik_mmap(IK_HEAPSIZE);
     pcb->heap_size          = IK_HEAPSIZE;
     pcb->allocation_pointer = pcb->heap_base;
     pcb->allocation_redline = pcb->heap_base + IK_HEAPSIZE - 2 * IK_CHUNK_SIZE;
+    pcb->heap_redline       = pcb->allocation_redline;
+  }
+
+  /* Default  thresholds  for the  adaptive  generation  selection policy;
+     they are scaled at run time by the survival rates, see the function
+     "collection_gen_adaptive()". */
+  {
+    pcb->collect_policy    = IK_GC_POLICY_FIXED;
+    pcb->gen_threshold[1]  =  1 * IK_HEAPSIZE;
+    pcb->gen_threshold[2]  =  2 * IK_HEAPSIZE;
+    pcb->gen_threshold[3]  =  4 * IK_HEAPSIZE;
+    pcb->gen_threshold[4]  =  8 * IK_HEAPSIZE;
+  }
+
+  /* The nursery has  the default size; it is adapted to  the time spent
+     collecting only when a target is set. */
+  {
+    pcb->nursery_size		= IK_HEAPSIZE;
+    pcb->collect_time_target	= 0;
+    gettimeofday(&(pcb->collect_last_end), NULL);
   }
 
   /* The Scheme  stack grows  from high memory  addresses to  low memory
@@ -355,25 +658,18 @@ ik_make_pcb (void)
    *    Is a pointer to the first byte in the array.
    *
    * cached_pages_size -
-   *    Is the number of bytes allocated to the array.
+   *    Is the number of bytes allocated to the array; the array holds
+   *    twice "cached_pages_limit" structs, at least "CACHE_SIZE".
    *
    * uncached_pages -
    *    Is a pointer to the first free "ikpage" struct.
+   *
+   * cached_pages_limit -
+   *    Is the  number of cached pages left  resident after a collection;
+   *    by default the size of the initial nursery.
    */
-  {
-    ikpage *	cur;
-    ikpage *	past;
-    ikpage *	prev = NULL;
-    cur = (ikpage*)(long)ik_mmap(CACHE_SIZE * sizeof(ikpage));
-    pcb->cached_pages_base = (ikptr)(long)cur;
-    pcb->cached_pages_size = CACHE_SIZE * sizeof(ikpage);
-    past = cur + CACHE_SIZE;
-    for (; cur < past; ++cur) {
-      cur->next = prev;
-      prev = cur;
-    }
-    pcb->uncached_pages = prev;
-  }
+  pcb->cached_pages_limit = IK_HEAPSIZE / IK_PAGESIZE;
+  ik_resize_page_cache(pcb, pcb->cached_pages_limit);
 
   /* Allocate and initialise the dirty vector and the segment vector.
    *
@@ -481,14 +777,12 @@ ik_make_pcb (void)
     hi_seg   = SEGMENT_INDEX(hi_mem+SEGMENT_SIZE-1);
     vec_size = (hi_seg - lo_seg) * IK_PAGESIZE;
     {
-      ikptr	dvec = ik_mmap(vec_size);
-      bzero((char*)(long)dvec, vec_size);
+      ikptr	dvec = table_mmap(vec_size);
       pcb->dirty_vector_base   = (unsigned*)(long)dvec;
       pcb->dirty_vector        = (dvec - lo_seg * IK_PAGESIZE);
     }
     {
-      ikptr	svec = ik_mmap(vec_size);
-      bzero((char*)(long)svec, vec_size);
+      ikptr	svec = table_mmap(vec_size);
       pcb->segment_vector_base = (unsigned*)(long)svec;
       pcb->segment_vector      = (unsigned*)(long)(svec - lo_seg * IK_PAGESIZE);
     }
@@ -516,6 +810,8 @@ ik_make_pcb (void)
 #endif
   }
 
+  pcb->ephemeron_tables = IK_NULL_OBJECT;
+
   /* Initialize base structure type descriptor  (STD).  This is the type
      descriptor of all the struct type descriptors; it describes itself.
      See   the  Texinfo   documentation  node   "objects  structs"   for
@@ -535,7 +831,6 @@ ik_make_pcb (void)
   /* Initialise miscellaneous fields. */
   {
     pcb->collect_key         = IK_FALSE_OBJECT;
-    pcb->not_to_be_collected = NULL;
   }
   return pcb;
 }
@@ -552,6 +847,19 @@ ik_delete_pcb (ikpcb* pcb)
     p = p->next;
   }
   ik_munmap(pcb->cached_pages_base, pcb->cached_pages_size);
+  if (pcb->alloc_samples)
+    ik_free(pcb->alloc_samples, IK_ALLOC_SAMPLES_COUNT * sizeof(ik_alloc_sample));
+  { /* Release the garbage collection avoidance registry. */
+    ik_gc_avoidance_collection_t *	C = pcb->not_to_be_collected.collections;
+    while (C) {
+      ik_gc_avoidance_collection_t *	next = C->next;
+      free(C);
+      C = next;
+    }
+    free(pcb->not_to_be_collected.live);
+  }
+  if (pcb->huge_pages_ap < pcb->huge_pages_ep)
+    ik_munmap(pcb->huge_pages_ap, pcb->huge_pages_ep - pcb->huge_pages_ap);
   {
     int i;
     for(i=0; i<generation_count; i++) {
@@ -563,6 +871,26 @@ ik_delete_pcb (ikpcb* pcb)
       }
     }
   }
+  free(pcb->root_stack);
+#ifdef HAVE_PTHREAD
+  pthread_mutex_destroy(&(pcb->alloc_mutex));
+#endif
+  {
+    ik_ptr_page* p = pcb->guardians_pending;
+    while (p) {
+      ik_ptr_page* next = p->next;
+      ik_munmap((ikptr)(long)p, IK_PAGESIZE);
+      p = next;
+    }
+  }
+  {
+    ik_ptr_page* p = pcb->ptr_pages_cache;
+    while (p) {
+      ik_ptr_page* next = p->next;
+      ik_munmap((ikptr)(long)p, IK_PAGESIZE);
+      p = next;
+    }
+  }
   ikptr     base        = pcb->memory_base;
   ikptr     end         = pcb->memory_end;
   unsigned* segment_vec = pcb->segment_vector;
@@ -575,8 +903,8 @@ ik_delete_pcb (ikpcb* pcb)
     }
   }
   long vecsize = (SEGMENT_INDEX(end) - SEGMENT_INDEX(base)) * IK_PAGESIZE;
-  ik_munmap((ikptr)(long)pcb->dirty_vector_base, vecsize);
-  ik_munmap((ikptr)(long)pcb->segment_vector_base, vecsize);
+  table_munmap((ikptr)(long)pcb->dirty_vector_base, vecsize);
+  table_munmap((ikptr)(long)pcb->segment_vector_base, vecsize);
   ik_free(pcb, sizeof(ikpcb));
 }
 
@@ -604,6 +932,10 @@ ik_safe_alloc (ikpcb * pcb, ik_ulong size)
     /* There is  room in the  current heap  segment: update the  PCB and
        return the offset. */
     pcb->allocation_pointer = new_alloc_ptr;
+    /* If the  allocation profiler is enabled  and a sampling point has
+       been crossed: record the allocation. */
+    if (new_alloc_ptr > pcb->allocation_redline)
+      ik_alloc_sample_record(pcb);
   } else {
     /* No room in the current heap block: run GC. */
     ik_collect(size, pcb);
@@ -643,11 +975,15 @@ ik_unsafe_alloc (ikpcb * pcb, ik_ulong requested_size)
      return the offset. */
   if (new_alloc_ptr < end_ptr) {
     pcb->allocation_pointer = new_alloc_ptr;
+    if (new_alloc_ptr > pcb->allocation_redline)
+      ik_alloc_sample_record(pcb);
 /* write(2, "_", 1); */
     return alloc_ptr;
   } else {
     /* No room in the current heap block: enlarge the heap by allocating
-       a new segment. */
+       a new segment.  The bytes allocated since the last sample of the
+       allocation profiler are carried over to the new segment. */
+    long	carried = (alloc_ptr)? (long)(alloc_ptr - pcb->alloc_sample_base) : 0;
     if (alloc_ptr) {
       /* This is not the first heap segment allocation, so prepend a new
 	 "ikpages"  node to  the linked  list of  old heap  segments and
@@ -688,14 +1024,89 @@ ik_unsafe_alloc (ikpcb * pcb, ik_ulong requested_size)
       heap_ptr			= ik_mmap_mixed(new_size, pcb);
       pcb->heap_base		= heap_ptr;
       pcb->heap_size		= new_size;
-      pcb->allocation_redline	= heap_ptr + new_size - 2 * IK_CHUNK_SIZE;
+      pcb->heap_redline		= heap_ptr + new_size - 2 * IK_CHUNK_SIZE;
       pcb->allocation_pointer	= heap_ptr + requested_size;
+      ik_alloc_sample_carry(pcb, heap_ptr, carried);
 /* write(2, " H ", 3); */
       return heap_ptr;
     }
   }
 }
 
+
+void
+ik_alloc_lock (ikpcb * pcb)
+/* Acquire the allocation lock of PCB.  The thread running PCB allocates
+   without it, so  other threads may allocate through  PCB, while holding
+   it,  only when the  thread running  PCB waits for  them without running
+   Scheme code. */
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_lock(&(pcb->alloc_mutex));
+#endif
+}
+void
+ik_alloc_unlock (ikpcb * pcb)
+{
+#ifdef HAVE_PTHREAD
+  pthread_mutex_unlock(&(pcb->alloc_mutex));
+#endif
+}
+void
+ik_alloc_buffer_register (ikpcb * pcb, ik_alloc_buffer * buf)
+/* Register  BUF in  PCB  as  an empty  allocation buffer.   From now on:
+   every garbage collection empties BUF, because the nursery is reused. */
+{
+  buf->ap	= 0;
+  buf->ep	= 0;
+  buf->refills	= 0;
+  ik_alloc_lock(pcb);
+  buf->next	= pcb->alloc_buffers;
+  pcb->alloc_buffers = buf;
+  ik_alloc_unlock(pcb);
+}
+void
+ik_alloc_buffer_unregister (ikpcb * pcb, ik_alloc_buffer * buf)
+/* Remove BUF  from the  allocation buffers  registered in PCB;  the unused
+   part of its block is left to the garbage collector. */
+{
+  ik_alloc_buffer **	link;
+  ik_alloc_lock(pcb);
+  for (link = &(pcb->alloc_buffers); *link; link = &((*link)->next)) {
+    if (buf == *link) {
+      *link = buf->next;
+      break;
+    }
+  }
+  ik_alloc_unlock(pcb);
+  buf->ap = 0;
+  buf->ep = 0;
+}
+ikptr
+ik_alloc_buffer_refill (ikpcb * pcb, ik_alloc_buffer * buf, ik_ulong size)
+/* Slow path of  "ik_buffer_alloc()": reserve a new block  of the nursery
+   for BUF and allocate SIZE bytes from it; return an *untagged* pointer.
+   The unused part of the old block  is abandoned.  The block is reserved
+   with  "ik_unsafe_alloc()" while holding  the allocation lock,  so this
+   function never  runs a garbage collection  and it can be  called by a
+   thread other than the one running PCB, see "ik_alloc_lock()". */
+{
+  ikptr	mem;
+  assert(size == IK_ALIGN(size));
+  ik_alloc_lock(pcb);
+  if (size >= IK_ALLOC_BUFFER_SIZE / 4) {
+    /* Do not waste the rest of the block for a big object. */
+    mem = ik_unsafe_alloc(pcb, size);
+  } else {
+    mem		= ik_unsafe_alloc(pcb, IK_ALLOC_BUFFER_SIZE);
+    buf->ap	= mem + size;
+    buf->ep	= mem + IK_ALLOC_BUFFER_SIZE;
+    ++(buf->refills);
+  }
+  ik_alloc_unlock(pcb);
+  return mem;
+}
+
 
 void
 ik_debug_message (const char * error_message, ...)
@@ -1062,6 +1473,50 @@ ikrt_set_code_annotation (ikptr s_code, ikptr s_annot, ikpcb* pcb)
   return IK_VOID;
 }
 
+
+/** --------------------------------------------------------------------
+ ** Stack of garbage collector roots.
+ ** ----------------------------------------------------------------- */
+
+void
+ik_push_root (ikpcb* pcb, ikptr * root)
+/* Push  on the root stack  the location ROOT holding  a reference the
+   garbage collector must not collect, and must update when moving the
+   referenced object. */
+{
+  if (pcb->root_stack_count == pcb->root_stack_size) {
+    long	size = (pcb->root_stack_size)? (2 * pcb->root_stack_size) : 64;
+    ikptr **	stack = realloc(pcb->root_stack, size * sizeof(ikptr *));
+    if (NULL == stack)
+      ik_abort("not enough memory to enlarge the garbage collector root stack");
+    pcb->root_stack	 = stack;
+    pcb->root_stack_size = size;
+  }
+  pcb->root_stack[pcb->root_stack_count++] = root;
+}
+void
+ik_pop_roots (ikpcb* pcb, long count)
+/* Pop COUNT locations from the root stack. */
+{
+  assert(count <= pcb->root_stack_count);
+  pcb->root_stack_count -= count;
+}
+long
+ik_root_stack_mark (ikpcb* pcb)
+/* Return the number of locations  in the root stack, to be handed later
+   to "ik_root_stack_restore()". */
+{
+  return pcb->root_stack_count;
+}
+void
+ik_root_stack_restore (ikpcb* pcb, long mark)
+/* Pop the  locations pushed  on the root  stack after  the call to
+   "ik_root_stack_mark()" that returned MARK. */
+{
+  assert(mark <= pcb->root_stack_count);
+  pcb->root_stack_count = mark;
+}
+
 
 /** --------------------------------------------------------------------
  ** Guardians handling.
@@ -1072,6 +1527,34 @@ ikrt_set_code_annotation (ikptr s_code, ikptr s_annot, ikpcb* pcb)
    referenced  by  "pcb->protected_list[IK_GUARDIANS_GENERATION_NUMBER].
    */
 
+ik_ptr_page *
+ik_ptr_page_alloc (ikpcb* pcb)
+/* Return an empty "ik_ptr_page" node, reusing a cached one if possible. */
+{
+  ik_ptr_page *	page = pcb->ptr_pages_cache;
+  if (page) {
+    pcb->ptr_pages_cache = page->next;
+    --pcb->ptr_pages_cached;
+  } else {
+    assert(sizeof(ik_ptr_page) == IK_PAGESIZE);
+    page = (ik_ptr_page*)(long)ik_mmap(IK_PAGESIZE);
+  }
+  page->count = 0;
+  page->next  = NULL;
+  return page;
+}
+void
+ik_ptr_page_release (ikpcb* pcb, ik_ptr_page * page)
+/* Push the unused PAGE node on the cache of PCB, or unmap it if the cache
+   is full. */
+{
+  if (pcb->ptr_pages_cached < IK_PTR_PAGES_CACHE_MAX) {
+    page->next           = pcb->ptr_pages_cache;
+    pcb->ptr_pages_cache = page;
+    ++pcb->ptr_pages_cached;
+  } else
+    ik_munmap((ikptr)(long)page, IK_PAGESIZE);
+}
 ikptr
 ikrt_register_guardian_pair (ikptr p0, ikpcb* pcb)
 /* Register a guardian  pair in the protected list of  PCB.  If there is
@@ -1084,10 +1567,8 @@ ikrt_register_guardian_pair (ikptr p0, ikpcb* pcb)
   ik_ptr_page *	first;
   first = pcb->protected_list[IK_GUARDIANS_GENERATION_NUMBER];
   if ((NULL == first) || (IK_PTR_PAGE_SIZE == first->count)) {
-    assert(sizeof(ik_ptr_page) == IK_PAGESIZE);
     ik_ptr_page *	new_node;
-    new_node        = (ik_ptr_page*)(long)ik_mmap(IK_PAGESIZE);
-    new_node->count = 0;
+    new_node        = ik_ptr_page_alloc(pcb);
     new_node->next  = first;
     first           = new_node;
     pcb->protected_list[IK_GUARDIANS_GENERATION_NUMBER] = new_node;
@@ -1096,6 +1577,42 @@ ikrt_register_guardian_pair (ikptr p0, ikpcb* pcb)
   return IK_VOID_OBJECT;
 }
 ikptr
+ikrt_deliver_guardians (ikptr s_max, ikpcb* pcb)
+/* Append  to their tconcs  the guardian pairs  found dead by  the last
+   collections: at most the fixnum S_MAX pairs, or all of them if S_MAX
+   is false.  Return true if pairs are still pending, else false.  This
+   function does not allocate. */
+{
+  long		max	  = (IK_FALSE_OBJECT == s_max)? -1 : IK_UNFIX(s_max);
+  unsigned *	dirty_vec = (unsigned *)(long)pcb->dirty_vector;
+  ik_ptr_page *	ls	  = pcb->guardians_pending;
+  while (ls && max) {
+    while (ls->count && max) {
+      ikptr	p	  = ls->ptr[--ls->count];
+      ikptr	tc	  = IK_REF(p, off_car);
+      ikptr	obj	  = IK_REF(p, off_cdr);
+      ikptr	last_pair = IK_REF(tc, off_cdr);
+      /* P becomes the new last pair of the tconc. */
+      IK_REF(last_pair, off_car) = obj;
+      IK_REF(last_pair, off_cdr) = p;
+      IK_REF(p, off_car)	 = IK_FALSE_OBJECT;
+      IK_REF(p, off_cdr)	 = IK_FALSE_OBJECT;
+      IK_REF(tc, off_cdr)	 = p;
+      dirty_vec[IK_PAGE_INDEX(tc)]	  = (unsigned)-1;
+      dirty_vec[IK_PAGE_INDEX(last_pair)] = (unsigned)-1;
+      if (0 < max)
+	--max;
+    }
+    if (0 == ls->count) {
+      ik_ptr_page *	next = ls->next;
+      ik_ptr_page_release(pcb, ls);
+      ls = next;
+    }
+  }
+  pcb->guardians_pending = ls;
+  return (ls)? IK_TRUE_OBJECT : IK_FALSE_OBJECT;
+}
+ikptr
 ikrt_register_guardian (ikptr tc, ikptr obj, ikpcb* pcb)
 {
   ikptr p0   = IKU_PAIR_ALLOC(pcb);
@@ -1135,6 +1652,8 @@ ikrt_stats_now (ikptr t, ikpcb* pcb)
   }
   /* major bytes */
   IK_FIELD(t, 14) = IK_FIX(pcb->allocation_count_major);
+  /* nursery size */
+  IK_FIELD(t, 15) = IK_FIX(pcb->nursery_size);
   return IK_VOID_OBJECT;
 }
 
@@ -1177,7 +1696,12 @@ ikptr
 ikrt_exit (ikptr status, ikpcb* pcb)
 /* This is not for the public API. */
 {
+  /* Does not return if PCB is not the main isolate. */
+  ik_isolate_exit(pcb, IK_IS_FIXNUM(status)? IK_UNFIX(status) : EXIT_FAILURE);
   ik_delete_pcb(pcb);
+  /* The pages of the isolates still running are not released. */
+  if (ik_isolates_running())
+    exit(IK_IS_FIXNUM(status)? IK_UNFIX(status) : EXIT_FAILURE);
   if (total_allocated_pages)
     ik_debug_message("allocated pages: %d", total_allocated_pages);
   assert(0 == total_allocated_pages);
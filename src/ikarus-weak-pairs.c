@@ -17,19 +17,21 @@
 
 #include "internals.h"
 
-ikptr
-ikrt_weak_cons (ikptr a, ikptr d, ikpcb* pcb)
+static ikptr
+weak_pair_alloc (ikptr a, ikptr d, ikptr * ap_p, ikptr * ep_p, unsigned type, ikpcb* pcb)
+/* Allocate  a pair  holding A  and D  in the  pages of  TYPE whose free
+   space is delimited by the pointers referenced by AP_P and EP_P. */
 {
-  ikptr ap  = pcb->weak_pairs_ap;
+  ikptr ap  = *ap_p;
   ikptr nap = ap + pair_size;
   ikptr p;
-  if (nap > pcb->weak_pairs_ep) {
-    ikptr mem = ik_mmap_typed(IK_PAGESIZE, weak_pairs_mt, pcb);
-    pcb->weak_pairs_ap = mem + pair_size;
-    pcb->weak_pairs_ep = mem + IK_PAGESIZE;
+  if (nap > *ep_p) {
+    ikptr mem = ik_mmap_typed(IK_PAGESIZE, type, pcb);
+    *ap_p = mem + pair_size;
+    *ep_p = mem + IK_PAGESIZE;
     p = mem | pair_tag;
   } else {
-    pcb->weak_pairs_ap = nap;
+    *ap_p = nap;
     p = ap | pair_tag;
   }
   IK_CAR(p) = a;
@@ -37,13 +39,53 @@ ikrt_weak_cons (ikptr a, ikptr d, ikpcb* pcb)
   return p;
 }
 ikptr
+ikrt_weak_cons (ikptr a, ikptr d, ikpcb* pcb)
+{
+  return weak_pair_alloc(a, d, &(pcb->weak_pairs_ap), &(pcb->weak_pairs_ep), weak_pairs_mt, pcb);
+}
+ikptr
+ikrt_ephemeron_cons (ikptr a, ikptr d, ikpcb* pcb)
+/* Build an ephemeron:  a pair holding a weak reference  to A and a
+   reference to D which the garbage collector follows only if A is
+   reachable by other means. */
+{
+  return weak_pair_alloc(a, d, &(pcb->ephemerons_ap), &(pcb->ephemerons_ep), ephemerons_mt, pcb);
+}
+ikptr
+ikrt_register_ephemeron_table (ikptr s_node, ikpcb* pcb)
+/* Register  a weak table  whose buckets vector is  referenced by the car
+   of the weak pair  S_NODE.  Every slot  of the vector but the last holds
+   a list of ephemerons whose cdr is a pair holding the value and the
+   index of the slot; the last slot holds the  number of entries as a
+   fixnum.  After  every collection  breaking ephemerons, the  collector
+   unlinks the ephemerons whose car is BWP from the slots at the indexes
+   they hold and updates the number  of entries.  S_NODE is  freshly allocated,  so no  dirty bit is
+   needed. */
+{
+  IK_CDR(s_node)	= pcb->ephemeron_tables;
+  pcb->ephemeron_tables	= s_node;
+  return IK_VOID_OBJECT;
+}
+ikptr
 ikrt_is_weak_pair (ikptr x, ikpcb* pcb)
 {
   if (IK_TAGOF(x) != pair_tag)
     return IK_FALSE_OBJECT;
   else {
     unsigned t = pcb->segment_vector[IK_PAGE_INDEX(x)];
-    return ((t & type_mask) == weak_pairs_type)? IK_TRUE_OBJECT : IK_FALSE_OBJECT;
+    return (((t & type_mask) == weak_pairs_type) && (0 == (t & ephemerons_page_mask)))?
+      IK_TRUE_OBJECT : IK_FALSE_OBJECT;
+  }
+}
+ikptr
+ikrt_is_ephemeron (ikptr x, ikpcb* pcb)
+{
+  if (IK_TAGOF(x) != pair_tag)
+    return IK_FALSE_OBJECT;
+  else {
+    unsigned t = pcb->segment_vector[IK_PAGE_INDEX(x)];
+    return (((t & type_mask) == weak_pairs_type) && (t & ephemerons_page_mask))?
+      IK_TRUE_OBJECT : IK_FALSE_OBJECT;
   }
 }
 
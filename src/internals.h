@@ -88,6 +88,9 @@
 #endif
 
 #include <vicare-platform.h>
+#ifdef HAVE_PTHREAD
+#  include <pthread.h>
+#endif
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -161,6 +164,8 @@
 #define scannable_mask		0x0000F000
 #define dealloc_mask		0x000F0000
 #define large_object_mask	0x00100000
+#define pairs_page_mask		0x00200000
+#define ephemerons_page_mask	0x00400000
 #define meta_dirty_shift	4
 
 #define hole_type		0x00000000
@@ -180,6 +185,11 @@
 #define retain_tag		0x00000000
 
 #define large_object_tag	0x00100000
+/* Pointers pages holding only pairs. */
+#define pairs_page_tag		0x00200000
+/* Weak pairs pages holding  only ephemerons: pairs whose cdr is retained
+   only as long as their car is reachable. */
+#define ephemerons_page_tag	0x00400000
 
 #define hole_mt		(hole_type	 | unscannable_tag | retain_tag)
 #define mainheap_mt	(mainheap_type	 | unscannable_tag | retain_tag)
@@ -189,6 +199,7 @@
 #define data_mt		(dat_type	 | unscannable_tag | dealloc_tag_un)
 #define code_mt		(code_type	 | scannable_tag   | dealloc_tag_un)
 #define weak_pairs_mt	(weak_pairs_type | scannable_tag   | dealloc_tag_un)
+#define ephemerons_mt	(weak_pairs_mt | ephemerons_page_tag)
 
 /*
  * When compiling Scheme code to  executable machine code: to generate a
@@ -269,15 +280,70 @@
 
 #define generation_count	5  /* generations 0 (nursery), 1, 2, 3, 4 */
 
+/* Pages sealed by "ikrt_gc_seal_static_generation()" are tagged with this
+   generation number:  being older than any collected generation,  the
+   objects in them are never moved nor released, so after a "fork()" the
+   pages stay shared  with the parent process unless  the program itself
+   mutates them. */
+#define IK_STATIC_GENERATION	generation_count
+
+/* Maximum number of threads the garbage collector can use to sweep the
+   page tables; see the command line option "--gc-sweep-threads". */
+#define IK_GC_MAX_THREADS	64
+
+/* Maximum number of threads decoding the sections of an indexed boot
+   image; see the command line option "--fasl-load-threads". */
+#define IK_FASL_MAX_THREADS	64
+
+/* Maximum  number of  unused  "ik_ptr_page" nodes kept  in the cache of
+   the PCB; further released nodes are unmapped. */
+#define IK_PTR_PAGES_CACHE_MAX	64
+
+/* Maximum number  of consecutive times the collection of  a generation can
+   be postponed because its expected pause exceeds the pause target. */
+#define IK_GC_MAX_DEFERRALS	8
+
+/* Number of garbage collection event records kept in the PCB. */
+#define IK_GC_EVENTS_COUNT	256
+
+/* Maximum  number of  stack frames recorded  by a sample  of the allocation
+   profiler, and  number of samples  buffered  in the  PCB until they  are
+   drained by "gc-allocation-profile". */
+#define IK_ALLOC_SAMPLE_DEPTH	16
+#define IK_ALLOC_SAMPLES_COUNT	4096
+
+/* Size and alignment of the regions from which heap segments are allocated
+   when transparent huge pages are enabled; see the command line option
+   "--gc-huge-pages". */
+#define IK_HUGE_PAGE_SIZE	(2 * 1024 * 1024)
+
+/* Generation selection policies for "ik_collect()". */
+#define IK_GC_POLICY_FIXED	0
+#define IK_GC_POLICY_ADAPTIVE	1
+
 #define IK_HEAP_EXT_SIZE	(32 * IK_CHUNK_SIZE)
 #define IK_HEAPSIZE		(1024 * IK_CHUNK_SIZE * ((wordsize==4)?1:2)) /* 4/8 MB */
 
+/* Bounds for the  size of the nursery when it is adapted to the time spent
+   collecting; see the field "nursery_size" of the PCB. */
+#define IK_NURSERY_MIN_SIZE	IK_HEAPSIZE
+#define IK_NURSERY_MAX_SIZE	(8 * IK_HEAPSIZE)
+
+/* Upper bound  for the number of  cached pages left  resident after a
+   collection: 1 GiB. */
+#define IK_PAGE_CACHE_MAX_LIMIT	((1L << 30) / IK_PAGESIZE)
+
 #define IK_STACKSIZE		(1024 * IK_CHUNK_SIZE)
 /* #define IK_STACKSIZE		(256 * IK_CHUNK_SIZE) */
 
 #define IK_FASL_HEADER		((sizeof(ikptr) == 4)? "#@IK01" : "#@IK02")
 #define IK_FASL_HEADER_LEN	(strlen(IK_FASL_HEADER))
 
+/* Header of an indexed boot image: a table of the lengths of its sections,
+   every one a FASL object starting with IK_FASL_HEADER. */
+#define IK_FASL_INDEX_HEADER		"#@IKIX"
+#define IK_FASL_INDEX_HEADER_LEN	6
+
 #define IK_PTR_PAGE_SIZE \
   ((IK_PAGESIZE - sizeof(long) - sizeof(struct ik_ptr_page*))/sizeof(ikptr))
 
@@ -304,6 +370,17 @@
 #define IK_ASS(LEFT,RIGHT)	\
   { ikptr s_tmp = (RIGHT); (LEFT) = s_tmp; }
 
+/* Register the location VAR as  root for the garbage collector, so that
+   the value it holds is not collected and its references are updated;
+   undo it with "ik_pop_roots()".  Between IK_BEGIN_ROOTS and IK_END_ROOTS
+   the roots pushed are popped at the end of the block; do not leave the
+   block with "return" or "goto". */
+#define IK_PUSH_ROOT(PCB,VAR)	ik_push_root((PCB), &(VAR))
+#define IK_BEGIN_ROOTS(PCB)	\
+  { long ik_root_stack_mark_ = ik_root_stack_mark(PCB);
+#define IK_END_ROOTS(PCB)	\
+  ik_root_stack_restore((PCB), ik_root_stack_mark_); }
+
 
 /** --------------------------------------------------------------------
  ** Type definitions.
@@ -334,6 +411,41 @@ typedef struct ikpages {
   struct ikpages* next;
 } ikpages;
 
+/* Record describing a garbage collection;  the last IK_GC_EVENTS_COUNT
+   records are kept in the PCB, see the function "ikrt_gc_event()". */
+typedef struct ik_gc_event {
+  long		collection_id;
+  int		generation;
+  /* Real time spent collecting, in microseconds. */
+  long		pause;
+  /* Number of bytes in the pages used by the heap of the PCB before and
+     after collecting. */
+  long		heap_before;
+  long		heap_after;
+  /* Number of  bytes scanned: the size of the  dirty pages scanned plus
+     the size of the objects moved into the target generation. */
+  long		bytes_scanned;
+  long		dirty_pages;
+  /* Number of guardian pairs inspected. */
+  long		guardians;
+  /* Number of bytes moved into the target generation, by type of page. */
+  long		copied_pairs;
+  long		copied_symbols;
+  long		copied_pointers;
+  long		copied_data;
+  long		copied_code;
+  long		copied_weak_pairs;
+} ik_gc_event;
+
+/* Sample recorded  by the allocation profiler:  the number of bytes it
+   accounts for and the code objects of the innermost DEPTH stack frames
+   of the allocating code, innermost first.  See "ik_alloc_sample_record()". */
+typedef struct ik_alloc_sample {
+  long		bytes;
+  int		depth;
+  ikptr		code[IK_ALLOC_SAMPLE_DEPTH];
+} ik_alloc_sample;
+
 /* Node in  a linked list  referencing all the generated  FFI callbacks.
    It is used  to allow the garbage collector not  to collect data still
    in  use by  the callbacks.	See "ikarus-ffi.c"  for details	 on this
@@ -352,6 +464,86 @@ typedef struct ik_ptr_page {
   ikptr		ptr[IK_PTR_PAGE_SIZE];
 } ik_ptr_page;
 
+/* The garbage  collection avoidance registry holds  references to "ikptr"
+   values not to be  garbage collected, because they are referenced by
+   data structures managed by foreign C language libraries.
+
+   Every value is stored in a slot; the address of the slot is handed to
+   the caller as a  pointer object and  it  never changes, so slots are
+   allocated in  chunks that are never  released.  The first word of a
+   slot holds the value, or IK_VOID if the slot is free.
+
+   The free slots are linked in a free list; the used slots are referenced
+   by the dense array "live", and every used slot holds its index in such
+   array.  So registering and forgetting  a value are O(1) operations and
+   the garbage collector scans only the used slots. */
+
+#define IK_GC_AVOIDANCE_ARRAY_LEN	((4096/(3 * sizeof(void *))) - 1)
+
+typedef struct ik_gc_avoidance_slot_t		ik_gc_avoidance_slot_t;
+struct ik_gc_avoidance_slot_t {
+  /* The registered value or IK_VOID.  It must be the first field. */
+  ikptr				obj;
+  /* Registration  serial number,  used to list  the values in  the order
+     of registration. */
+  long				serial;
+  union {
+    /* Index of this slot in the array of used slots. */
+    long			index;
+    /* Next slot in the free list. */
+    ik_gc_avoidance_slot_t *	next_free;
+  } u;
+};
+
+typedef struct ik_gc_avoidance_collection_t	ik_gc_avoidance_collection_t;
+struct ik_gc_avoidance_collection_t {
+  /* NULL or  a pointer to  the next struct of  this type in  the linked
+     list. */
+  ik_gc_avoidance_collection_t *	next;
+  ik_gc_avoidance_slot_t		slots[IK_GC_AVOIDANCE_ARRAY_LEN];
+};
+
+typedef struct ik_gc_avoidance_registry_t {
+  /* Linked list of allocated chunks of slots. */
+  ik_gc_avoidance_collection_t *	collections;
+  /* First slot in the free list. */
+  ik_gc_avoidance_slot_t *		free_slots;
+  /* Malloc'ed array of "live_size" pointers  to slots; the first
+     "live_count" reference the used slots. */
+  ik_gc_avoidance_slot_t **		live;
+  long					live_count;
+  long					live_size;
+  /* Serial number of the next registration. */
+  long					next_serial;
+} ik_gc_avoidance_registry_t;
+
+/* An allocation buffer is a block of the nursery reserved to a single
+   execution context, from  which it allocates by bumping  "ap" without
+   touching the PCB; when the block  is exhausted it is refilled by
+   "ik_alloc_buffer_refill()".  A collection empties all the registered
+   buffers. */
+/* Size of the block reserved by a refill; bigger requests are served
+   by "ik_unsafe_alloc()" directly. */
+#define IK_ALLOC_BUFFER_SIZE	(4 * IK_PAGESIZE)
+
+typedef struct ik_alloc_buffer {
+  /* Next free byte and end of the reserved block; both zero when empty. */
+  ikptr				ap;
+  ikptr				ep;
+  /* Number of refills since registration. */
+  long				refills;
+  /* Next buffer registered in the PCB. */
+  struct ik_alloc_buffer *	next;
+} ik_alloc_buffer;
+
+/* Options  of the runtime system selected  on the command line; they are
+   applied by "ik_make_pcb()" before any memory is allocated for the PCB. */
+typedef struct ik_runtime_options_t {
+  int		sweep_threads;
+  int		huge_pages;
+  int		fasl_load_threads;
+} ik_runtime_options_t;
+
 /* For  more  documentation  on  the PCB  structure:  see  the  function
    "ik_make_pcb()". */
 typedef struct ikpcb {
@@ -388,6 +580,22 @@ typedef struct ikpcb {
   ikptr*		root8;
   ikptr*		root9;
 
+  /* Stack  of additional roots for  the garbage collector, managed with
+     "ik_push_root()" and  "ik_pop_roots()": "root_stack_size" pointers to
+     locations holding references, the first "root_stack_count" in use. */
+  ikptr**		root_stack;
+  long			root_stack_count;
+  long			root_stack_size;
+
+  /* Linked list of the allocation buffers to empty at every collection. */
+  ik_alloc_buffer *	alloc_buffers;
+#ifdef HAVE_PTHREAD
+  /* Held while  the allocation buffers are  refilled and registered, and
+     by the  helper threads  allocating through  the PCB; see
+     "ik_alloc_lock()". */
+  pthread_mutex_t	alloc_mutex;
+#endif
+
   /* The value of "argv[0]" as handed to the "main()" function. */
   char *		argv0;
 
@@ -403,6 +611,8 @@ typedef struct ikpcb {
   ik_uint *		segment_vector;
   ikptr			weak_pairs_ap;
   ikptr			weak_pairs_ep;
+  ikptr			ephemerons_ap;
+  ikptr			ephemerons_ep;
   /* Pointer to  and number of  bytes of  the current heap  memory.  New
      objects are allocated here. */
   ikptr			heap_base;
@@ -416,9 +626,17 @@ typedef struct ikpcb {
   ikpage *		cached_pages;
   /* Linked list of cached ikpages so that we don't malloc/free. */
   ikpage *		uncached_pages;
-  /* Pointer to and size of the cached pages array. */
+  /* Pointer to and size of the cached pages array; it is sized from the
+     field "cached_pages_limit". */
   ikptr			cached_pages_base;
   int			cached_pages_size;
+  /* Number of  pages in  "cached_pages".  The  first "cached_pages_resident"
+     of them are still  backed by memory; the others have been returned to
+     the OS with "madvise()" but are still mapped. */
+  int			cached_pages_count;
+  int			cached_pages_resident;
+  /* Maximum number of cached pages left resident after a collection. */
+  int			cached_pages_limit;
   /* Pointer to and number of bytes of the current stack memory. */
   ikptr			stack_base;
   ik_ulong		stack_size;
@@ -426,15 +644,36 @@ typedef struct ikpcb {
   ikptr			symbol_table;
   /* The hash table holding interned generated symbols. */
   ikptr			gensym_table;
+  /* List of weak pairs  referencing the buckets vectors of  weak tables;
+     the collector unlinks their dead entries.  See
+     "ikrt_register_ephemeron_table()". */
+  ikptr			ephemeron_tables;
   /* Array of linked lists; one for each GC generation.  The linked list
      holds  references  to  Scheme  values  that  must  not  be  garbage
      collected  even   when  they   are  not  referenced,   for  example
      guardians. */
   ik_ptr_page*		protected_list[generation_count];
+  /* Linked list of  unused "ik_ptr_page" nodes; the garbage  collector
+     builds  and discards  many  such  nodes while  handling guardians,
+     caching them avoids a "mmap()" and a "munmap()" for each one. */
+  ik_ptr_page*		ptr_pages_cache;
+  /* Number of nodes in "ptr_pages_cache". */
+  long			ptr_pages_cached;
+  /* Linked list of guardian pairs  whose object was found dead by the
+     collections, not yet appended to  their tconc; they are delivered in
+     batches by "ikrt_deliver_guardians()" after the collection. */
+  ik_ptr_page*		guardians_pending;
+  /* The isolate running  this PCB, an "ik_isolate_t" structure private
+     to "ikarus-isolates.c"; NULL if isolates are not supported. */
+  void *		isolate;
   ik_uint *		dirty_vector_base;
   ik_uint *		segment_vector_base;
   ikptr			memory_base;
   ikptr			memory_end;
+  /* Number of  pages registered in  "segment_vector" with a  type other
+     than "hole_mt":  the pages in use by  the heap of this PCB.  Updated
+     whenever pages are registered or released. */
+  long			heap_pages_count;
 
   /* Number of garbage collections performed so far.  It is used: at the
      beginning of  a GC  run, to determine  which objects  generation to
@@ -450,40 +689,113 @@ typedef struct ikpcb {
   struct timeval	collect_stime;
   struct timeval	collect_rtime;
 
-  /* Collection of objects not to be collected. */
-  void *		not_to_be_collected;
+  /* Number of  threads used by  the garbage collector to  sweep the page
+     tables: 0 or 1 means sweep sequentially, in the calling thread. */
+  int			sweep_threads;
+
+  /* Number of  threads decoding the  sections of an  indexed boot image:
+     0 or 1 means decode them sequentially, in the calling thread. */
+  int			fasl_load_threads;
+
+  /* Policy used  by "ik_collect()" to select the  generation to collect:
+     IK_GC_POLICY_FIXED  selects it from  "collection_id";  IK_GC_POLICY_ADAPTIVE
+     selects it from the occupancy of the generations. */
+  int			collect_policy;
+  /* Number of bytes moved into each generation since the last time it was
+     collected. */
+  long			gen_occupancy[generation_count];
+  /* Occupancy above which the adaptive policy collects a generation; the
+     slot for the nursery is unused. */
+  long			gen_threshold[generation_count];
+  /* Survival rate, in thousandths, of the last collection of each
+     generation. */
+  int			gen_survival[generation_count];
+  /* Number of bytes surviving the last collection of the oldest
+     generation. */
+  long			gen_major_live;
+
+  /* Size of the  heap segment allocated as nursery  by "ik_collect()".  It
+     is  doubled  or halved  to  keep  the  fraction  of real  time spent
+     collecting near "collect_time_target". */
+  long			nursery_size;
+  /* Target ratio, in thousandths,  between the real time spent collecting
+     and the total real time; zero disables the adaptation of the nursery
+     size. */
+  int			collect_time_target;
+  /* Moving average  of the  ratio,  in thousandths, between the real time
+     spent collecting and the total real time. */
+  int			collect_time_ratio;
+  /* Timestamp of the end of the last garbage collection. */
+  struct timeval	collect_last_end;
+
+  /* When true:  the  collections of the  oldest generation  mark, rather
+     than copy, the pairs and symbols in its pages. */
+  int			collect_mark_region;
+  /* Lists of  the free pair and symbol  slots left in the pages retained
+     by the last marking collection of the oldest generation; every free
+     slot holds in its first word  the address of the next one, zero ends
+     the list.  Survivors promoted into  the oldest generation are copied
+     into these slots before new pages are allocated. */
+  ikptr			mark_region_free_pairs;
+  ikptr			mark_region_free_symbols;
+
+  /* When  greater than the generation  that would  normally receive the
+     survivors of a collection: the  survivors are moved directly into
+     this generation.  Zero disables pretenuring. */
+  int			pretenure_generation;
+
+  /* When true: the next collection inspects all the generations. */
+  int			collect_major_request;
+  /* Number of bytes in the pages of the static generation. */
+  long			static_bytes;
+
+  /* Maximum  pause, in microseconds,  a collection should cause; zero
+     means no target.  When the expected pause of the selected generation
+     exceeds it: a younger generation is collected instead. */
+  long			collect_pause_target;
+  /* Moving average  of the pause, in microseconds,  caused by collecting
+     each generation. */
+  long			gen_pause[generation_count];
+  /* Number of  consecutive times the collection of  each generation was
+     postponed because of the pause target. */
+  int			gen_deferrals[generation_count];
+
+  /* When true:  heap segments are allocated  from regions  aligned to
+     IK_HUGE_PAGE_SIZE and  backed by transparent huge pages.  Segments
+     smaller than a region are carved from the one referenced by the
+     pointers "huge_pages_ap" and "huge_pages_ep". */
+  int			huge_pages;
+  ikptr			huge_pages_ap;
+  ikptr			huge_pages_ep;
+
+  /* Ring buffer of the records describing the last garbage collections;
+     the  record of  the collection  number N is  at index  N modulo
+     IK_GC_EVENTS_COUNT.  "gc_events_count"  is the number  of records
+     written so far. */
+  ik_gc_event		gc_events[IK_GC_EVENTS_COUNT];
+  long			gc_events_count;
+
+  /* Allocation profiler.  When "alloc_sample_interval" is non-zero: the
+     field "allocation_redline" is lowered to "alloc_sample_interval" bytes
+     past the allocation  pointer, so  that the  compiled code calls the
+     overflow handler  and  a sample  is recorded;  the actual end  of the
+     usable heap segment is always in "heap_redline".  "alloc_sample_base"
+     is the allocation pointer when the profiler was last armed. */
+  ikptr			heap_redline;
+  long			alloc_sample_interval;
+  ikptr			alloc_sample_base;
+  /* Malloc'ed buffer of "alloc_samples_count" samples not yet drained;
+     the bytes of the samples not fitting in it are accumulated in
+     "alloc_samples_dropped". */
+  ik_alloc_sample *	alloc_samples;
+  long			alloc_samples_count;
+  long			alloc_samples_dropped;
+
+  /* Registry of objects not to be collected. */
+  ik_gc_avoidance_registry_t	not_to_be_collected;
 
 } ikpcb;
 
-/* The garbage collection avoidance list  is a linked list of structures
-   managed as a stack.  Allocated  structures are never released, so the
-   stack continues to grow and never shrinks.
-
-   Every structure contains  an array of machine words that  is meant to
-   hold references to  "ikptr" values not to be garbage  collected; if a
-   slot in the array is not IK_VOID: it contains a "ikptr" value.
-
-   Adding values requires a linear search for a NULL slot and this sucks
-   plenty; but this  way: the sweep of the garbage  collector is as fast
-   as  possible, removing  values requires  only a  pointer indirection,
-   memory consumption is as small as possible.
-
-   The  arrays implicitly  associate  the memory  pointer  in which  the
-   "ikptr" is  stored to  the "ikptr"  value itself;  this is  useful to
-   store references to  to "ikptr" values in data  structures managed by
-   foreign C language libraries. */
-
-#define IK_GC_AVOIDANCE_ARRAY_LEN	((4096/sizeof(void *)) - 1)
-
-typedef struct ik_gc_avoidance_collection_t	ik_gc_avoidance_collection_t;
-struct ik_gc_avoidance_collection_t {
-  /* NULL or  a pointer to  the next struct of  this type in  the linked
-     list. */
-  ik_gc_avoidance_collection_t *	next;
-  /* Pointer to the first word in the free list. */
-  ikptr		slots[IK_GC_AVOIDANCE_ARRAY_LEN];
-};
-
 /* The "ikcont"  data structure  is used  to access  Scheme continuation
    objects: given an "ikptr" reference to continuation, we subtract from
    it "continuation_primary_tag"  and the result is  an untagged pointer
@@ -544,6 +856,9 @@ typedef struct ikcont {
  ** ----------------------------------------------------------------- */
 
 ik_decl ikpcb *		ik_collect		(unsigned long, ikpcb*);
+ik_private_decl void	ik_alloc_sample_record	(ikpcb* pcb);
+ik_private_decl void	ik_alloc_sample_arm	(ikpcb* pcb);
+ik_private_decl void	ik_alloc_sample_carry	(ikpcb* pcb, ikptr segment, long carried);
 ik_private_decl void	ik_verify_integrity	(ikpcb* pcb, char*);
 
 ik_private_decl void*	ik_malloc		(int);
@@ -556,12 +871,29 @@ ik_private_decl ikptr	ik_mmap_data		(unsigned long size, int gen, ikpcb*);
 ik_private_decl ikptr	ik_mmap_code		(unsigned long size, int gen, ikpcb*);
 ik_private_decl ikptr	ik_mmap_mixed		(unsigned long size, ikpcb*);
 ik_private_decl void	ik_munmap		(ikptr, unsigned long);
-ik_private_decl ikpcb * ik_make_pcb		(void);
+ik_private_decl ikptr	ik_mmap_file		(int fd, long offset, unsigned long size, ikpcb*);
+ik_decl void	ik_push_root		(ikpcb* pcb, ikptr * root);
+ik_decl void	ik_pop_roots		(ikpcb* pcb, long count);
+ik_decl long	ik_root_stack_mark	(ikpcb* pcb);
+ik_decl void	ik_root_stack_restore	(ikpcb* pcb, long mark);
+ik_private_decl ik_ptr_page * ik_ptr_page_alloc	(ikpcb* pcb);
+ik_private_decl void	ik_ptr_page_release	(ikpcb* pcb, ik_ptr_page * page);
+ik_private_decl void	ik_release_cached_pages	(ikpcb* pcb);
+ik_private_decl long	ik_trim_cached_pages	(ikpcb* pcb);
+ik_private_decl int	ik_resize_page_cache	(ikpcb* pcb, int limit);
+ik_private_decl long	ik_heap_bytes		(ikpcb* pcb);
+ik_private_decl ikpcb * ik_make_pcb		(const ik_runtime_options_t * options);
 ik_private_decl void	ik_delete_pcb		(ikpcb*);
 ik_private_decl void	ik_free_symbol_table	(ikpcb* pcb);
+ik_private_decl void	ik_isolates_init	(ikpcb* pcb, char* boot_file);
+ik_private_decl long	ik_isolates_running	(void);
+ik_private_decl void	ik_isolate_exit		(ikpcb* pcb, int status);
 
 ik_private_decl void	ik_fasl_load		(ikpcb* pcb, char* filename);
 ik_private_decl void	ik_relocate_code	(ikptr);
+ik_private_decl int	ik_heap_image_run	(ikpcb* pcb, char* filename);
+ik_private_decl int	ik_fasl_load_mapped	(ikpcb* pcb, char* filename);
+ik_private_decl void	ik_tcbucket_requeue	(ikpcb* pcb, ikptr s_tcbucket);
 
 ik_private_decl ikptr	ik_exec_code		(ikpcb* pcb, ikptr code_ptr, ikptr argcount, ikptr cp);
 
@@ -579,6 +911,7 @@ ik_private_decl void	ik_underflow_handler	(void);
  ** ----------------------------------------------------------------- */
 
 ik_decl ikpcb *	ik_the_pcb		(void);
+ik_private_decl void	ik_set_the_pcb		(ikpcb * pcb);
 
 ik_decl int	ik_abort		(const char * error_message, ...);
 ik_decl void	ik_error		(ikptr args);
@@ -588,6 +921,25 @@ ik_decl void	ik_debug_message_no_newline (const char * error_message, ...);
 
 ik_decl ikptr	ik_unsafe_alloc		(ikpcb* pcb, ik_ulong size);
 ik_decl ikptr	ik_safe_alloc		(ikpcb* pcb, ik_ulong size);
+ik_decl void	ik_alloc_buffer_register	(ikpcb* pcb, ik_alloc_buffer * buf);
+ik_decl void	ik_alloc_buffer_unregister	(ikpcb* pcb, ik_alloc_buffer * buf);
+ik_decl ikptr	ik_alloc_buffer_refill		(ikpcb* pcb, ik_alloc_buffer * buf, ik_ulong size);
+ik_decl void	ik_alloc_lock			(ikpcb* pcb);
+ik_decl void	ik_alloc_unlock			(ikpcb* pcb);
+
+static inline ikptr
+ik_buffer_alloc (ikpcb * pcb, ik_alloc_buffer * buf, ik_ulong size)
+/* Allocate SIZE  bytes, filtered  through "IK_ALIGN()", from  BUF and
+   return an *untagged* pointer; refill BUF when exhausted, which never
+   runs a garbage collection. */
+{
+  ikptr	ap = buf->ap;
+  if (ap + size <= buf->ep) {
+    buf->ap = ap + size;
+    return ap;
+  } else
+    return ik_alloc_buffer_refill(pcb, buf, size);
+}
 
 ik_decl void	ik_print		(ikptr x);
 ik_decl void	ik_print_no_newline	(ikptr x);
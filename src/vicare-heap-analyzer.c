@@ -0,0 +1,606 @@
+/*
+ * Vicare Scheme -- heap snapshot analyzer
+ *
+ * This program is free software:  you can redistribute it and/or modify
+ * it under  the terms of  the GNU General  Public License version  3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is  distributed in the hope that it  will be useful, but
+ * WITHOUT  ANY   WARRANTY;  without   even  the  implied   warranty  of
+ * MERCHANTABILITY  or FITNESS FOR  A PARTICULAR  PURPOSE.  See  the GNU
+ * General Public License for more details.
+ *
+ * You should  have received  a copy of  the GNU General  Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Read a heap snapshot  written by  "gc-heap-snapshot", compute the
+   dominator tree of the object graph with the Lengauer-Tarjan algorithm
+   and print the retained sizes:  by type, by record type and closure
+   code, of the biggest single objects and of the global symbols.
+
+   Usage: vicare-heap-analyzer [--top COUNT] SNAPSHOT-FILE */
+
+
+/** --------------------------------------------------------------------
+ ** Headers.
+ ** ----------------------------------------------------------------- */
+
+#ifdef HAVE_CONFIG_H
+#  include <config.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include "vicare-heap-snapshot.h"
+
+#define NONE		(-1)
+
+static const char * type_names[IK_SNAPSHOT_TYPE_COUNT] = {
+  "roots", "pair", "weak-pair", "vector", "string", "bytevector", "symbol",
+  "record", "closure", "code", "continuation", "tcbucket", "port", "number",
+  "pointer", "ephemeron"
+};
+
+typedef struct node_t {
+  uint64_t	address;
+  uint64_t	size;
+  uint64_t	retained;
+  /* Index of the node of the class, or NONE. */
+  long		class;
+  /* Offset of the name in the names buffer, or NONE. */
+  long		name;
+  /* Index of the first reference in the references array. */
+  long		refs;
+  long		refs_count;
+  int		type;
+} node_t;
+
+typedef struct heap_t {
+  node_t *	nodes;
+  long		nodes_count;
+  long		root;
+  /* Indexes of the referenced nodes, NONE for unknown addresses. */
+  long *	refs;
+  long		refs_count;
+  /* Hash table mapping addresses to node indexes. */
+  long *	table;
+  uint64_t	table_mask;
+  /* NUL-terminated names. */
+  char *	names;
+  long		names_len;
+  /* Non-zero for the nodes reachable from the roots. */
+  char *	live;
+  /* Immediate dominators and depth first numbering. */
+  long *	idom;
+  long *	order;
+  long		order_count;
+} heap_t;
+
+static void
+fail (const char * message, const char * arg)
+{
+  fprintf(stderr, "vicare-heap-analyzer: %s%s%s\n", message, (arg)? ": " : "", (arg)? arg : "");
+  exit(EXIT_FAILURE);
+}
+static void *
+xmalloc (size_t size)
+{
+  void *	p = malloc(size? size : 1);
+  if (NULL == p)
+    fail("memory allocation failed", NULL);
+  return p;
+}
+
+
+/** --------------------------------------------------------------------
+ ** Reading the snapshot.
+ ** ----------------------------------------------------------------- */
+
+typedef struct reader_t {
+  const unsigned char *	p;
+  const unsigned char *	end;
+} reader_t;
+
+static void
+need (reader_t * R, size_t n)
+{
+  if ((size_t)(R->end - R->p) < n)
+    fail("truncated snapshot", NULL);
+}
+static unsigned
+get_u8 (reader_t * R)
+{
+  need(R, 1);
+  return *(R->p++);
+}
+static uint32_t
+get_u32 (reader_t * R)
+{
+  uint32_t	v;
+  need(R, sizeof(v));
+  memcpy(&v, R->p, sizeof(v));
+  R->p += sizeof(v);
+  return v;
+}
+static uint64_t
+get_u64 (reader_t * R)
+{
+  uint64_t	v;
+  need(R, sizeof(v));
+  memcpy(&v, R->p, sizeof(v));
+  R->p += sizeof(v);
+  return v;
+}
+static uint64_t
+hash_address (uint64_t address)
+{
+  return (address >> 3) * 0x9E3779B97F4A7C15ULL;
+}
+static long
+lookup (heap_t * H, uint64_t address)
+{
+  uint64_t	i = hash_address(address) & H->table_mask;
+  for (; NONE != H->table[i]; i = (i + 1) & H->table_mask)
+    if (H->nodes[H->table[i]].address == address)
+      return H->table[i];
+  return NONE;
+}
+static void
+insert (heap_t * H, uint64_t address, long idx)
+{
+  uint64_t	i = hash_address(address) & H->table_mask;
+  for (; NONE != H->table[i]; i = (i + 1) & H->table_mask)
+    ;
+  H->table[i] = idx;
+}
+static void
+read_snapshot (heap_t * H, const unsigned char * data, size_t size)
+{
+  reader_t	R = { data, data + size };
+  long		pass, i;
+  if ((size < 16) || memcmp(data, IK_SNAPSHOT_MAGIC, strlen(IK_SNAPSHOT_MAGIC)))
+    fail("not a heap snapshot", NULL);
+  /* First pass: count the objects,  the references and the bytes of the
+     names.  Second pass: fill the nodes.  Third pass: resolve the names
+     and the references, which can precede the referenced object. */
+  for (pass=0; pass<3; ++pass) {
+    long	node = 0, ref = 0;
+    R.p = data + strlen(IK_SNAPSHOT_MAGIC) + 2 * sizeof(uint32_t);
+    for (;;) {
+      unsigned	kind = get_u8(&R);
+      if (IK_SNAPSHOT_END == kind) {
+	break;
+      } else if (IK_SNAPSHOT_OBJECT == kind) {
+	uint64_t	address = get_u64(&R);
+	unsigned	type	= get_u8(&R);
+	uint64_t	bytes	= get_u64(&R);
+	uint64_t	class	= get_u64(&R);
+	uint32_t	count	= get_u32(&R);
+	need(&R, count * sizeof(uint64_t));
+	if (type >= IK_SNAPSHOT_TYPE_COUNT)
+	  fail("invalid object type in snapshot", NULL);
+	if (1 == pass) {
+	  node_t *	N = &(H->nodes[node]);
+	  N->address	= address;
+	  N->type	= type;
+	  N->size	= bytes;
+	  N->retained	= bytes;
+	  N->class	= NONE;
+	  N->name	= NONE;
+	  N->refs	= ref;
+	  N->refs_count	= count;
+	  if (NONE == lookup(H, address))
+	    insert(H, address, node);
+	  if (IK_SNAPSHOT_TYPE_ROOTS == type)
+	    H->root = node;
+	} else if (2 == pass) {
+	  node_t *	N = &(H->nodes[node]);
+	  if (class)
+	    N->class = lookup(H, class);
+	  for (i=0; i<(long)count; ++i)
+	    H->refs[ref + i] = lookup(H, get_u64(&R));
+	}
+	if (2 != pass)
+	  R.p += count * sizeof(uint64_t);
+	++node;
+	ref += count;
+      } else if (IK_SNAPSHOT_NAME == kind) {
+	uint64_t	address = get_u64(&R);
+	uint32_t	len	= get_u32(&R);
+	need(&R, len);
+	if (0 == pass) {
+	  H->names_len += len + 1;
+	} else if (2 == pass) {
+	  long	idx = lookup(H, address);
+	  if ((NONE != idx) && (NONE == H->nodes[idx].name)) {
+	    H->nodes[idx].name = H->names_len;
+	    memcpy(H->names + H->names_len, R.p, len);
+	    H->names_len += len;
+	    H->names[H->names_len++] = '\0';
+	  }
+	}
+	R.p += len;
+      } else
+	fail("invalid record in snapshot", NULL);
+    }
+    if (0 == pass) {
+      uint64_t	capacity = 1024;
+      while (capacity < 2 * (uint64_t)node)
+	capacity *= 2;
+      H->nodes_count	= node;
+      H->refs_count	= ref;
+      H->nodes		= xmalloc(node * sizeof(node_t));
+      H->refs		= xmalloc(ref  * sizeof(long));
+      H->table		= xmalloc(capacity * sizeof(long));
+      H->table_mask	= capacity - 1;
+      H->names		= xmalloc(H->names_len);
+      H->names_len	= 0;
+      H->root		= NONE;
+      for (i=0; i<(long)capacity; ++i)
+	H->table[i] = NONE;
+    }
+  }
+  if (NONE == H->root)
+    fail("snapshot without roots", NULL);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Reachability.
+ ** ----------------------------------------------------------------- */
+
+static long
+edge_target (heap_t * H, node_t * N, long i)
+/* Return the node referenced by the I-th edge of N, or NONE if there is
+   none or the edge does not retain it.  The key of an ephemeron is never
+   retained, its value only if the key is live or not a heap object. */
+{
+  if (IK_SNAPSHOT_TYPE_EPHEMERON == N->type) {
+    long	key = H->refs[N->refs];
+    if ((0 == i) || ((NONE != key) && !H->live[key]))
+      return NONE;
+  }
+  return H->refs[N->refs + i];
+}
+static void
+mark_live (heap_t * H)
+/* Mark the nodes reachable from the roots.  When no strong edge is left
+   to follow,  look for ephemerons whose key has been marked meanwhile
+   and follow their value; repeat until nothing more is marked. */
+{
+  long		n     = H->nodes_count;
+  long *	stack = xmalloc(n * sizeof(long));
+  long		top   = 0, i, v;
+  H->live = xmalloc(n);
+  memset(H->live, 0, n);
+  H->live[H->root] = 1;
+  stack[top++]	   = H->root;
+  while (top) {
+    while (top) {
+      node_t *	N = &(H->nodes[stack[--top]]);
+      for (i=0; i<N->refs_count; ++i) {
+	long	child = edge_target(H, N, i);
+	if ((NONE != child) && !H->live[child]) {
+	  H->live[child] = 1;
+	  stack[top++]	 = child;
+	}
+      }
+    }
+    for (v=0; v<n; ++v) {
+      node_t *	N = &(H->nodes[v]);
+      if (H->live[v] && (IK_SNAPSHOT_TYPE_EPHEMERON == N->type) && (2 == N->refs_count)) {
+	long	child = edge_target(H, N, 1);
+	if ((NONE != child) && !H->live[child]) {
+	  H->live[child] = 1;
+	  stack[top++]	 = child;
+	}
+      }
+    }
+  }
+  free(stack);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Dominators.
+ ** ----------------------------------------------------------------- */
+
+/* Lengauer-Tarjan with path compression; nodes are renumbered in depth
+   first order from the roots and all the arrays below are indexed by
+   such numbers.  Only the edges selected by "edge_target()" are walked,
+   so "mark_live()" must have been called. */
+
+static long
+eval_ancestor (long v, long * ancestor, long * label, long * semi, long * stack)
+{
+  long	top = 0, u;
+  if (NONE == ancestor[v])
+    return v;
+  /* Collect the path to the root of the forest, then compress it. */
+  for (u = v; NONE != ancestor[ancestor[u]]; u = ancestor[u])
+    stack[top++] = u;
+  while (top) {
+    u = stack[--top];
+    if (semi[label[ancestor[u]]] < semi[label[u]])
+      label[u] = label[ancestor[u]];
+    ancestor[u] = ancestor[ancestor[u]];
+  }
+  return label[v];
+}
+static void
+compute_dominators (heap_t * H)
+{
+  long		n	  = H->nodes_count;
+  long *	dfnum	  = xmalloc(n * sizeof(long));
+  long *	vertex	  = xmalloc(n * sizeof(long));
+  long *	parent	  = xmalloc(n * sizeof(long));
+  long *	semi	  = xmalloc(n * sizeof(long));
+  long *	ancestor  = xmalloc(n * sizeof(long));
+  long *	label	  = xmalloc(n * sizeof(long));
+  long *	idom	  = xmalloc(n * sizeof(long));
+  long *	bucket	  = xmalloc(n * sizeof(long));
+  long *	next	  = xmalloc(n * sizeof(long));
+  long *	stack	  = xmalloc(n * sizeof(long));
+  long *	edge	  = xmalloc(n * sizeof(long));
+  long *	pred_idx  = xmalloc((n + 1) * sizeof(long));
+  long *	preds;
+  long		count = 0, top = 0, i, v, w;
+  for (i=0; i<n; ++i)
+    dfnum[i] = NONE;
+  /* Iterative depth first search from the roots. */
+  dfnum[H->root]  = count;
+  vertex[count]	  = H->root;
+  parent[count++] = NONE;
+  stack[top]	  = H->root;
+  edge[top++]	  = 0;
+  while (top) {
+    node_t *	N = &(H->nodes[stack[top-1]]);
+    if (edge[top-1] < N->refs_count) {
+      long	child = edge_target(H, N, edge[top-1]++);
+      if ((NONE != child) && (NONE == dfnum[child])) {
+	dfnum[child]	= count;
+	vertex[count]	= child;
+	parent[count++]	= dfnum[stack[top-1]];
+	stack[top]	= child;
+	edge[top++]	= 0;
+      }
+    } else
+      --top;
+  }
+  /* Predecessors, by depth first number. */
+  for (i=0; i<=count; ++i)
+    pred_idx[i] = 0;
+  for (v=0; v<count; ++v) {
+    node_t *	N = &(H->nodes[vertex[v]]);
+    for (i=0; i<N->refs_count; ++i)
+      if (NONE != (w = edge_target(H, N, i)))
+	++pred_idx[dfnum[w] + 1];
+  }
+  for (i=0; i<count; ++i)
+    pred_idx[i+1] += pred_idx[i];
+  preds = xmalloc((pred_idx[count] + 1) * sizeof(long));
+  for (i=0; i<count; ++i)
+    edge[i] = pred_idx[i];
+  for (v=0; v<count; ++v) {
+    node_t *	N = &(H->nodes[vertex[v]]);
+    for (i=0; i<N->refs_count; ++i)
+      if (NONE != (w = edge_target(H, N, i))) {
+	w = dfnum[w];
+	preds[edge[w]++] = v;
+      }
+  }
+  for (v=0; v<count; ++v) {
+    semi[v]	= v;
+    label[v]	= v;
+    ancestor[v]	= NONE;
+    idom[v]	= NONE;
+    bucket[v]	= NONE;
+  }
+  for (w=count-1; w>0; --w) {
+    long	p = parent[w];
+    for (i=pred_idx[w]; i<pred_idx[w+1]; ++i) {
+      long	u = eval_ancestor(preds[i], ancestor, label, semi, stack);
+      if (semi[u] < semi[w])
+	semi[w] = semi[u];
+    }
+    next[w]	      = bucket[semi[w]];
+    bucket[semi[w]]   = w;
+    ancestor[w]	      = p;
+    for (v = bucket[p]; NONE != v; v = next[v]) {
+      long	u = eval_ancestor(v, ancestor, label, semi, stack);
+      idom[v] = (semi[u] < semi[v])? u : p;
+    }
+    bucket[p] = NONE;
+  }
+  for (w=1; w<count; ++w)
+    if (idom[w] != semi[w])
+      idom[w] = idom[idom[w]];
+  /* Store the results by node index. */
+  H->idom	 = xmalloc(n * sizeof(long));
+  H->order	 = xmalloc(count * sizeof(long));
+  H->order_count = count;
+  for (i=0; i<n; ++i)
+    H->idom[i] = NONE;
+  for (w=0; w<count; ++w) {
+    H->order[w] = vertex[w];
+    if (w)
+      H->idom[vertex[w]] = vertex[idom[w]];
+  }
+  /* Retained sizes: every node is numbered after its dominator. */
+  for (w=count-1; w>0; --w)
+    H->nodes[H->idom[vertex[w]]].retained += H->nodes[vertex[w]].retained;
+  free(dfnum); free(vertex); free(parent); free(semi); free(ancestor);
+  free(label); free(idom); free(bucket); free(next); free(stack); free(edge);
+  free(pred_idx); free(preds);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Reports.
+ ** ----------------------------------------------------------------- */
+
+typedef struct entry_t {
+  long		key;
+  long		count;
+  uint64_t	size;
+  uint64_t	retained;
+} entry_t;
+
+static int
+compare_retained (const void * a, const void * b)
+{
+  uint64_t	x = ((const entry_t *)a)->retained;
+  uint64_t	y = ((const entry_t *)b)->retained;
+  return (x < y)? 1 : ((x > y)? -1 : 0);
+}
+static const char *
+node_name (heap_t * H, long idx)
+{
+  return ((NONE != idx) && (NONE != H->nodes[idx].name))? (H->names + H->nodes[idx].name) : "?";
+}
+static long
+class_key (heap_t * H, long idx)
+/* Return the node  index of the class of IDX for records and closures,
+   else its type code negated minus one. */
+{
+  node_t *	N = &(H->nodes[idx]);
+  if (((IK_SNAPSHOT_TYPE_RECORD == N->type) || (IK_SNAPSHOT_TYPE_CLOSURE == N->type)) && (NONE != N->class))
+    return N->class;
+  return -1 - N->type;
+}
+static void
+print_key (heap_t * H, long key)
+{
+  if (key < 0)
+    printf("%s", type_names[-1 - key]);
+  else if (IK_SNAPSHOT_TYPE_CODE == H->nodes[key].type)
+    printf("closure %s", node_name(H, key));
+  else
+    printf("record %s", node_name(H, key));
+}
+static void
+report_classes (heap_t * H, long top)
+/* Print the classes  with the biggest retained sizes; an object counts
+   toward the retained size of its class unless its dominator belongs to
+   the same class, so that nested instances are not counted twice. */
+{
+  long		n = H->nodes_count, i, w, used = 0;
+  /* Entry of every class node and of every plain type. */
+  long *	slot = xmalloc(n * sizeof(long));
+  long		type_slot[IK_SNAPSHOT_TYPE_COUNT];
+  entry_t *	entries = xmalloc((n + IK_SNAPSHOT_TYPE_COUNT) * sizeof(entry_t));
+  for (i=0; i<n; ++i)
+    slot[i] = NONE;
+  for (i=0; i<IK_SNAPSHOT_TYPE_COUNT; ++i)
+    type_slot[i] = NONE;
+  for (w=1; w<H->order_count; ++w) {
+    long	v   = H->order[w];
+    long	key = class_key(H, v);
+    long *	S   = (key < 0)? &(type_slot[-1 - key]) : &(slot[key]);
+    entry_t *	E;
+    if (NONE == *S) {
+      *S = used++;
+      entries[*S].key	   = key;
+      entries[*S].count	   = 0;
+      entries[*S].size	   = 0;
+      entries[*S].retained = 0;
+    }
+    E = &(entries[*S]);
+    E->count++;
+    E->size += H->nodes[v].size;
+    if (class_key(H, H->idom[v]) != key)
+      E->retained += H->nodes[v].retained;
+  }
+  qsort(entries, used, sizeof(entry_t), compare_retained);
+  printf("\n%14s %14s %10s  %s\n", "retained", "shallow", "count", "class");
+  for (i=0; (i<used) && (i<top); ++i) {
+    printf("%14llu %14llu %10ld  ", (unsigned long long)entries[i].retained,
+	   (unsigned long long)entries[i].size, entries[i].count);
+    print_key(H, entries[i].key);
+    printf("\n");
+  }
+  free(slot);
+  free(entries);
+}
+static void
+report_objects (heap_t * H, long top, int type, const char * title)
+/* Print the  objects with the biggest retained sizes; if TYPE is not
+   NONE: only the objects of such type. */
+{
+  long		i, used = 0;
+  entry_t *	entries = xmalloc(H->order_count * sizeof(entry_t));
+  for (i=1; i<H->order_count; ++i) {
+    long	v = H->order[i];
+    if ((NONE != type) && (type != H->nodes[v].type))
+      continue;
+    entries[used].key	   = v;
+    entries[used].retained = H->nodes[v].retained;
+    ++used;
+  }
+  qsort(entries, used, sizeof(entry_t), compare_retained);
+  printf("\n%14s %18s  %s\n", "retained", "address", title);
+  for (i=0; (i<used) && (i<top); ++i) {
+    long	v = entries[i].key;
+    printf("%14llu 0x%016llx  ", (unsigned long long)entries[i].retained,
+	   (unsigned long long)H->nodes[v].address);
+    if (NONE != H->nodes[v].name)
+      printf("%s %s", type_names[H->nodes[v].type], node_name(H, v));
+    else
+      print_key(H, class_key(H, v));
+    printf("\n");
+  }
+  free(entries);
+}
+
+
+/** --------------------------------------------------------------------
+ ** Main.
+ ** ----------------------------------------------------------------- */
+
+int
+main (int argc, char ** argv)
+{
+  heap_t		H;
+  const char *		pathname = NULL;
+  long			top	 = 20;
+  FILE *		stream;
+  unsigned char *	data;
+  long			size;
+  int			i;
+  for (i=1; i<argc; ++i) {
+    if ((0 == strcmp(argv[i], "--top")) && (i+1 < argc)) {
+      top = strtol(argv[++i], NULL, 10);
+      if (top <= 0)
+	fail("invalid argument to option --top", argv[i]);
+    } else if (NULL == pathname)
+      pathname = argv[i];
+    else
+      fail("usage: vicare-heap-analyzer [--top COUNT] SNAPSHOT-FILE", NULL);
+  }
+  if (NULL == pathname)
+    fail("usage: vicare-heap-analyzer [--top COUNT] SNAPSHOT-FILE", NULL);
+  stream = fopen(pathname, "rb");
+  if ((NULL == stream) || fseek(stream, 0, SEEK_END) || (0 > (size = ftell(stream))))
+    fail(strerror(errno), pathname);
+  rewind(stream);
+  data = xmalloc(size);
+  if ((size_t)size != fread(data, 1, size, stream))
+    fail("error reading snapshot", pathname);
+  fclose(stream);
+  memset(&H, 0, sizeof(heap_t));
+  read_snapshot(&H, data, size);
+  free(data);
+  mark_live(&H);
+  compute_dominators(&H);
+  printf("objects: %ld, reachable: %ld, bytes: %llu\n", H.nodes_count - 1, H.order_count - 1,
+	 (unsigned long long)H.nodes[H.root].retained);
+  report_classes(&H, top);
+  report_objects(&H, top, NONE, "object");
+  report_objects(&H, top, IK_SNAPSHOT_TYPE_SYMBOL, "global");
+  return EXIT_SUCCESS;
+}
+
+/* end of file */
@@ -0,0 +1,77 @@
+/*
+ * Vicare Scheme -- heap snapshots
+ *
+ * This program is free software:  you can redistribute it and/or modify
+ * it under  the terms of  the GNU General  Public License version  3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is  distributed in the hope that it  will be useful, but
+ * WITHOUT  ANY   WARRANTY;  without   even  the  implied   warranty  of
+ * MERCHANTABILITY  or FITNESS FOR  A PARTICULAR  PURPOSE.  See  the GNU
+ * General Public License for more details.
+ *
+ * You should  have received  a copy of  the GNU General  Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Format of  the heap snapshot files written  by "ikrt_gc_heap_snapshot()"
+   and read by "vicare-heap-analyzer".  All the integers are unsigned,
+   in the byte order of the machine that wrote the file; addresses are
+   always stored as 64-bit words.
+
+   The file starts with the 8 bytes of IK_SNAPSHOT_MAGIC, followed by a
+   32-bit word holding the word size of the writer and a reserved 32-bit
+   word.  Then comes a sequence of records, each introduced by one byte:
+
+   IK_SNAPSHOT_OBJECT
+      64-bit address of the object (the tagged reference); 8-bit type,
+      one of the IK_SNAPSHOT_TYPE_* codes; 64-bit size in bytes; 64-bit
+      address of the class of the object (the type descriptor of records
+      and structs, the code object of closures, zero otherwise); 32-bit
+      number N of references; N 64-bit addresses of the referenced
+      objects.  The pseudo object with address zero and type
+      IK_SNAPSHOT_TYPE_ROOTS references the roots of the heap.
+
+      The references of an IK_SNAPSHOT_TYPE_EPHEMERON are its key and
+      its value, in this order; both are weak edges:  the key is not
+      retained by the ephemeron, the value is retained only if the key
+      is reachable through other edges.  The car of an
+      IK_SNAPSHOT_TYPE_WEAK_PAIR is not listed at all.
+
+   IK_SNAPSHOT_NAME
+      64-bit address of an object, 32-bit length L, L bytes of UTF-8 name.
+      Written for symbols, code objects and type descriptors.
+
+   IK_SNAPSHOT_END
+      Nothing follows. */
+
+#ifndef VICARE_HEAP_SNAPSHOT_H
+#define VICARE_HEAP_SNAPSHOT_H
+
+#define IK_SNAPSHOT_MAGIC		"VKHEAP01"
+
+#define IK_SNAPSHOT_OBJECT		'O'
+#define IK_SNAPSHOT_NAME		'N'
+#define IK_SNAPSHOT_END			'E'
+
+#define IK_SNAPSHOT_TYPE_ROOTS		0
+#define IK_SNAPSHOT_TYPE_PAIR		1
+#define IK_SNAPSHOT_TYPE_WEAK_PAIR	2
+#define IK_SNAPSHOT_TYPE_VECTOR		3
+#define IK_SNAPSHOT_TYPE_STRING		4
+#define IK_SNAPSHOT_TYPE_BYTEVECTOR	5
+#define IK_SNAPSHOT_TYPE_SYMBOL		6
+#define IK_SNAPSHOT_TYPE_RECORD		7
+#define IK_SNAPSHOT_TYPE_CLOSURE	8
+#define IK_SNAPSHOT_TYPE_CODE		9
+#define IK_SNAPSHOT_TYPE_CONTINUATION	10
+#define IK_SNAPSHOT_TYPE_TCBUCKET	11
+#define IK_SNAPSHOT_TYPE_PORT		12
+#define IK_SNAPSHOT_TYPE_NUMBER		13
+#define IK_SNAPSHOT_TYPE_POINTER	14
+#define IK_SNAPSHOT_TYPE_EPHEMERON	15
+#define IK_SNAPSHOT_TYPE_COUNT		16
+
+#endif /* VICARE_HEAP_SNAPSHOT_H */
+
+/* end of file */
@@ -76,6 +76,17 @@
 #define IK_ASS(LEFT,RIGHT)	\
   { ikptr s_tmp = (RIGHT); (LEFT) = s_tmp; }
 
+/* Register the location VAR as  root for the garbage collector, so that
+   the value it holds is not collected and its references are updated;
+   undo it with "ik_pop_roots()".  Between IK_BEGIN_ROOTS and IK_END_ROOTS
+   the roots pushed are popped at the end of the block; do not leave the
+   block with "return" or "goto". */
+#define IK_PUSH_ROOT(PCB,VAR)	ik_push_root((PCB), &(VAR))
+#define IK_BEGIN_ROOTS(PCB)	\
+  { long ik_root_stack_mark_ = ik_root_stack_mark(PCB);
+#define IK_END_ROOTS(PCB)	\
+  ik_root_stack_restore((PCB), ik_root_stack_mark_); }
+
 
 /** --------------------------------------------------------------------
  ** Global data types.
@@ -125,6 +136,21 @@ typedef struct ikpcb {
   /* Other fields not useful in the public API. */
 } ikpcb;
 
+/* An allocation buffer is a block of the nursery reserved to a single
+   execution context, from  which it allocates by bumping  "ap" without
+   touching the PCB; when the block  is exhausted it is refilled by
+   "ik_alloc_buffer_refill()".  A collection empties all the registered
+   buffers. */
+typedef struct ik_alloc_buffer {
+  /* Next free byte and end of the reserved block; both zero when empty. */
+  ikptr				ap;
+  ikptr				ep;
+  /* Number of refills since registration. */
+  long				refills;
+  /* Next buffer registered in the PCB. */
+  struct ik_alloc_buffer *	next;
+} ik_alloc_buffer;
+
 
 /** --------------------------------------------------------------------
  ** Function prototypes.
@@ -139,6 +165,30 @@ ik_decl void	ik_debug_message	(const char * error_message, ...);
 ik_decl ikptr	ik_unsafe_alloc		(ikpcb* pcb, ik_ulong size);
 ik_decl ikptr	ik_safe_alloc		(ikpcb* pcb, ik_ulong size);
 
+ik_decl void	ik_push_root		(ikpcb* pcb, ikptr * root);
+ik_decl void	ik_pop_roots		(ikpcb* pcb, long count);
+ik_decl long	ik_root_stack_mark	(ikpcb* pcb);
+ik_decl void	ik_root_stack_restore	(ikpcb* pcb, long mark);
+ik_decl void	ik_alloc_buffer_register	(ikpcb* pcb, ik_alloc_buffer * buf);
+ik_decl void	ik_alloc_buffer_unregister	(ikpcb* pcb, ik_alloc_buffer * buf);
+ik_decl ikptr	ik_alloc_buffer_refill		(ikpcb* pcb, ik_alloc_buffer * buf, ik_ulong size);
+ik_decl void	ik_alloc_lock			(ikpcb* pcb);
+ik_decl void	ik_alloc_unlock			(ikpcb* pcb);
+
+static inline ikptr
+ik_buffer_alloc (ikpcb * pcb, ik_alloc_buffer * buf, ik_ulong size)
+/* Allocate SIZE  bytes, filtered  through "IK_ALIGN()", from  BUF and
+   return an *untagged* pointer; refill BUF when exhausted, which never
+   runs a garbage collection. */
+{
+  ikptr	ap = buf->ap;
+  if (ap + size <= buf->ep) {
+    buf->ap = ap + size;
+    return ap;
+  } else
+    return ik_alloc_buffer_refill(pcb, buf, size);
+}
+
 ik_decl void	ik_print		(ikptr x);
 ik_decl void	ik_print_no_newline	(ikptr x);
 ik_decl void	ik_fprint		(FILE*, ikptr x);